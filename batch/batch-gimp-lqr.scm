@@ -57,7 +57,18 @@
 		pres_layer_name		;(STRING "pres-layer-name" "Preservation layer name (overcomes pres-layer)")
 		disc_layer_name		;(STRING "disc-layer-name" "Discard layer name (overcomes disc-layer)")
 		""			;(STRING "rigmask-layer-name" "Rigidity mask layer name (overcomes rigmask-layer)"))
-		layer_name		;(STRING "selected-layer-name" "Selected layer name (overcomes the active layer)"))
+		layer_name		;(STRING "selected-layer-name" "Selected layer name (overcomes the active layer)")
+		""			;(STRING "seams-file" "File to write the seam map(s) to (empty for none)")
+		1			;(INT "proxy-factor" "Search the seams on a copy scaled down by this factor (1 for none)")
+		0			;(INT "memory-limit" "Memory limit in MiB (0 for none)")
+		0			;(INT "prescale-mode" "Plain scaling before carving: none (0), automatic (1), by prescale-ratio (2)")
+		1			;(FLOAT "prescale-ratio" "Scaling ratio for prescale mode 2")
+		0			;(INT "max-seconds" "Time budget in seconds (0 for none)")
+		0			;(INT "backend" "Seam search backend: liblqr (0), threaded (1)")
+		0			;(INT "threads" "Threads of the threaded backend and of independent layers (0 for one per processor)")
+		0			;(INT "all-layers" "Carve the other layers along: none (0), all (1), the group of the selected layer (2)")
+		0			;(INT "independent-layers" "Whether to carve each of the other layers with its own seams")
+		0			;(INT "energy-cache" "Size limit in MiB of the energy map cache of the threaded backend (0 for none)"))
                 )
     (set! drawable (car (gimp-image-get-active-layer image)))
     (gimp-file-save RUN-NONINTERACTIVE image drawable filename filename)
@@ -123,7 +134,18 @@
 		pres_layer_name		;(STRING "pres-layer-name" "Preservation layer name (overcomes pres-layer)")
 		disc_layer_name		;(STRING "disc-layer-name" "Discard layer name (overcomes disc-layer)")
 		rigmask_layer_name	;(STRING "rigmask-layer-name" "Rigidity mask layer name (overcomes rigmask-layer)")
-		layer_name		;(STRING "selected-layer-name" "Selected layer name (overcomes the active layer)"))
+		layer_name		;(STRING "selected-layer-name" "Selected layer name (overcomes the active layer)")
+		""			;(STRING "seams-file" "File to write the seam map(s) to (empty for none)")
+		1			;(INT "proxy-factor" "Search the seams on a copy scaled down by this factor (1 for none)")
+		0			;(INT "memory-limit" "Memory limit in MiB (0 for none)")
+		0			;(INT "prescale-mode" "Plain scaling before carving: none (0), automatic (1), by prescale-ratio (2)")
+		1			;(FLOAT "prescale-ratio" "Scaling ratio for prescale mode 2")
+		0			;(INT "max-seconds" "Time budget in seconds (0 for none)")
+		0			;(INT "backend" "Seam search backend: liblqr (0), threaded (1)")
+		0			;(INT "threads" "Threads of the threaded backend and of independent layers (0 for one per processor)")
+		0			;(INT "all-layers" "Carve the other layers along: none (0), all (1), the group of the selected layer (2)")
+		0			;(INT "independent-layers" "Whether to carve each of the other layers with its own seams")
+		0			;(INT "energy-cache" "Size limit in MiB of the energy map cache of the threaded backend (0 for none)"))
                 )
     (set! drawable (car (gimp-image-get-active-layer image)))
     (gimp-file-save RUN-NONINTERACTIVE image drawable outfilename outfilename)
@@ -188,7 +210,18 @@
 		""			;(STRING "pres-layer-name" "Preservation layer name (overcomes pres-layer)")
 		""			;(STRING "disc-layer-name" "Discard layer name (overcomes disc-layer)")
 		""			;(STRING "rigmask-layer-name" "Rigidity mask layer name (overcomes rigmask-layer)")
-		""			;(STRING "selected-layer-name" "Selected layer name (overcomes the active layer)"))
+		""			;(STRING "selected-layer-name" "Selected layer name (overcomes the active layer)")
+		""			;(STRING "seams-file" "File to write the seam map(s) to (empty for none)")
+		1			;(INT "proxy-factor" "Search the seams on a copy scaled down by this factor (1 for none)")
+		0			;(INT "memory-limit" "Memory limit in MiB (0 for none)")
+		0			;(INT "prescale-mode" "Plain scaling before carving: none (0), automatic (1), by prescale-ratio (2)")
+		1			;(FLOAT "prescale-ratio" "Scaling ratio for prescale mode 2")
+		0			;(INT "max-seconds" "Time budget in seconds (0 for none)")
+		0			;(INT "backend" "Seam search backend: liblqr (0), threaded (1)")
+		0			;(INT "threads" "Threads of the threaded backend and of independent layers (0 for one per processor)")
+		0			;(INT "all-layers" "Carve the other layers along: none (0), all (1), the group of the selected layer (2)")
+		0			;(INT "independent-layers" "Whether to carve each of the other layers with its own seams")
+		0			;(INT "energy-cache" "Size limit in MiB of the energy map cache of the threaded backend (0 for none)"))
                 )
     (set! layer_ID (car (gimp-image-get-active-layer image)))
     (gimp-file-save RUN-NONINTERACTIVE image layer_ID outfilename outfilename)
@@ -106,10 +106,21 @@ gint p_plug_in_lqr_iter(GimpRunMode run_mode, gint32 total_steps, gdouble curren
     buf.scaleback = buf_to.scaleback;
     buf.scaleback_mode = buf_to.scaleback_mode;
     buf.no_disc_on_enlarge = buf_to.no_disc_on_enlarge;
+    buf.proxy_factor = buf_to.proxy_factor;
+    buf.memory_limit = buf_to.memory_limit;
+    buf.prescale_mode = buf_to.prescale_mode;
+    p_delta_gfloat(&buf.prescale_ratio, buf_from.prescale_ratio, buf_to.prescale_ratio, total_steps, current_step);
+    buf.max_seconds = buf_to.max_seconds;
+    buf.backend = buf_to.backend;
+    buf.n_threads = buf_to.n_threads;
+    buf.all_layers = buf_to.all_layers;
+    buf.independent_layers = buf_to.independent_layers;
+    buf.energy_cache = buf_to.energy_cache;
     g_strlcpy(buf.pres_layer_name, buf_to.pres_layer_name, VALS_MAX_NAME_LENGTH);
     g_strlcpy(buf.disc_layer_name, buf_to.disc_layer_name, VALS_MAX_NAME_LENGTH);
     g_strlcpy(buf.rigmask_layer_name, buf_to.rigmask_layer_name, VALS_MAX_NAME_LENGTH);
     g_strlcpy(buf.selected_layer_name, buf_to.selected_layer_name, VALS_MAX_NAME_LENGTH);
+    g_strlcpy(buf.seams_file, buf_to.seams_file, VALS_MAX_NAME_LENGTH);
 
     gimp_set_data("plug_in_lqr", &buf, sizeof(buf));
 
@@ -0,0 +1,656 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <glib/gstdio.h>
+#include <libgimp/gimp.h>
+#include <lqr.h>
+
+#include "plugin-intl.h"
+
+#include "main.h"
+#include "io_functions.h"
+#include "energy.h"
+
+/* The kernels are plain loops over the rows, without branches, so
+ * that gcc vectorizes them (see configure.ac). They are scaled like
+ * liblqr's gradients, which take half the difference of the
+ * neighbours: a uniform ramp gets the same energy from all of them. */
+
+/* position in the layer of the pixel u across the seams and v along
+ * them */
+#define ENERGY_INDEX(u, v, width, orientation) \
+  ((orientation) == 0 ? (gsize) (v) * (width) + (u) : (gsize) (u) * (width) + (v))
+
+#define ENERGY_ENTROPY_BINS (8)
+#define ENERGY_ENTROPY_SAMPLES (ENERGY_WINDOW * ENERGY_WINDOW)
+
+/* columns of the entropy kernel taken at once */
+#define ENERGY_ENTROPY_BLOCK (64)
+
+/* to be changed along with the kernels, so that the maps they
+ * computed before are not used */
+#define ENERGY_CACHE_MAGIC "LQRNRG1"
+
+/* temporaries left behind by a crashed writer are dropped after a
+ * day */
+#define ENERGY_CACHE_TMP_AGE (24 * 60 * 60)
+
+typedef struct
+{
+  gchar magic[8];
+  gchar key[72];
+  gint32 orientation;
+  gint32 n_u;
+  gint32 n_v;
+} EnergyCacheHeader;
+
+typedef struct
+{
+  gchar *path;
+  gint64 mtime;
+  guint64 size;
+} EnergyCacheEntry;
+
+/* static functions declarations */
+
+static void energy_sobel_row (const gfloat * const *rows, gint width, gfloat * out);
+static void energy_scharr_row (const gfloat * const *rows, gint width, gfloat * out);
+static void energy_forward_row (const gfloat * const *rows, gint width, gfloat * out);
+static void energy_entropy_row (const gfloat * const *rows, gint width, gfloat * out);
+static gfloat energy_pixel (gint x, gint y, gint img_width, gint img_height,
+                            LqrReadingWindow * rwindow, gpointer extra_data);
+static gchar * energy_cache_path (const gchar * key, gint orientation);
+static void energy_cache_evict (const gchar * dir, guint64 max_bytes);
+static gint energy_cache_entry_cmp (gconstpointer a, gconstpointer b);
+static gdouble energy_time_lqr (LqrCarver * carver, gint nrg_func, gfloat * buffer, gint runs);
+static gdouble energy_time_rows (const EnergyKernel * kernel, const guchar * rgb_buffer,
+                                 gint width, gint height, gint bpp, gfloat * buffer, gint runs);
+
+static const EnergyKernel energy_kernels[ENERGY_KERNEL_LAST - ENERGY_KERNEL_SOBEL] = {
+  {"sobel", 1, energy_sobel_row},
+  {"scharr", 1, energy_scharr_row},
+  {"forward", 1, energy_forward_row},
+  {"entropy", 2, energy_entropy_row}
+};
+
+/* -c log (c / n) for c samples out of n in a bin, normalized by the
+ * largest entropy of the window */
+static gfloat energy_entropy_terms[ENERGY_ENTROPY_SAMPLES + 1];
+
+
+const EnergyKernel *
+energy_kernel_get (gint nrg_func)
+{
+  static gsize terms_init = 0;
+  gint c;
+
+  if ((nrg_func < ENERGY_KERNEL_SOBEL) || (nrg_func >= ENERGY_KERNEL_LAST))
+    {
+      return NULL;
+    }
+
+  if (g_once_init_enter (&terms_init))
+    {
+      energy_entropy_terms[0] = 0;
+      for (c = 1; c <= ENERGY_ENTROPY_SAMPLES; c++)
+        {
+          energy_entropy_terms[c] = -c * log ((gdouble) c / ENERGY_ENTROPY_SAMPLES) /
+            (ENERGY_ENTROPY_SAMPLES * log (ENERGY_ENTROPY_BINS));
+        }
+      g_once_init_leave (&terms_init, 1);
+    }
+
+  return &energy_kernels[nrg_func - ENERGY_KERNEL_SOBEL];
+}
+
+LqrRetVal
+energy_set_function (LqrCarver * carver, gint nrg_func)
+{
+  const EnergyKernel *kernel;
+
+  kernel = energy_kernel_get (nrg_func);
+  if (kernel == NULL)
+    {
+      return lqr_carver_set_energy_function_builtin (carver, nrg_func);
+    }
+
+  return lqr_carver_set_energy_function (carver, energy_pixel, kernel->radius,
+                                         LQR_ER_BRIGHTNESS, (gpointer) kernel);
+}
+
+gfloat *
+energy_brightness_new (const guchar * rgb_buffer, gint width, gint height, gint bpp)
+{
+  gfloat *lum;
+  gsize z;
+
+  LQR_TRY_N_N (lum = g_try_new (gfloat, (gsize) width * height));
+  for (z = 0; z < (gsize) width * height; z++)
+    {
+      lum[z] = energy_brightness (rgb_buffer + z * bpp, bpp);
+    }
+
+  return lum;
+}
+
+gboolean
+energy_rows (const EnergyKernel * kernel, const gfloat * lum,
+             gint width, gint height, gint orientation,
+             gint v0, gint v1, gfloat * out)
+{
+  const gfloat *rows[ENERGY_WINDOW];
+  gfloat *buf;
+  gfloat *row;
+  gint n_u, n_v, stride;
+  gint r = kernel->radius;
+  gint u, v, vv, j;
+
+  n_u = (orientation == 0) ? width : height;
+  n_v = (orientation == 0) ? height : width;
+  stride = n_u + 2 * r;
+
+  buf = g_try_new (gfloat, (gsize) (2 * r + 1) * stride);
+  if (buf == NULL)
+    {
+      return FALSE;
+    }
+
+  for (v = v0; v < v1; v++)
+    {
+      for (j = 0; j <= 2 * r; j++)
+        {
+          vv = CLAMP (v + j - r, 0, n_v - 1);
+          row = buf + (gsize) j * stride + r;
+          if (orientation == 0)
+            {
+              memcpy (row, lum + (gsize) vv * width, n_u * sizeof (gfloat));
+            }
+          else
+            {
+              for (u = 0; u < n_u; u++)
+                {
+                  row[u] = lum[ENERGY_INDEX (u, vv, width, orientation)];
+                }
+            }
+          for (u = 1; u <= r; u++)
+            {
+              row[-u] = row[0];
+              row[n_u - 1 + u] = row[n_u - 1];
+            }
+          rows[j] = row;
+        }
+      kernel->row (rows, n_u, out + (gsize) (v - v0) * n_u);
+    }
+
+  g_free (buf);
+
+  return TRUE;
+}
+
+static void
+energy_sobel_row (const gfloat * const *rows, gint width, gfloat * out)
+{
+  const gfloat *a = rows[0];
+  const gfloat *b = rows[1];
+  const gfloat *c = rows[2];
+  gfloat gx, gy;
+  gint i;
+
+  for (i = 0; i < width; i++)
+    {
+      gx = (a[i + 1] + 2 * b[i + 1] + c[i + 1]) - (a[i - 1] + 2 * b[i - 1] + c[i - 1]);
+      gy = (c[i - 1] + 2 * c[i] + c[i + 1]) - (a[i - 1] + 2 * a[i] + a[i + 1]);
+      out[i] = sqrtf (gx * gx + gy * gy) / 8;
+    }
+}
+
+static void
+energy_scharr_row (const gfloat * const *rows, gint width, gfloat * out)
+{
+  const gfloat *a = rows[0];
+  const gfloat *b = rows[1];
+  const gfloat *c = rows[2];
+  gfloat gx, gy;
+  gint i;
+
+  for (i = 0; i < width; i++)
+    {
+      gx = 3 * (a[i + 1] - a[i - 1]) + 10 * (b[i + 1] - b[i - 1]) + 3 * (c[i + 1] - c[i - 1]);
+      gy = 3 * (c[i - 1] - a[i - 1]) + 10 * (c[i] - a[i]) + 3 * (c[i + 1] - a[i + 1]);
+      out[i] = sqrtf (gx * gx + gy * gy) / 32;
+    }
+}
+
+/* The edges a seam through the pixel would leave: between its
+ * neighbours on its row, and the cheaper of the ones between the
+ * pixel above and either of them, depending on where the seam comes
+ * from */
+static void
+energy_forward_row (const gfloat * const *rows, gint width, gfloat * out)
+{
+  const gfloat *a = rows[0];
+  const gfloat *b = rows[1];
+  gfloat cu, cl, cr;
+  gint i;
+
+  for (i = 0; i < width; i++)
+    {
+      cu = fabsf (b[i + 1] - b[i - 1]);
+      cl = fabsf (a[i] - b[i - 1]);
+      cr = fabsf (a[i] - b[i + 1]);
+      out[i] = (cu + (cl < cr ? cl : cr)) / 2;
+    }
+}
+
+/* Entropy of the brightness over the window, in ENERGY_ENTROPY_BINS
+ * bins: the samples of each bin are counted down the columns of a
+ * block first, then summed across the window */
+static void
+energy_entropy_row (const gfloat * const *rows, gint width, gfloat * out)
+{
+  gfloat counts[ENERGY_ENTROPY_BLOCK + 2 * ENERGY_MAX_RADIUS];
+  const gfloat *row;
+  gfloat lo, hi;
+  gint i0, n, i, j, k;
+  gint c;
+
+  for (i0 = 0; i0 < width; i0 += ENERGY_ENTROPY_BLOCK)
+    {
+      n = MIN (ENERGY_ENTROPY_BLOCK, width - i0);
+      for (i = 0; i < n; i++)
+        {
+          out[i0 + i] = 0;
+        }
+      for (k = 0; k < ENERGY_ENTROPY_BINS; k++)
+        {
+          lo = (gfloat) k / ENERGY_ENTROPY_BINS;
+          hi = (k == ENERGY_ENTROPY_BINS - 1) ? G_MAXFLOAT : (gfloat) (k + 1) / ENERGY_ENTROPY_BINS;
+          for (i = 0; i < n + 2 * ENERGY_MAX_RADIUS; i++)
+            {
+              counts[i] = 0;
+            }
+          for (j = 0; j < ENERGY_WINDOW; j++)
+            {
+              row = rows[j] + i0 - ENERGY_MAX_RADIUS;
+              for (i = 0; i < n + 2 * ENERGY_MAX_RADIUS; i++)
+                {
+                  counts[i] += (gfloat) ((row[i] >= lo) & (row[i] < hi));
+                }
+            }
+          for (i = 0; i < n; i++)
+            {
+              c = (gint) (counts[i] + counts[i + 1] + counts[i + 2] + counts[i + 3] +
+                          counts[i + 4]);
+              out[i0 + i] += energy_entropy_terms[c];
+            }
+        }
+    }
+}
+
+/* liblqr's view of a kernel: the window around the pixel is copied
+ * to a row buffer, the pixels beyond the borders repeating the ones
+ * on them, as in energy_rows */
+static gfloat
+energy_pixel (gint x, gint y, gint img_width, gint img_height,
+              LqrReadingWindow * rwindow, gpointer extra_data)
+{
+  const EnergyKernel *kernel = extra_data;
+  gfloat tile[ENERGY_WINDOW][ENERGY_WINDOW];
+  const gfloat *rows[ENERGY_WINDOW];
+  gint r = kernel->radius;
+  gint i, j, dx, dy;
+  gfloat nrg;
+
+  for (j = -r; j <= r; j++)
+    {
+      dy = CLAMP (y + j, 0, img_height - 1) - y;
+      for (i = -r; i <= r; i++)
+        {
+          dx = CLAMP (x + i, 0, img_width - 1) - x;
+          tile[j + r][i + r] = lqr_rwindow_read (rwindow, dx, dy, 0);
+        }
+      rows[j + r] = tile[j + r] + r;
+    }
+  kernel->row (rows, 1, &nrg);
+
+  return nrg;
+}
+
+/* The digest of the pixels, and the settings the energy depends
+ * upon; the masks are added afterwards */
+gchar *
+energy_cache_key (const gchar * digest, gint width, gint height, gint bpp, gint nrg_func)
+{
+  GChecksum *sum;
+  gint32 params[4];
+  gchar *key;
+
+  params[0] = width;
+  params[1] = height;
+  params[2] = bpp;
+  params[3] = nrg_func;
+
+  sum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (sum, (const guchar *) ENERGY_CACHE_MAGIC, -1);
+  g_checksum_update (sum, (const guchar *) params, sizeof (params));
+  g_checksum_update (sum, (const guchar *) digest, -1);
+
+  key = g_strdup (g_checksum_get_string (sum));
+  g_checksum_free (sum);
+
+  return key;
+}
+
+static gchar *
+energy_cache_path (const gchar * key, gint orientation)
+{
+  gchar *name;
+  gchar *path;
+
+  name = g_strdup_printf ("%s-%c.nrg", key, orientation == 0 ? 'v' : 'h');
+  path = g_build_filename (g_get_user_cache_dir (), PLUGIN_NAME, "energy", name, NULL);
+  g_free (name);
+
+  return path;
+}
+
+/* Reads the map straight into en; a hit marks it as the most
+ * recently used one */
+gboolean
+energy_cache_load (const gchar * key, gint orientation, gint n_u, gint n_v, gfloat * en)
+{
+  EnergyCacheHeader header;
+  gchar *path;
+  FILE *f;
+  gboolean ok = FALSE;
+
+  path = energy_cache_path (key, orientation);
+  f = g_fopen (path, "rb");
+  if (f)
+    {
+      ok = (fread (&header, sizeof (EnergyCacheHeader), 1, f) == 1) &&
+        (memcmp (header.magic, ENERGY_CACHE_MAGIC, sizeof (header.magic)) == 0) &&
+        (strncmp (header.key, key, sizeof (header.key)) == 0) &&
+        (header.orientation == orientation) && (header.n_u == n_u) && (header.n_v == n_v) &&
+        (fread (en, sizeof (gfloat), (gsize) n_u * n_v, f) == (gsize) n_u * n_v);
+      fclose (f);
+      if (ok)
+        {
+          g_utime (path, NULL);
+        }
+    }
+  g_free (path);
+
+  return ok;
+}
+
+/* Failures are not fatal, the next run will just compute the map
+ * again */
+void
+energy_cache_store (const gchar * key, gint orientation, gint n_u, gint n_v,
+                    const gfloat * en, guint64 max_bytes)
+{
+  EnergyCacheHeader header;
+  gchar *path;
+  gchar *dir;
+  gchar *tmp;
+  FILE *f;
+  gint fd;
+  gboolean ok;
+
+  if (sizeof (EnergyCacheHeader) + (guint64) n_u * n_v * sizeof (gfloat) > max_bytes)
+    {
+      return;
+    }
+
+  memset (&header, 0, sizeof (EnergyCacheHeader));
+  memcpy (header.magic, ENERGY_CACHE_MAGIC, sizeof (header.magic));
+  g_strlcpy (header.key, key, sizeof (header.key));
+  header.orientation = orientation;
+  header.n_u = n_u;
+  header.n_v = n_v;
+
+  path = energy_cache_path (key, orientation);
+  dir = g_path_get_dirname (path);
+  tmp = g_strconcat (path, ".XXXXXX", NULL);
+  fd = (g_mkdir_with_parents (dir, 0700) == 0) ? g_mkstemp (tmp) : -1;
+  if (fd == -1)
+    {
+      g_free (tmp);
+      g_free (dir);
+      g_free (path);
+      return;
+    }
+  g_close (fd, NULL);
+
+  f = g_fopen (tmp, "wb");
+  ok = (f != NULL) &&
+    (fwrite (&header, sizeof (EnergyCacheHeader), 1, f) == 1) &&
+    (fwrite (en, sizeof (gfloat), (gsize) n_u * n_v, f) == (gsize) n_u * n_v);
+  if (f)
+    {
+      ok = (fclose (f) == 0) && ok;
+    }
+  if ((!ok) || (g_rename (tmp, path) != 0))
+    {
+      g_unlink (tmp);
+    }
+
+  energy_cache_evict (dir, max_bytes);
+
+  g_free (tmp);
+  g_free (dir);
+  g_free (path);
+}
+
+/* Drops the least recently used maps until the others fit in
+ * max_bytes, and the stale temporaries */
+static void
+energy_cache_evict (const gchar * dir, guint64 max_bytes)
+{
+  GDir *gdir;
+  GArray *entries;
+  EnergyCacheEntry entry;
+  GStatBuf st;
+  const gchar *name;
+  guint64 total = 0;
+  gint64 now;
+  guint i;
+
+  gdir = g_dir_open (dir, 0, NULL);
+  if (gdir == NULL)
+    {
+      return;
+    }
+
+  now = g_get_real_time () / G_USEC_PER_SEC;
+  entries = g_array_new (FALSE, FALSE, sizeof (EnergyCacheEntry));
+  while ((name = g_dir_read_name (gdir)) != NULL)
+    {
+      entry.path = g_build_filename (dir, name, NULL);
+      if (g_stat (entry.path, &st) != 0)
+        {
+          g_free (entry.path);
+          continue;
+        }
+      if (g_str_has_suffix (name, ".nrg"))
+        {
+          entry.mtime = st.st_mtime;
+          entry.size = st.st_size;
+          total += entry.size;
+          g_array_append_val (entries, entry);
+          continue;
+        }
+      if ((strstr (name, ".nrg.") != NULL) && (now - st.st_mtime > ENERGY_CACHE_TMP_AGE))
+        {
+          g_unlink (entry.path);
+        }
+      g_free (entry.path);
+    }
+  g_dir_close (gdir);
+
+  g_array_sort (entries, energy_cache_entry_cmp);
+  for (i = 0; i < entries->len; i++)
+    {
+      entry = g_array_index (entries, EnergyCacheEntry, i);
+      if ((total > max_bytes) && (g_unlink (entry.path) == 0))
+        {
+          total -= entry.size;
+        }
+      g_free (entry.path);
+    }
+  g_array_free (entries, TRUE);
+}
+
+/* oldest first */
+static gint
+energy_cache_entry_cmp (gconstpointer a, gconstpointer b)
+{
+  const EnergyCacheEntry *ea = a;
+  const EnergyCacheEntry *eb = b;
+
+  return (ea->mtime > eb->mtime) - (ea->mtime < eb->mtime);
+}
+
+gboolean
+energy_benchmark (gint32 layer_ID, gint runs)
+{
+  static const struct
+  {
+    gint nrg_func;
+    const gchar *name;
+  } builtins[] = {
+    {LQR_EF_GRAD_XABS, "grad_xabs"},
+    {LQR_EF_GRAD_SUMABS, "grad_sumabs"},
+    {LQR_EF_GRAD_NORM, "grad_norm"},
+    {LQR_EF_LUMA_GRAD_XABS, "luma_grad_xabs"},
+    {LQR_EF_LUMA_GRAD_SUMABS, "luma_grad_sumabs"},
+    {LQR_EF_LUMA_GRAD_NORM, "luma_grad_norm"},
+    {LQR_EF_NULL, "null"}
+  };
+  const EnergyKernel *kernel;
+  LqrCarver *carver;
+  guchar *rgb_buffer;
+  gfloat *buffer;
+  gint width, height, bpp;
+  gdouble t_lqr, t_rows;
+  gint i;
+
+  width = gimp_drawable_width (layer_ID);
+  height = gimp_drawable_height (layer_ID);
+  bpp = drawable_channels (layer_ID);
+
+  rgb_buffer = rgb_buffer_from_layer (layer_ID);
+  if (rgb_buffer == NULL)
+    {
+      return FALSE;
+    }
+  buffer = g_try_new (gfloat, (gsize) width * height);
+  carver = buffer ? lqr_carver_new (rgb_buffer, width, height, bpp) : NULL;
+  if (carver)
+    {
+      /* the row kernels read the same pixels */
+      lqr_carver_set_preserve_input_image (carver);
+    }
+  if ((carver == NULL) || (lqr_carver_init (carver, 1, 0) != LQR_OK))
+    {
+      if (carver)
+        {
+          lqr_carver_destroy (carver);
+        }
+      pixel_buffer_free (rgb_buffer);
+      g_free (buffer);
+      return FALSE;
+    }
+
+  g_printerr ("gimp-lqr-plugin: energy benchmark, %dx%d, %d channels, best of %d runs\n",
+              width, height, bpp, runs);
+  g_printerr ("gimp-lqr-plugin: %-16s %12s %12s\n", "function", "liblqr (ms)", "rows (ms)");
+
+  for (i = 0; i < G_N_ELEMENTS (builtins); i++)
+    {
+      t_lqr = energy_time_lqr (carver, builtins[i].nrg_func, buffer, runs);
+      g_printerr ("gimp-lqr-plugin: %-16s %12.2f %12s\n", builtins[i].name, t_lqr, "-");
+    }
+  for (i = ENERGY_KERNEL_SOBEL; i < ENERGY_KERNEL_LAST; i++)
+    {
+      kernel = energy_kernel_get (i);
+      t_lqr = energy_time_lqr (carver, i, buffer, runs);
+      t_rows = energy_time_rows (kernel, rgb_buffer, width, height, bpp, buffer, runs);
+      g_printerr ("gimp-lqr-plugin: %-16s %12.2f %12.2f\n", kernel->name, t_lqr, t_rows);
+    }
+
+  lqr_carver_destroy (carver);
+  pixel_buffer_free (rgb_buffer);
+  g_free (buffer);
+
+  return TRUE;
+}
+
+/* the energy is computed again each time the function is set */
+static gdouble
+energy_time_lqr (LqrCarver * carver, gint nrg_func, gfloat * buffer, gint runs)
+{
+  gint64 start;
+  gdouble best = G_MAXDOUBLE;
+  gint k;
+
+  for (k = 0; k < runs; k++)
+    {
+      energy_set_function (carver, nrg_func);
+      start = g_get_monotonic_time ();
+      if (lqr_carver_get_energy (carver, buffer, 0) != LQR_OK)
+        {
+          return -1;
+        }
+      best = MIN (best, (g_get_monotonic_time () - start) / 1e3);
+    }
+
+  return best;
+}
+
+/* from the pixels, like liblqr, which reads their brightness first */
+static gdouble
+energy_time_rows (const EnergyKernel * kernel, const guchar * rgb_buffer,
+                  gint width, gint height, gint bpp, gfloat * buffer, gint runs)
+{
+  gint64 start;
+  gdouble best = G_MAXDOUBLE;
+  gfloat *lum;
+  gint k;
+
+  for (k = 0; k < runs; k++)
+    {
+      start = g_get_monotonic_time ();
+      lum = energy_brightness_new (rgb_buffer, width, height, bpp);
+      if ((lum == NULL) || !energy_rows (kernel, lum, width, height, 0, 0, height, buffer))
+        {
+          g_free (lum);
+          return -1;
+        }
+      g_free (lum);
+      best = MIN (best, (g_get_monotonic_time () - start) / 1e3);
+    }
+
+  return best;
+}
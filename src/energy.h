@@ -0,0 +1,104 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+#ifndef __ENERGY_H__
+#define __ENERGY_H__
+
+#ifndef __LQR_H__
+#error "lqr/lqr.h must be included prior to energy.h"
+#endif /* __LQR_H__ */
+
+/* Energy functions of the plug-in. They are selected through
+ * nrg_func like liblqr's builtin ones (LqrEnergyFunctionBuiltinType),
+ * with values which liblqr does not use. Each one is a kernel over
+ * the brightness, computed a whole row at a time so that the
+ * compiler can vectorize it; liblqr calls it one pixel at a time,
+ * through a window as wide as the kernel. */
+
+typedef enum
+{
+  ENERGY_KERNEL_SOBEL = 16,
+  ENERGY_KERNEL_SCHARR,
+  ENERGY_KERNEL_FORWARD,        /* approximation of the forward energy */
+  ENERGY_KERNEL_ENTROPY,        /* local entropy of the brightness */
+  ENERGY_KERNEL_LAST
+} EnergyKernelType;
+
+#define ENERGY_MAX_RADIUS (2)
+#define ENERGY_WINDOW (2 * ENERGY_MAX_RADIUS + 1)
+
+/* rows holds the 2 * radius + 1 rows around the one computed, each
+ * pointing to its first pixel and readable radius pixels beyond both
+ * ends; out gets width values */
+typedef void (*EnergyRowFunc) (const gfloat * const *rows, gint width, gfloat * out);
+
+typedef struct
+{
+  const gchar *name;
+  gint radius;
+  EnergyRowFunc row;
+} EnergyKernel;
+
+/* brightness as liblqr reads it, weighed by the opacity */
+static inline gfloat
+energy_brightness (const guchar * p, gint channels)
+{
+  gfloat b;
+
+  b = (channels < 3) ? p[0] / 255.0 : (p[0] + p[1] + p[2]) / 765.0;
+  if ((channels == 2) || (channels == 4))
+    {
+      b *= p[channels - 1] / 255.0;
+    }
+
+  return b;
+}
+
+/* NULL for liblqr's builtin functions */
+const EnergyKernel *energy_kernel_get (gint nrg_func);
+LqrRetVal energy_set_function (LqrCarver * carver, gint nrg_func);
+gfloat *energy_brightness_new (const guchar * rgb_buffer, gint width, gint height, gint bpp);
+
+/* The energy of the rows v0 to v1 - 1 along the seams (see
+ * PROXY_INDEX), from the brightness of the whole layer; the pixels
+ * beyond the borders repeat the ones on them */
+gboolean energy_rows (const EnergyKernel * kernel, const gfloat * lum,
+                      gint width, gint height, gint orientation,
+                      gint v0, gint v1, gfloat * out);
+
+/* ENERGY MAP CACHE */
+
+/* The energy maps computed by the plug-in, before the masks are
+ * added, are kept on disk under the user's cache directory, one file
+ * for each key (see energy_cache_key) and orientation. Writes go
+ * through a temporary file, so that several processes can share the
+ * cache; the least recently used maps are dropped to keep it within
+ * max_bytes. */
+
+gchar *energy_cache_key (const gchar * digest, gint width, gint height, gint bpp,
+                         gint nrg_func);
+gboolean energy_cache_load (const gchar * key, gint orientation, gint n_u, gint n_v,
+                            gfloat * en);
+void energy_cache_store (const gchar * key, gint orientation, gint n_u, gint n_v,
+                         const gfloat * en, guint64 max_bytes);
+
+/* Times each energy function on the layer, through liblqr and, for
+ * the kernels, a row at a time, and prints the results */
+gboolean energy_benchmark (gint32 layer_ID, gint runs);
+
+#endif /* __ENERGY_H__ */
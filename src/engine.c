@@ -0,0 +1,728 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <libgimp/gimp.h>
+#include <lqr.h>
+
+#include "plugin-intl.h"
+
+#include "energy.h"
+#include "engine.h"
+
+/* The seams are removed one at a time, as liblqr does. The layer is
+ * taken in rows along the seams, each holding the positions across
+ * it of the pixels still there. For each seam, the cumulative energy
+ * is computed row after row: within a row each thread covers a
+ * chunk, and only waits for the chunks next to it to be done with
+ * the row before. The seam is then taken out of the rows and the
+ * energy recomputed around it, with the rows split among the
+ * threads. */
+
+/* position in the layer of the pixel u across the seams and v along
+ * them */
+#define ENGINE_INDEX(e, u, v) \
+  ((e)->orientation == 0 ? (gsize) (v) * (e)->width + (u) : (gsize) (u) * (e)->width + (v))
+
+#define ENGINE_MAX_THREADS (256)
+
+/* checks on a neighbouring chunk before yielding */
+#define ENGINE_SPINS (1000)
+
+typedef struct
+{
+  GMutex mutex;
+  GCond cond;
+  gint n;
+  gint count;
+  guint generation;
+} EngineBarrier;
+
+/* rows of the cumulative energy done by a thread, each counter on
+ * a cache line of its own */
+typedef struct
+{
+  volatile gint rows;
+  gchar pad[64 - sizeof (gint)];
+} EngineRows;
+
+typedef struct
+{
+  gint width;
+  gint height;
+  gint n_threads;
+  gint delta_x;
+  gfloat rigidity;
+  gint nrg_func;
+  const EnergyKernel *kernel;   /* NULL for liblqr's functions */
+  gfloat *lum;                  /* brightness, in layer order */
+  gfloat *bias;                 /* NULL without masks */
+  gfloat *rigmask;              /* NULL without a rigidity mask */
+  gchar *nrg_key;               /* NULL without the energy cache */
+  guint64 nrg_cache_bytes;
+
+  /* the search, set up by engine_resize */
+  gint orientation;
+  gint n_u;
+  gint n_v;
+  gint reach;
+  gint *pos;                    /* n_v rows of n_u positions */
+  gfloat *en;
+  gboolean nrg_cached;          /* en was read from the cache */
+  gfloat *m;
+  gint8 *least;
+  gint *seam;
+  gfloat *rig_map;              /* by step, from -delta_x */
+  gint *vs;                     /* seam ranks, in layer order */
+  EngineRows *rows;
+  EngineBarrier barrier;
+} SeamEngine;
+
+typedef struct
+{
+  SeamEngine *e;
+  gint k;
+} EngineWorker;
+
+/* static functions declarations */
+
+static gpointer engine_new (guchar * rgb_buffer, gint width, gint height, gint bpp,
+                            gint n_threads);
+static LqrRetVal engine_init (gpointer carver, gint delta_x, gfloat rigidity, gint nrg_func);
+static LqrRetVal engine_bias_add (gpointer carver, gdouble * buffer);
+static LqrRetVal engine_rigmask_add (gpointer carver, guchar * rgb, gint channels,
+                                     gint width, gint height, gint x_off, gint y_off);
+static void engine_energy_cache (gpointer carver, const gchar * key, guint64 max_bytes);
+static LqrRetVal engine_resize (gpointer carver, gint width, gint height);
+static LqrVMap * engine_vmap (gpointer carver);
+static void engine_destroy (gpointer carver);
+static void engine_search_clear (SeamEngine * e);
+static gpointer engine_worker (gpointer data);
+static void engine_work (SeamEngine * e, gint k);
+
+const CarveBackend engine_threads_backend = {
+  "threads",
+  engine_new,
+  engine_init,
+  engine_bias_add,
+  engine_rigmask_add,
+  engine_energy_cache,
+  engine_resize,
+  engine_vmap,
+  engine_destroy
+};
+
+
+static gpointer
+engine_new (guchar * rgb_buffer, gint width, gint height, gint bpp, gint n_threads)
+{
+  SeamEngine *e;
+
+  LQR_TRY_N_N (e = g_try_new0 (SeamEngine, 1));
+  e->lum = energy_brightness_new (rgb_buffer, width, height, bpp);
+  if (e->lum == NULL)
+    {
+      g_free (e);
+      return NULL;
+    }
+
+  e->width = width;
+  e->height = height;
+  e->n_threads = CLAMP (n_threads > 0 ? n_threads : (gint) g_get_num_processors (),
+                        1, ENGINE_MAX_THREADS);
+  e->delta_x = 1;
+  e->nrg_func = LQR_EF_GRAD_XABS;
+
+  return e;
+}
+
+static LqrRetVal
+engine_init (gpointer carver, gint delta_x, gfloat rigidity, gint nrg_func)
+{
+  SeamEngine *e = carver;
+
+  e->delta_x = MAX (delta_x, 0);
+  e->rigidity = rigidity;
+  e->nrg_func = nrg_func;
+  e->kernel = energy_kernel_get (nrg_func);
+
+  return LQR_OK;
+}
+
+/* halved, as in liblqr */
+static LqrRetVal
+engine_bias_add (gpointer carver, gdouble * buffer)
+{
+  SeamEngine *e = carver;
+  gsize i, size;
+
+  size = (gsize) e->width * e->height;
+  if ((e->bias == NULL) && ((e->bias = g_try_new0 (gfloat, size)) == NULL))
+    {
+      return LQR_NOMEM;
+    }
+
+  for (i = 0; i < size; i++)
+    {
+      e->bias[i] += buffer[i] / 2;
+    }
+
+  return LQR_OK;
+}
+
+static LqrRetVal
+engine_rigmask_add (gpointer carver, guchar * rgb, gint channels,
+                    gint width, gint height, gint x_off, gint y_off)
+{
+  SeamEngine *e = carver;
+  gint x, y;
+
+  if ((e->rigmask == NULL) &&
+      ((e->rigmask = g_try_new0 (gfloat, (gsize) e->width * e->height)) == NULL))
+    {
+      return LQR_NOMEM;
+    }
+
+  for (y = MAX (y_off, 0); y < MIN (y_off + height, e->height); y++)
+    {
+      for (x = MAX (x_off, 0); x < MIN (x_off + width, e->width); x++)
+        {
+          e->rigmask[(gsize) y * e->width + x] =
+            energy_brightness (rgb + ((gsize) (y - y_off) * width + x - x_off) * channels,
+                               channels);
+        }
+    }
+
+  return LQR_OK;
+}
+
+static void
+engine_barrier_wait (EngineBarrier * b)
+{
+  guint generation;
+
+  g_mutex_lock (&b->mutex);
+  generation = b->generation;
+  if (++b->count == b->n)
+    {
+      b->count = 0;
+      b->generation++;
+      g_cond_broadcast (&b->cond);
+    }
+  else
+    {
+      while (generation == b->generation)
+        {
+          g_cond_wait (&b->cond, &b->mutex);
+        }
+    }
+  g_mutex_unlock (&b->mutex);
+}
+
+static void
+engine_energy_cache (gpointer carver, const gchar * key, guint64 max_bytes)
+{
+  SeamEngine *e = carver;
+
+  g_free (e->nrg_key);
+  e->nrg_key = g_strdup (key);
+  e->nrg_cache_bytes = max_bytes;
+}
+
+static LqrRetVal
+engine_resize (gpointer carver, gint width, gint height)
+{
+  SeamEngine *e = carver;
+  GThread *threads[ENGINE_MAX_THREADS];
+  EngineWorker workers[ENGINE_MAX_THREADS];
+  gint *vs;
+  gsize size;
+  gint n_started;
+  gint i, v, k;
+
+  engine_search_clear (e);
+
+  if ((height == e->height) && (width < e->width))
+    {
+      e->orientation = 0;
+      e->reach = e->width - width;
+    }
+  else if ((width == e->width) && (height < e->height))
+    {
+      e->orientation = 1;
+      e->reach = e->height - height;
+    }
+  else
+    {
+      return LQR_ERROR;
+    }
+  e->n_u = (e->orientation == 0) ? e->width : e->height;
+  e->n_v = (e->orientation == 0) ? e->height : e->width;
+  if (e->reach >= e->n_u)
+    {
+      return LQR_ERROR;
+    }
+
+  size = (gsize) e->n_u * e->n_v;
+  e->pos = g_try_new (gint, size);
+  e->en = g_try_new (gfloat, size);
+  e->m = g_try_new (gfloat, size);
+  e->least = g_try_new (gint8, size);
+  e->seam = g_try_new (gint, e->n_v);
+  e->rig_map = g_try_new (gfloat, 2 * e->delta_x + 1);
+  e->vs = g_try_new0 (gint, size);
+  e->rows = g_try_new0 (EngineRows, e->n_threads);
+  if ((e->pos == NULL) || (e->en == NULL) || (e->m == NULL) || (e->least == NULL) ||
+      (e->seam == NULL) || (e->rig_map == NULL) || (e->vs == NULL) || (e->rows == NULL))
+    {
+      engine_search_clear (e);
+      return LQR_NOMEM;
+    }
+
+  for (v = 0; v < e->n_v; v++)
+    {
+      for (i = 0; i < e->n_u; i++)
+        {
+          e->pos[(gsize) v * e->n_u + i] = i;
+        }
+    }
+  /* same penalty for the steps as liblqr */
+  for (i = -e->delta_x; i <= e->delta_x; i++)
+    {
+      e->rig_map[i + e->delta_x] = e->rigidity * pow (ABS (i), 1.5) / e->n_v;
+    }
+  e->nrg_cached = e->nrg_key &&
+    energy_cache_load (e->nrg_key, e->orientation, e->n_u, e->n_v, e->en);
+
+  /* the workers wait at the barrier until the main thread, the first
+   * worker, knows how many could be started */
+  g_mutex_init (&e->barrier.mutex);
+  g_cond_init (&e->barrier.cond);
+  e->barrier.n = e->n_threads;
+  e->barrier.count = 0;
+  e->barrier.generation = 0;
+
+  for (n_started = 1; n_started < e->n_threads; n_started++)
+    {
+      workers[n_started].e = e;
+      workers[n_started].k = n_started;
+      threads[n_started] = g_thread_try_new ("lqr-seams", engine_worker,
+                                             &workers[n_started], NULL);
+      if (threads[n_started] == NULL)
+        {
+          break;
+        }
+    }
+  g_mutex_lock (&e->barrier.mutex);
+  e->barrier.n = n_started;
+  e->n_threads = n_started;
+  g_mutex_unlock (&e->barrier.mutex);
+
+  gimp_progress_init (_("Searching for seams..."));
+  engine_barrier_wait (&e->barrier);
+  engine_work (e, 0);
+  gimp_progress_end ();
+
+  for (k = 1; k < n_started; k++)
+    {
+      g_thread_join (threads[k]);
+    }
+  g_mutex_clear (&e->barrier.mutex);
+  g_cond_clear (&e->barrier.cond);
+
+  /* only the ranks are kept, for engine_vmap */
+  vs = e->vs;
+  e->vs = NULL;
+  engine_search_clear (e);
+  e->vs = vs;
+
+  return LQR_OK;
+}
+
+static gpointer
+engine_worker (gpointer data)
+{
+  EngineWorker *worker = data;
+
+  engine_barrier_wait (&worker->e->barrier);
+  engine_work (worker->e, worker->k);
+
+  return NULL;
+}
+
+/* The plug-in's kernel at the pixel i of row v, over the pixels
+ * still around it */
+static gfloat
+engine_kernel_energy (SeamEngine * e, gint i, gint v, gint w)
+{
+  gfloat tile[ENERGY_WINDOW][ENERGY_WINDOW];
+  const gfloat *rows[ENERGY_WINDOW];
+  gint r = e->kernel->radius;
+  gint j, k, vv;
+  gsize row;
+  gfloat nrg;
+
+  for (j = -r; j <= r; j++)
+    {
+      vv = CLAMP (v + j, 0, e->n_v - 1);
+      row = (gsize) vv * e->n_u;
+      for (k = -r; k <= r; k++)
+        {
+          tile[j + r][k + r] =
+            e->lum[ENGINE_INDEX (e, e->pos[row + CLAMP (i + k, 0, w - 1)], vv)];
+        }
+      rows[j + r] = tile[j + r] + r;
+    }
+  e->kernel->row (rows, 1, &nrg);
+
+  return nrg;
+}
+
+/* Gradient of the brightness at the pixel i of row v, when w pixels
+ * are left in each row */
+static gfloat
+engine_raw_energy (SeamEngine * e, gint i, gint v, gint w)
+{
+  gint *pos = e->pos;
+  gint n_u = e->n_u;
+  gint i0, i1, v0, v1;
+  gfloat gx, gy = 0;
+  gfloat nrg;
+
+  if (e->kernel)
+    {
+      return engine_kernel_energy (e, i, v, w);
+    }
+
+  i0 = MAX (i - 1, 0);
+  i1 = MIN (i + 1, w - 1);
+  gx = (i1 > i0) ?
+    (e->lum[ENGINE_INDEX (e, pos[(gsize) v * n_u + i1], v)] -
+     e->lum[ENGINE_INDEX (e, pos[(gsize) v * n_u + i0], v)]) / (i1 - i0) : 0;
+
+  if ((e->nrg_func != LQR_EF_GRAD_XABS) && (e->nrg_func != LQR_EF_LUMA_GRAD_XABS))
+    {
+      v0 = MAX (v - 1, 0);
+      v1 = MIN (v + 1, e->n_v - 1);
+      gy = (v1 > v0) ?
+        (e->lum[ENGINE_INDEX (e, pos[(gsize) v1 * n_u + i], v1)] -
+         e->lum[ENGINE_INDEX (e, pos[(gsize) v0 * n_u + i], v0)]) / (v1 - v0) : 0;
+    }
+
+  switch (e->nrg_func)
+    {
+    case LQR_EF_GRAD_XABS:
+    case LQR_EF_LUMA_GRAD_XABS:
+      nrg = fabs (gx);
+      break;
+    case LQR_EF_GRAD_SUMABS:
+    case LQR_EF_LUMA_GRAD_SUMABS:
+      nrg = (fabs (gx) + fabs (gy)) / 2;
+      break;
+    case LQR_EF_NULL:
+      nrg = 0;
+      break;
+    default:
+      nrg = sqrt (gx * gx + gy * gy);
+      break;
+    }
+
+  return nrg;
+}
+
+/* the same, plus the bias */
+static gfloat
+engine_energy (SeamEngine * e, gint i, gint v, gint w)
+{
+  gfloat nrg;
+
+  nrg = engine_raw_energy (e, i, v, w);
+  if (e->bias)
+    {
+      nrg += e->bias[ENGINE_INDEX (e, e->pos[(gsize) v * e->n_u + i], v)] / e->n_u;
+    }
+
+  return nrg;
+}
+
+static inline void
+engine_wait_rows (EngineRows * rows, gint n)
+{
+  gint spins = 0;
+
+  while (g_atomic_int_get (&rows->rows) < n)
+    {
+      if (++spins > ENGINE_SPINS)
+        {
+          g_thread_yield ();
+        }
+    }
+}
+
+/* Cumulative energy of the chunk k of each row, when w pixels are
+ * left; the chunks are at least as wide as a step, so that only the
+ * neighbouring ones are needed from the row before */
+static void
+engine_cumulate (SeamEngine * e, gint k, gint w)
+{
+  gint n_chunks;
+  gint i, i0, i1, j, d, v;
+  gsize row, prev;
+  gfloat rig, best, c;
+  gint8 best_d;
+
+  n_chunks = CLAMP (w / (2 * e->delta_x + 1), 1, e->n_threads);
+  if (k >= n_chunks)
+    {
+      return;
+    }
+  i0 = (gint) ((gint64) k * w / n_chunks);
+  i1 = (gint) ((gint64) (k + 1) * w / n_chunks);
+
+  for (i = i0; i < i1; i++)
+    {
+      e->m[i] = e->en[i];
+      e->least[i] = 0;
+    }
+  g_atomic_int_set (&e->rows[k].rows, 1);
+
+  for (v = 1; v < e->n_v; v++)
+    {
+      if (k > 0)
+        {
+          engine_wait_rows (&e->rows[k - 1], v);
+        }
+      if (k < n_chunks - 1)
+        {
+          engine_wait_rows (&e->rows[k + 1], v);
+        }
+
+      row = (gsize) v * e->n_u;
+      prev = row - e->n_u;
+      for (i = i0; i < i1; i++)
+        {
+          rig = e->rigmask ? e->rigmask[ENGINE_INDEX (e, e->pos[row + i], v)] : 1;
+          best = e->m[prev + i];
+          best_d = 0;
+          for (d = -e->delta_x; d <= e->delta_x; d++)
+            {
+              j = i + d;
+              if ((d == 0) || (j < 0) || (j >= w))
+                {
+                  continue;
+                }
+              c = e->m[prev + j] + e->rig_map[d + e->delta_x] * rig;
+              if (c < best)
+                {
+                  best = c;
+                  best_d = d;
+                }
+            }
+          e->m[row + i] = e->en[row + i] + best;
+          e->least[row + i] = best_d;
+        }
+      g_atomic_int_set (&e->rows[k].rows, v + 1);
+    }
+}
+
+static void
+engine_backtrack (SeamEngine * e, gint w)
+{
+  gsize last;
+  gint i, j, v;
+
+  last = (gsize) (e->n_v - 1) * e->n_u;
+  for (i = 0, j = 1; j < w; j++)
+    {
+      if (e->m[last + j] < e->m[last + i])
+        {
+          i = j;
+        }
+    }
+  for (v = e->n_v - 1; v >= 0; v--)
+    {
+      e->seam[v] = i;
+      i += e->least[(gsize) v * e->n_u + i];
+    }
+}
+
+/* Takes the seam r out of row v, which had w pixels */
+static void
+engine_remove (SeamEngine * e, gint v, gint r, gint w)
+{
+  gsize row = (gsize) v * e->n_u;
+  gint i = e->seam[v];
+
+  e->vs[ENGINE_INDEX (e, e->pos[row + i], v)] = r;
+  memmove (e->pos + row + i, e->pos + row + i + 1, (w - 1 - i) * sizeof (gint));
+  memmove (e->en + row + i, e->en + row + i + 1, (w - 1 - i) * sizeof (gfloat));
+}
+
+/* Only the pixels within the reach of the energy from the seam, or
+ * between its positions on the rows within that reach, have new
+ * neighbours */
+static void
+engine_update (SeamEngine * e, gint v, gint w)
+{
+  gsize row = (gsize) v * e->n_u;
+  gint r = e->kernel ? e->kernel->radius : 1;
+  gint lo, hi, i, vv;
+
+  lo = hi = e->seam[v];
+  for (vv = MAX (v - r, 0); vv <= MIN (v + r, e->n_v - 1); vv++)
+    {
+      lo = MIN (lo, e->seam[vv]);
+      hi = MAX (hi, e->seam[vv]);
+    }
+  lo = MAX (lo - r, 0);
+  hi = MIN (hi + r, w - 1);
+
+  for (i = lo; i <= hi; i++)
+    {
+      e->en[row + i] = engine_energy (e, i, v, w);
+    }
+}
+
+static void
+engine_work (SeamEngine * e, gint k)
+{
+  gint v, v0, v1, i, r, w;
+
+  v0 = (gint) ((gint64) k * e->n_v / e->n_threads);
+  v1 = (gint) ((gint64) (k + 1) * e->n_v / e->n_threads);
+
+  /* the energy without the bias, which is what the cache holds; no
+   * pixel has moved yet, the kernels can take whole rows */
+  if ((!e->nrg_cached) &&
+      !((e->kernel) &&
+        energy_rows (e->kernel, e->lum, e->width, e->height, e->orientation,
+                     v0, v1, e->en + (gsize) v0 * e->n_u)))
+    {
+      for (v = v0; v < v1; v++)
+        {
+          for (i = 0; i < e->n_u; i++)
+            {
+              e->en[(gsize) v * e->n_u + i] = engine_raw_energy (e, i, v, e->n_u);
+            }
+        }
+    }
+  if ((e->nrg_key) && (!e->nrg_cached))
+    {
+      engine_barrier_wait (&e->barrier);
+      if (k == 0)
+        {
+          energy_cache_store (e->nrg_key, e->orientation, e->n_u, e->n_v, e->en,
+                              e->nrg_cache_bytes);
+        }
+      engine_barrier_wait (&e->barrier);
+    }
+  for (v = v0; (v < v1) && (e->bias); v++)
+    {
+      for (i = 0; i < e->n_u; i++)
+        {
+          e->en[(gsize) v * e->n_u + i] += e->bias[ENGINE_INDEX (e, i, v)] / e->n_u;
+        }
+    }
+  engine_barrier_wait (&e->barrier);
+
+  for (r = 1; r <= e->reach; r++)
+    {
+      w = e->n_u - r + 1;
+
+      engine_cumulate (e, k, w);
+      engine_barrier_wait (&e->barrier);
+
+      if (k == 0)
+        {
+          engine_backtrack (e, w);
+          for (i = 0; i < e->n_threads; i++)
+            {
+              e->rows[i].rows = 0;
+            }
+          gimp_progress_update ((gdouble) r / e->reach);
+        }
+      engine_barrier_wait (&e->barrier);
+
+      for (v = v0; v < v1; v++)
+        {
+          engine_remove (e, v, r, w);
+        }
+      engine_barrier_wait (&e->barrier);
+
+      for (v = v0; v < v1; v++)
+        {
+          engine_update (e, v, w - 1);
+        }
+      engine_barrier_wait (&e->barrier);
+    }
+}
+
+static LqrVMap *
+engine_vmap (gpointer carver)
+{
+  SeamEngine *e = carver;
+  LqrVMap *vmap;
+
+  LQR_TRY_N_N (e->vs);
+  vmap = lqr_vmap_new (e->vs, e->width, e->height, e->reach, e->orientation);
+  if (vmap)
+    {
+      /* the map took it over */
+      e->vs = NULL;
+    }
+
+  return vmap;
+}
+
+static void
+engine_search_clear (SeamEngine * e)
+{
+  g_free (e->pos);
+  g_free (e->en);
+  g_free (e->m);
+  g_free (e->least);
+  g_free (e->seam);
+  g_free (e->rig_map);
+  g_free (e->vs);
+  g_free (e->rows);
+  e->pos = NULL;
+  e->en = NULL;
+  e->m = NULL;
+  e->least = NULL;
+  e->seam = NULL;
+  e->rig_map = NULL;
+  e->vs = NULL;
+  e->rows = NULL;
+}
+
+static void
+engine_destroy (gpointer carver)
+{
+  SeamEngine *e = carver;
+
+  engine_search_clear (e);
+  g_free (e->lum);
+  g_free (e->bias);
+  g_free (e->rigmask);
+  g_free (e->nrg_key);
+  g_free (e);
+}
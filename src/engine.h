@@ -0,0 +1,70 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+#ifndef __ENGINE_H__
+#define __ENGINE_H__
+
+#ifndef __LQR_H__
+#error "lqr/lqr.h must be included prior to engine.h"
+#endif /* __LQR_H__ */
+
+/* Carving backends: what is needed to search for the seams of a
+ * resize, on an opaque carver. liblqr is the default backend (see
+ * render.c); the seams found by any other one are handed over to
+ * liblqr as a visibility map, and liblqr carves the layer and the
+ * aux layers, scans the output and dumps the seams. */
+
+enum _CarveBackendType
+{
+  CARVE_BACKEND_LQR,
+  CARVE_BACKEND_THREADS
+};
+
+typedef enum _CarveBackendType CarveBackendType;
+
+struct _CarveBackend;
+
+typedef struct _CarveBackend CarveBackend;
+
+struct _CarveBackend
+{
+  const gchar *name;
+  /* the buffer stays owned by the caller */
+  gpointer (*carver_new) (guchar * rgb_buffer, gint width, gint height, gint bpp,
+                          gint n_threads);
+  LqrRetVal (*init) (gpointer carver, gint delta_x, gfloat rigidity, gint nrg_func);
+  /* the bias of every pixel, as lqr_carver_bias_add takes it with a
+   * factor of 1 (see update_bias) */
+  LqrRetVal (*bias_add) (gpointer carver, gdouble * buffer);
+  LqrRetVal (*rigmask_add) (gpointer carver, guchar * rgb, gint channels,
+                            gint width, gint height, gint x_off, gint y_off);
+  /* the energy before the masks may be read from and written to the
+   * cache (see energy.h) under key; the backends which leave the
+   * energy to liblqr ignore it */
+  void (*energy_cache) (gpointer carver, const gchar * key, guint64 max_bytes);
+  LqrRetVal (*resize) (gpointer carver, gint width, gint height);
+  LqrVMap *(*vmap) (gpointer carver);
+  void (*destroy) (gpointer carver);
+};
+
+/* The threaded engine only shrinks along one direction: the energy
+ * and each row of the cumulative energy are computed by n_threads
+ * threads (0 for one per processor) */
+extern const CarveBackend engine_threads_backend;
+
+#endif /* __ENGINE_H__ */
@@ -32,6 +32,7 @@
 
 #include "plugin-intl.h"
 #include "main.h"
+#include "energy.h"
 #include "interface.h"
 #include "preview.h"
 #include "layers_combo.h"
@@ -2141,6 +2142,10 @@ advanced_page_new (gint32 image_ID, gint32 layer_ID)
 			    _("Transversal grad. (luma) "), LQR_EF_LUMA_GRAD_XABS,
                             _("Grad. sum (luma)"), LQR_EF_LUMA_GRAD_SUMABS,
                             _("Grad. norm (luma)"), LQR_EF_LUMA_GRAD_NORM,
+                            _("Sobel (bright.)"), ENERGY_KERNEL_SOBEL,
+                            _("Scharr (bright.)"), ENERGY_KERNEL_SCHARR,
+                            _("Forward energy (bright.)"), ENERGY_KERNEL_FORWARD,
+                            _("Local entropy (bright.)"), ENERGY_KERNEL_ENTROPY,
 			    /* Null can be translated as Zero */
 			    _("Null"), LQR_EF_NULL, NULL);
   gimp_int_combo_box_set_active (GIMP_INT_COMBO_BOX (nrg_func_combo_box),
@@ -31,6 +31,7 @@
 
 #include "main_common.h"
 #include "main.h"
+#include "io_functions.h"
 #include "render.h"
 #include "interface_I.h"
 #include "preview.h"
@@ -425,6 +426,8 @@ dialog_I (PlugInImageVals * image_vals,
 
 
   lqr_carver_destroy (carver_data->carver);
+  pixel_buffers_release_mapped ();
+  render_clear_commits (carver_data);
 
   switch (dialog_I_response)
     {
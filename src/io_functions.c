@@ -16,171 +16,1507 @@
  * along with this program; if not, see <http://www.gnu.org.licences/>.
  */
 
+#include "config.h"
+
 #include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <unistd.h>
+#endif /* HAVE_SYS_MMAN_H */
+
+#include <glib/gstdio.h>
 #include <libgimp/gimp.h>
 #include <lqr.h>
 
-#include "config.h"
+#ifdef LQR_GEGL_IO
+#include <gegl.h>
+#endif /* LQR_GEGL_IO */
+
 #include "plugin-intl.h"
 
+#include "vmapfile/lqr-vmap-file.h"
+
+#include "engine.h"
 #include "io_functions.h"
 
+/* number of rows moved at once when transposing column scans */
+#define TRANSPOSE_BLOCK_ROWS (64)
+
+/* Pixel transfers. With the GEGL backend, rectangles are moved with
+ * a single gegl_buffer_get/set call in an explicit 8 bit format; the
+ * legacy backend walks the tiles of a pixel region. Either way, the
+ * buffers on this side have the layout the carver expects. */
+
+#ifdef LQR_GEGL_IO
+
+struct _PixelIO
+{
+  gint32 drawable_ID;
+  PixelIOMode mode;
+  GeglBuffer *buffer;
+  const Babl *format;
+};
+
+/* The carver works on 8 bit channels whatever the precision of the
+ * image; indexed drawables are transferred as they are */
+static const Babl *
+drawable_io_format (gint32 drawable_ID)
+{
+  const Babl *format;
+
+  format = gimp_drawable_get_format (drawable_ID);
+  if (babl_format_is_palette (format))
+    {
+      return format;
+    }
+
+  switch (babl_format_get_n_components (format))
+    {
+      case 1:
+        return babl_format ("Y' u8");
+      case 2:
+        return babl_format ("Y'A u8");
+      case 3:
+        return babl_format ("R'G'B' u8");
+      default:
+        return babl_format ("R'G'B'A u8");
+    }
+}
+
+gint
+drawable_channels (gint32 drawable_ID)
+{
+  return babl_format_get_bytes_per_pixel (drawable_io_format (drawable_ID));
+}
+
+PixelIO *
+pixel_io_open (gint32 drawable_ID, PixelIOMode mode)
+{
+  PixelIO *io;
+
+  LQR_TRY_N_N (io = g_try_new (PixelIO, 1));
+
+  io->drawable_ID = drawable_ID;
+  io->mode = mode;
+  io->format = drawable_io_format (drawable_ID);
+  if (mode == PIXEL_IO_WRITE)
+    {
+      io->buffer = gimp_drawable_get_shadow_buffer (drawable_ID);
+    }
+  else
+    {
+      io->buffer = gimp_drawable_get_buffer (drawable_ID);
+    }
+
+  return io;
+}
+
+void
+pixel_io_get_rect (PixelIO * io, guchar * dest, gsize rowstride,
+                   gint x, gint y, gint w, gint h)
+{
+  gegl_buffer_get (io->buffer, GEGL_RECTANGLE (x, y, w, h), 1.0,
+                   io->format, dest, rowstride, GEGL_ABYSS_NONE);
+}
+
+void
+pixel_io_set_rect (PixelIO * io, const guchar * src, gsize rowstride,
+                   gint x, gint y, gint w, gint h)
+{
+  gegl_buffer_set (io->buffer, GEGL_RECTANGLE (x, y, w, h), 0,
+                   io->format, src, rowstride);
+  /* direct writes are followed by partial updates of the display */
+  if (io->mode == PIXEL_IO_WRITE_DIRECT)
+    {
+      gegl_buffer_flush (io->buffer);
+    }
+}
+
+void
+pixel_io_close (PixelIO * io, gboolean commit)
+{
+  gegl_buffer_flush (io->buffer);
+  g_object_unref (io->buffer);
+  if ((io->mode == PIXEL_IO_WRITE) && commit)
+    {
+      gimp_drawable_merge_shadow (io->drawable_ID, TRUE);
+    }
+  g_free (io);
+}
+
+#else /* !LQR_GEGL_IO */
+
+struct _PixelIO
+{
+  gint32 drawable_ID;
+  PixelIOMode mode;
+  GimpDrawable *drawable;
+};
+
+gint
+drawable_channels (gint32 drawable_ID)
+{
+  return gimp_drawable_bpp (drawable_ID);
+}
+
+PixelIO *
+pixel_io_open (gint32 drawable_ID, PixelIOMode mode)
+{
+  PixelIO *io;
+
+  LQR_TRY_N_N (io = g_try_new (PixelIO, 1));
+
+  io->drawable_ID = drawable_ID;
+  io->mode = mode;
+  io->drawable = gimp_drawable_get (drawable_ID);
+
+  return io;
+}
+
+/* Copies h rows of row_size bytes between two strided buffers */
+static inline void
+copy_rows (guchar * dest, gsize dest_rowstride,
+           const guchar * src, gsize src_rowstride, gsize row_size, gint h)
+{
+  gint y;
+
+  for (y = 0; y < h; y++)
+    {
+      memcpy (dest, src, row_size);
+      src += src_rowstride;
+      dest += dest_rowstride;
+    }
+}
+
+/* The rectangle is walked tile by tile, so that each tile is
+ * transferred from (or to) the core only once */
+void
+pixel_io_get_rect (PixelIO * io, guchar * dest, gsize rowstride,
+                   gint x, gint y, gint w, gint h)
+{
+  GimpPixelRgn rgn;
+  gpointer pr;
+
+  gimp_pixel_rgn_init (&rgn, io->drawable, x, y, w, h, FALSE, FALSE);
+
+  for (pr = gimp_pixel_rgns_register (1, &rgn);
+       pr != NULL; pr = gimp_pixel_rgns_process (pr))
+    {
+      copy_rows (dest + (gsize) (rgn.y - y) * rowstride + (gsize) (rgn.x - x) * rgn.bpp,
+                 rowstride, rgn.data, rgn.rowstride, (gsize) rgn.w * rgn.bpp, rgn.h);
+    }
+}
+
+void
+pixel_io_set_rect (PixelIO * io, const guchar * src, gsize rowstride,
+                   gint x, gint y, gint w, gint h)
+{
+  GimpPixelRgn rgn;
+  gpointer pr;
+
+  gimp_pixel_rgn_init (&rgn, io->drawable, x, y, w, h, TRUE,
+                       io->mode == PIXEL_IO_WRITE);
+
+  for (pr = gimp_pixel_rgns_register (1, &rgn);
+       pr != NULL; pr = gimp_pixel_rgns_process (pr))
+    {
+      copy_rows (rgn.data, rgn.rowstride,
+                 src + (gsize) (rgn.y - y) * rowstride + (gsize) (rgn.x - x) * rgn.bpp,
+                 rowstride, (gsize) rgn.w * rgn.bpp, rgn.h);
+    }
+}
+
+void
+pixel_io_close (PixelIO * io, gboolean commit)
+{
+  gimp_drawable_flush (io->drawable);
+  if ((io->mode == PIXEL_IO_WRITE) && commit)
+    {
+      gimp_drawable_merge_shadow (io->drawable_ID, TRUE);
+    }
+  gimp_drawable_detach (io->drawable);
+  g_free (io);
+}
+
+#endif /* LQR_GEGL_IO */
+
+/* Carver input buffers. Buffers which do not fit on the heap, or
+ * which are larger than LQR_PLUGIN_SWAP_THRESHOLD MiB (if that is
+ * set in the environment), are backed by an unlinked temporary file
+ * instead, so that huge images can be paged out rather than failing.
+ * Mapped buffers must never be freed by liblqr (see
+ * lqr_carver_set_preserve_input_image); they are released with
+ * pixel_buffer_free or pixel_buffers_release_mapped. */
+
+static GHashTable *mapped_buffers = NULL;
+
+static guint64
+swap_threshold (void)
+{
+  static gboolean initialized = FALSE;
+  static guint64 threshold = 0;
+  const gchar *env;
+
+  if (!initialized)
+    {
+      env = g_getenv ("LQR_PLUGIN_SWAP_THRESHOLD");
+      if (env)
+        {
+          threshold = g_ascii_strtoull (env, NULL, 10) << 20;
+        }
+      initialized = TRUE;
+    }
+  return threshold;
+}
+
+/* The file is sparse, so the buffer starts out zero-filled */
+static guchar *
+mapped_buffer_new (gsize size)
+{
+#ifdef HAVE_SYS_MMAN_H
+  gchar *filename;
+  gint fd;
+  gpointer buffer;
+
+  filename = gimp_temp_name ("lqr");
+  fd = g_open (filename, O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0)
+    {
+      g_free (filename);
+      return NULL;
+    }
+  g_unlink (filename);
+  g_free (filename);
+
+  if (ftruncate (fd, (off_t) size) != 0)
+    {
+      close (fd);
+      return NULL;
+    }
+
+  buffer = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  if (buffer == MAP_FAILED)
+    {
+      return NULL;
+    }
+
+  if (mapped_buffers == NULL)
+    {
+      mapped_buffers = g_hash_table_new (g_direct_hash, g_direct_equal);
+    }
+  g_hash_table_insert (mapped_buffers, buffer, GSIZE_TO_POINTER (size));
+
+  return buffer;
+#else
+  return NULL;
+#endif /* HAVE_SYS_MMAN_H */
+}
+
+/* Allocates a w x h buffer with bpp channels; the size is computed
+ * in 64 bits, and NULL is returned if it cannot be addressed */
+guchar *
+pixel_buffer_new (gint bpp, gint w, gint h, gboolean clear)
+{
+  guint64 size;
+  guint64 threshold;
+  guchar *buffer = NULL;
+
+  size = (guint64) bpp * w * h;
+  if (size > G_MAXSIZE)
+    {
+      return NULL;
+    }
+
+  threshold = swap_threshold ();
+  if ((threshold == 0) || (size < threshold))
+    {
+      buffer = clear ? g_try_malloc0 (size) : g_try_malloc (size);
+    }
+  if (buffer == NULL)
+    {
+      buffer = mapped_buffer_new (size);
+    }
+
+  return buffer;
+}
+
+gboolean
+pixel_buffer_is_mapped (guchar * buffer)
+{
+  return (mapped_buffers != NULL) &&
+    g_hash_table_lookup_extended (mapped_buffers, buffer, NULL, NULL);
+}
+
+void
+pixel_buffer_free (guchar * buffer)
+{
+#ifdef HAVE_SYS_MMAN_H
+  gpointer size;
+
+  if ((mapped_buffers != NULL) &&
+      g_hash_table_lookup_extended (mapped_buffers, buffer, NULL, &size))
+    {
+      g_hash_table_remove (mapped_buffers, buffer);
+      munmap (buffer, GPOINTER_TO_SIZE (size));
+      return;
+    }
+#endif /* HAVE_SYS_MMAN_H */
+  g_free (buffer);
+}
+
+#ifdef HAVE_SYS_MMAN_H
+static gboolean
+unmap_buffer (gpointer buffer, gpointer size, gpointer data)
+{
+  munmap (buffer, GPOINTER_TO_SIZE (size));
+  return TRUE;
+}
+#endif /* HAVE_SYS_MMAN_H */
+
+/* Releases the mapped buffers still in use by destroyed carvers */
+void
+pixel_buffers_release_mapped (void)
+{
+#ifdef HAVE_SYS_MMAN_H
+  if (mapped_buffers != NULL)
+    {
+      g_hash_table_foreach_remove (mapped_buffers, unmap_buffer, NULL);
+    }
+#endif /* HAVE_SYS_MMAN_H */
+}
+
 guchar *
 rgb_buffer_from_layer (gint32 layer_ID)
 {
-  gint y, bpp;
-  gint w, h;
-  GimpDrawable *drawable;
-  GimpPixelRgn rgn_in;
+  return rgb_buffer_from_layer_area (layer_ID, 0, 0,
+                                     gimp_drawable_width (layer_ID),
+                                     gimp_drawable_height (layer_ID));
+}
+
+/* Reads the w x h area of the layer with origin (x0, y0) in layer
+ * coordinates; the area may extend beyond the layer boundaries, in
+ * which case the parts outside are zero-filled */
+guchar *
+rgb_buffer_from_layer_area (gint32 layer_ID, gint x0, gint y0, gint w, gint h)
+{
+  gint bpp;
+  gint lw, lh;
+  gint ix0, iy0, ix1, iy1;
+  gint y, y1, th;
+  gsize rowstride;
+  PixelIO *io;
   guchar *buffer;
-  gint update_step;
 
   gimp_progress_init (_("Parsing layer..."));
 
-  w = gimp_drawable_width (layer_ID);
-  h = gimp_drawable_height (layer_ID);
+  lw = gimp_drawable_width (layer_ID);
+  lh = gimp_drawable_height (layer_ID);
+
+  bpp = drawable_channels (layer_ID);
+
+  ix0 = MAX (x0, 0);
+  iy0 = MAX (y0, 0);
+  ix1 = MIN (x0 + w, lw);
+  iy1 = MIN (y0 + h, lh);
+
+  LQR_TRY_N_N (buffer = pixel_buffer_new (bpp, w, h,
+                                          (ix0 != x0) || (iy0 != y0) ||
+                                          (ix1 != x0 + w) || (iy1 != y0 + h)));
+
+  if ((ix1 <= ix0) || (iy1 <= iy0))
+    {
+      gimp_progress_end();
+      return buffer;
+    }
+
+  io = pixel_io_open (layer_ID, PIXEL_IO_READ);
+  if (io == NULL)
+    {
+      pixel_buffer_free (buffer);
+      gimp_progress_end();
+      return NULL;
+    }
+
+  rowstride = (gsize) w * bpp;
+  th = gimp_tile_height ();
+
+  /* one row of tiles at a time */
+  for (y = iy0; y < iy1; y = y1)
+    {
+      y1 = MIN ((y / th + 1) * th, iy1);
+      pixel_io_get_rect (io, buffer + (gsize) (y - y0) * rowstride + (gsize) (ix0 - x0) * bpp,
+                         rowstride, ix0, y, ix1 - ix0, y1 - y);
+      gimp_progress_update ((gdouble) (y1 - iy0) / (iy1 - iy0));
+    }
+
+  pixel_io_close (io, FALSE);
+
+  gimp_progress_end();
+
+  return buffer;
+}
+
+/* Reduces h rows of pixels to one weight per pixel: the mean of
+ * the colour channels, times the alpha channel if there is one,
+ * which is what liblqr would compute from the full pixels when
+ * adding a bias or a rigidity mask */
+static inline void
+reduce_rows_to_mask (const guchar * rows, gsize rowstride, gint bpp,
+                     guchar * buffer, gint w, gint h)
+{
+  gint x, y;
+  const guchar *src;
+  guchar *dest;
+
+  for (y = 0; y < h; y++)
+    {
+      src = rows + (gsize) y * rowstride;
+      dest = buffer + (gsize) y * w;
+      switch (bpp)
+        {
+          case 1:
+            memcpy (dest, src, w);
+            break;
+          case 2:
+            for (x = 0; x < w; x++, src += 2)
+              {
+                dest[x] = (src[0] * src[1] + 127) / 255;
+              }
+            break;
+          case 3:
+            for (x = 0; x < w; x++, src += 3)
+              {
+                dest[x] = (src[0] + src[1] + src[2] + 1) / 3;
+              }
+            break;
+          case 4:
+            for (x = 0; x < w; x++, src += 4)
+              {
+                dest[x] = ((src[0] + src[1] + src[2]) * src[3] + 382) / 765;
+              }
+            break;
+          default:
+            g_assert_not_reached ();
+        }
+    }
+}
+
+/* Reads a layer or a channel (the selection mask included) as a
+ * single-channel mask, one row of tiles at a time, see
+ * reduce_rows_to_mask */
+guchar *
+mask_buffer_from_drawable (gint32 drawable_ID)
+{
+  gint w, h, bpp;
+  gint y, th, band_h;
+  PixelIO *io;
+  guchar *band;
+  guchar *buffer;
+
+  w = gimp_drawable_width (drawable_ID);
+  h = gimp_drawable_height (drawable_ID);
+  bpp = drawable_channels (drawable_ID);
+  th = gimp_tile_height ();
+
+  LQR_TRY_N_N (buffer = g_try_new (guchar, (gsize) w * h));
+  band = g_try_new (guchar, (gsize) w * th * bpp);
+  io = band ? pixel_io_open (drawable_ID, PIXEL_IO_READ) : NULL;
+  if (io == NULL)
+    {
+      g_free (band);
+      g_free (buffer);
+      return NULL;
+    }
+
+  for (y = 0; y < h; y += th)
+    {
+      band_h = MIN (th, h - y);
+      pixel_io_get_rect (io, band, (gsize) w * bpp, 0, y, w, band_h);
+      reduce_rows_to_mask (band, (gsize) w * bpp, bpp,
+                           buffer + (gsize) y * w, w, band_h);
+    }
+
+  pixel_io_close (io, FALSE);
+  g_free (band);
+
+  return buffer;
+}
+
+/* Reads a mask over the width x height area of the carved layer
+ * (at base_x_off, base_y_off in the image) and averages it over
+ * blocks of factor x factor pixels, the last row and column of
+ * blocks taking the remainder; the parts of the area outside the
+ * drawable count as zero. Only a row of tiles of the drawable is
+ * held at a time. */
+guchar *
+mask_buffer_scaled_from_drawable (gint32 drawable_ID, gint base_x_off, gint base_y_off,
+                                  gint width, gint height, gint factor)
+{
+  gint mw, mh, bpp;
+  gint pw, ph;
+  gint x_off, y_off;
+  gint x, y, y0, bx, by, px, py;
+  gint th, band_h;
+  PixelIO *io;
+  guchar *band;
+  guchar *mask;
+  guint32 *sums;
+  guchar *buffer;
+  gint block_w, block_h;
+
+  pw = width / factor;
+  ph = height / factor;
+
+  mw = gimp_drawable_width (drawable_ID);
+  mh = gimp_drawable_height (drawable_ID);
+  bpp = drawable_channels (drawable_ID);
+  th = gimp_tile_height ();
+  gimp_drawable_offsets (drawable_ID, &x_off, &y_off);
+  x_off -= base_x_off;
+  y_off -= base_y_off;
+
+  LQR_TRY_N_N (buffer = g_try_new (guchar, (gsize) pw * ph));
+  sums = g_try_new0 (guint32, (gsize) pw * ph);
+  band = g_try_new (guchar, (gsize) mw * th * bpp);
+  mask = g_try_new (guchar, (gsize) mw * th);
+  io = (sums && band && mask) ? pixel_io_open (drawable_ID, PIXEL_IO_READ) : NULL;
+  if (io == NULL)
+    {
+      g_free (mask);
+      g_free (band);
+      g_free (sums);
+      g_free (buffer);
+      return NULL;
+    }
+
+  for (y0 = MAX (-y_off, 0); y0 < MIN (mh, height - y_off); y0 += band_h)
+    {
+      band_h = MIN (th - y0 % th, MIN (mh, height - y_off) - y0);
+      pixel_io_get_rect (io, band, (gsize) mw * bpp, 0, y0, mw, band_h);
+      reduce_rows_to_mask (band, (gsize) mw * bpp, bpp, mask, mw, band_h);
+      for (y = 0; y < band_h; y++)
+        {
+          by = y0 + y + y_off;
+          py = MIN (by / factor, ph - 1);
+          for (x = MAX (-x_off, 0); x < MIN (mw, width - x_off); x++)
+            {
+              bx = x + x_off;
+              px = MIN (bx / factor, pw - 1);
+              sums[(gsize) py * pw + px] += mask[(gsize) y * mw + x];
+            }
+        }
+    }
+
+  pixel_io_close (io, FALSE);
+
+  for (py = 0; py < ph; py++)
+    {
+      block_h = (py == ph - 1) ? height - py * factor : factor;
+      for (px = 0; px < pw; px++)
+        {
+          block_w = (px == pw - 1) ? width - px * factor : factor;
+          buffer[(gsize) py * pw + px] =
+            (sums[(gsize) py * pw + px] + block_w * block_h / 2) / (block_w * block_h);
+        }
+    }
+
+  g_free (mask);
+  g_free (band);
+  g_free (sums);
+
+  return buffer;
+}
+
+/* Layers which are going to be attached to the carver are read in
+ * full through the cache, already cropped to the selected layer's
+ * area; everything else is read as a compact mask, and its own
+ * offsets are passed on to liblqr. Whatever is read through a cache
+ * stays owned by it */
+#define MASK_IN_FULL(layer_ID, cache) \
+  ((cache) && ((cache)->full) && gimp_drawable_is_layer (layer_ID))
+
+/* a mask as read by read_mask, with its offsets from the carver */
+typedef struct
+{
+  guchar *buffer;
+  gint channels;
+  gint w;
+  gint h;
+  gint x_off;
+  gint y_off;
+  gdouble coeff;
+  gboolean owned;
+} BiasMask;
+
+static guchar *
+read_mask (gint32 layer_ID, AuxLayerCache * cache, gint base_x_off, gint base_y_off,
+           gint * channels, gint * w, gint * h, gint * x_off, gint * y_off)
+{
+  if (MASK_IN_FULL (layer_ID, cache))
+    {
+      *channels = drawable_channels (layer_ID);
+      *w = cache->width;
+      *h = cache->height;
+      *x_off = cache->x_off - base_x_off;
+      *y_off = cache->y_off - base_y_off;
+      return aux_layer_cache_get (cache, layer_ID);
+    }
+
+  gimp_drawable_offsets (layer_ID, x_off, y_off);
+  *x_off -= base_x_off;
+  *y_off -= base_y_off;
+  *w = gimp_drawable_width (layer_ID);
+  *h = gimp_drawable_height (layer_ID);
+  *channels = 1;
+  return cache ? aux_layer_cache_get (cache, layer_ID) : mask_buffer_from_drawable (layer_ID);
+}
+
+/* Adds coeff times the brightness of n pixels of a mask, weighed by
+ * their opacity as liblqr does, to a row of the bias; one loop for
+ * each number of channels, so that the compiler can vectorize them */
+static void
+bias_row_add (gdouble * out, const guchar * p, gint channels, gint n, gdouble coeff)
+{
+  gint x;
+
+  switch (channels)
+    {
+    case 1:
+      coeff /= 255;
+      for (x = 0; x < n; x++)
+        {
+          out[x] += coeff * p[x];
+        }
+      break;
+    case 2:
+      coeff /= 255 * 255;
+      for (x = 0; x < n; x++)
+        {
+          out[x] += coeff * (p[2 * x] * p[2 * x + 1]);
+        }
+      break;
+    case 3:
+      coeff /= 3 * 255;
+      for (x = 0; x < n; x++)
+        {
+          out[x] += coeff * (p[3 * x] + p[3 * x + 1] + p[3 * x + 2]);
+        }
+      break;
+    default:
+      coeff /= 3 * 255 * 255;
+      for (x = 0; x < n; x++)
+        {
+          out[x] += coeff * ((p[4 * x] + p[4 * x + 1] + p[4 * x + 2]) * p[4 * x + 3]);
+        }
+      break;
+    }
+}
+
+/* Builds the bias of both masks in a single buffer covering the
+ * width x height carver, and hands it to the backend at once.
+ * Either layer may be 0 */
+LqrRetVal
+update_bias (const CarveBackend * backend, gpointer carver, gint width, gint height,
+             gint32 pres_layer_ID, gint pres_coeff, gint32 disc_layer_ID, gint disc_coeff,
+             gint base_x_off, gint base_y_off, AuxLayerCache * cache)
+{
+  BiasMask masks[2];
+  BiasMask *m;
+  gint32 layer_ID[2];
+  gint coeff[2];
+  gdouble *bias;
+  gint n = 0;
+  gint i, y, x0, x1;
+  LqrRetVal ret = LQR_NOMEM;
+
+  layer_ID[0] = pres_layer_ID;
+  coeff[0] = pres_coeff;
+  layer_ID[1] = disc_layer_ID;
+  coeff[1] = disc_coeff;
+
+  for (i = 0; i < 2; i++)
+    {
+      if ((layer_ID[i] == 0) || (coeff[i] == 0))
+        {
+          continue;
+        }
+      m = &masks[n];
+      m->buffer = read_mask (layer_ID[i], cache, base_x_off, base_y_off,
+                             &m->channels, &m->w, &m->h, &m->x_off, &m->y_off);
+      if (m->buffer == NULL)
+        {
+          goto out;
+        }
+      m->coeff = coeff[i];
+      m->owned = (cache == NULL);
+      n++;
+    }
+
+  if (n == 0)
+    {
+      return LQR_OK;
+    }
+
+  bias = g_try_new0 (gdouble, (gsize) width * height);
+  if (bias == NULL)
+    {
+      goto out;
+    }
+
+  /* a single pass over the bias, each row taking all the masks while
+   * it is in cache */
+  for (y = 0; y < height; y++)
+    {
+      for (i = 0; i < n; i++)
+        {
+          m = &masks[i];
+          x0 = MAX (m->x_off, 0);
+          x1 = MIN (m->x_off + m->w, width);
+          if ((y < m->y_off) || (y >= m->y_off + m->h) || (x1 <= x0))
+            {
+              continue;
+            }
+          bias_row_add (bias + (gsize) y * width + x0,
+                        m->buffer + ((gsize) (y - m->y_off) * m->w + x0 - m->x_off) *
+                        m->channels, m->channels, x1 - x0, m->coeff);
+        }
+    }
+
+  ret = backend->bias_add (carver, bias);
+  g_free (bias);
+
+out:
+  for (i = 0; i < n; i++)
+    {
+      if (masks[i].owned)
+        {
+          g_free (masks[i].buffer);
+        }
+    }
+
+  return ret;
+}
+
+LqrRetVal
+set_rigmask (const CarveBackend * backend, gpointer carver, gint32 layer_ID,
+             gint base_x_off, gint base_y_off, AuxLayerCache * cache)
+{
+  guchar *rgb;
+  gint w, h, bpp;
+  gint x_off, y_off;
+
+  if (layer_ID == 0)
+    {
+      return LQR_OK;
+    }
+
+  CATCH_MEM (rgb = read_mask (layer_ID, cache, base_x_off, base_y_off,
+                              &bpp, &w, &h, &x_off, &y_off));
+
+  CATCH (backend->rigmask_add (carver, rgb, bpp, w, h, x_off, y_off));
+
+  if (cache == NULL)
+    {
+      g_free(rgb);
+    }
+
+  return LQR_OK;
+}
+
+/* Returns the contents of an aux layer, in full or as a mask as
+ * read_mask expects them, reading it only the first time it is
+ * requested; the buffer stays owned by the cache */
+guchar *
+aux_layer_cache_get (AuxLayerCache * cache, gint32 layer_ID)
+{
+  gint i;
+  gint x_off, y_off;
+
+  for (i = 0; i < cache->n; i++)
+    {
+      if (cache->layer_ID[i] == layer_ID)
+        {
+          return cache->buffer[i];
+        }
+    }
+
+  if (cache->n == AUX_LAYER_CACHE_SIZE)
+    {
+      return NULL;
+    }
+
+  if (MASK_IN_FULL (layer_ID, cache))
+    {
+      gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+      cache->buffer[cache->n] =
+        rgb_buffer_from_layer_area (layer_ID, cache->x_off - x_off, cache->y_off - y_off,
+                                    cache->width, cache->height);
+    }
+  else
+    {
+      cache->buffer[cache->n] = mask_buffer_from_drawable (layer_ID);
+    }
+  LQR_TRY_N_N (cache->buffer[cache->n]);
+  cache->layer_ID[cache->n] = layer_ID;
+  cache->taken[cache->n] = FALSE;
+
+  return cache->buffer[cache->n++];
+}
+
+/* Hands the contents of an aux layer over to the caller (typically
+ * lqr_carver_new, which takes ownership of it). The cached buffer
+ * is handed over the first time; if the same layer is requested
+ * again, the caller gets a copy. Nothing must read from the cache
+ * for that layer afterwards. */
+guchar *
+aux_layer_cache_take (AuxLayerCache * cache, gint32 layer_ID)
+{
+  gint i;
+  gint x_off, y_off;
+  guchar *buffer;
+
+  for (i = 0; i < cache->n; i++)
+    {
+      if (cache->layer_ID[i] == layer_ID)
+        {
+          if (!cache->taken[i])
+            {
+              cache->taken[i] = TRUE;
+              return cache->buffer[i];
+            }
+          LQR_TRY_N_N (buffer = pixel_buffer_new (drawable_channels (layer_ID),
+                                                  cache->width, cache->height, FALSE));
+          memcpy (buffer, cache->buffer[i],
+                  (gsize) drawable_channels (layer_ID) * cache->width * cache->height);
+          return buffer;
+        }
+    }
+
+  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+  return rgb_buffer_from_layer_area (layer_ID,
+                                     cache->x_off - x_off, cache->y_off - y_off,
+                                     cache->width, cache->height);
+}
+
+/* Frees the buffers which were not handed over */
+void
+aux_layer_cache_clear (AuxLayerCache * cache)
+{
+  gint i;
+
+  for (i = 0; i < cache->n; i++)
+    {
+      if (!cache->taken[i])
+        {
+          pixel_buffer_free (cache->buffer[i]);
+        }
+      cache->buffer[i] = NULL;
+    }
+  cache->n = 0;
+}
+
+
+/* Transposes ncols contiguous columns of height h into a
+ * row-major destination with the given rowstride; the work is
+ * split into blocks of rows so that both sides stay in cache */
+static void
+transpose_cols_to_rows (guchar * cols, guchar * dest_base, gsize dest_rowstride,
+                        gint ncols, gint h, gint bpp)
+{
+  gint x, y, y0, y1, k;
+  guchar *src;
+  guchar *dest;
+
+  for (y0 = 0; y0 < h; y0 += TRANSPOSE_BLOCK_ROWS)
+    {
+      y1 = MIN (y0 + TRANSPOSE_BLOCK_ROWS, h);
+      for (x = 0; x < ncols; x++)
+        {
+          src = cols + ((gsize) x * h + y0) * bpp;
+          dest = dest_base + (gsize) y0 * dest_rowstride + (gsize) x * bpp;
+          for (y = y0; y < y1; y++)
+            {
+              for (k = 0; k < bpp; k++)
+                {
+                  dest[k] = src[k];
+                }
+              src += bpp;
+              dest += dest_rowstride;
+            }
+        }
+    }
+}
+
+/* Column scans are gathered into stripes one tile wide, which are
+ * then pushed with a single rect transfer, instead of setting the
+ * drawable one column at a time (which touches every tile in the
+ * column once per pixel column) */
+static LqrRetVal
+write_carver_cols (LqrCarver * r, PixelIO * io,
+                   gint h, gint bpp, gint update_step)
+{
+  gint x, x0 = 0;
+  gint ncols = 0;
+  gint stripe_w;
+  guchar *out_col;
+  guchar *cols;
+  guchar *stripe;
+
+  stripe_w = gimp_tile_width ();
+
+  CATCH_MEM (cols = g_try_new (guchar, (gsize) stripe_w * h * bpp));
+  stripe = g_try_new (guchar, (gsize) stripe_w * h * bpp);
+  if (stripe == NULL)
+    {
+      g_free (cols);
+      return LQR_NOMEM;
+    }
+
+  while (lqr_carver_scan_line (r, &x, &out_col))
+    {
+      if ((ncols > 0) && ((x != x0 + ncols) || (x % stripe_w == 0)))
+        {
+          transpose_cols_to_rows (cols, stripe, (gsize) ncols * bpp,
+                                  ncols, h, bpp);
+          pixel_io_set_rect (io, stripe, (gsize) ncols * bpp, x0, 0, ncols, h);
+          ncols = 0;
+        }
+      if (ncols == 0)
+        {
+          x0 = x;
+        }
+
+      memcpy (cols + (gsize) ncols * h * bpp, out_col, (gsize) h * bpp);
+      ncols++;
+
+      if (x % update_step == 0)
+        {
+          gimp_progress_update ((gdouble) x / (lqr_carver_get_height(r) - 1));
+        }
+    }
+
+  if (ncols > 0)
+    {
+      transpose_cols_to_rows (cols, stripe, (gsize) ncols * bpp,
+                              ncols, h, bpp);
+      pixel_io_set_rect (io, stripe, (gsize) ncols * bpp, x0, 0, ncols, h);
+    }
+
+  g_free (stripe);
+  g_free (cols);
+
+  return LQR_OK;
+}
+
+LqrRetVal
+write_carver_to_layer (LqrCarver * r, gint32 layer_ID)
+{
+  PixelIO *io;
+  gint y;
+  gint w, h, bpp;
+  guchar *out_line;
+  gint update_step;
+  LqrRetVal ret_val = LQR_OK;
+
+  w = gimp_drawable_width (layer_ID);
+  h = gimp_drawable_height (layer_ID);
+  bpp = drawable_channels (layer_ID);
+
+  CATCH_MEM (io = pixel_io_open (layer_ID, PIXEL_IO_WRITE));
+
+  gimp_progress_init (_("Applying changes..."));
+  update_step = MAX ((lqr_carver_get_height(r) - 1) / 20, 1);
+
+  if (lqr_carver_scan_by_row(r))
+    {
+      while (lqr_carver_scan_line (r, &y, &out_line))
+        {
+          pixel_io_set_rect (io, out_line, (gsize) w * bpp, 0, y, w, 1);
+
+          if (y % update_step == 0)
+            {
+              gimp_progress_update ((gdouble) y / (lqr_carver_get_height(r) - 1));
+            }
+        }
+    }
+  else
+    {
+      ret_val = write_carver_cols (r, io, h, bpp, update_step);
+    }
+
+  /* a half written shadow is dropped */
+  pixel_io_close (io, ret_val == LQR_OK);
+  if (ret_val == LQR_OK)
+    {
+      gimp_drawable_update (layer_ID, 0, 0, w, h);
+    }
+
+  gimp_progress_end();
+
+  return ret_val;
+}
+
+/* Pipelined output: one worker thread per carver scans lines into
+ * stripes one tile high (or one tile wide, for column scans) while
+ * the main thread, which is the only one allowed to talk to the
+ * GIMP core, pushes the stripes which are ready, whichever layer
+ * they belong to. Each worker owns two stripes, which travel back
+ * and forth between its free queue and the shared full queue. */
+
+#define OUTPUT_STRIPES_PER_JOB (2)
+
+typedef struct
+{
+  gint job;
+  gboolean last;
+  LqrRetVal ret_val;
+  guchar *data;
+  gint x, y;
+  gint w, h;
+} OutputStripe;
+
+typedef struct
+{
+  LqrCarver *carver;
+  gint32 layer_ID;
+  gint w, h, bpp;
+  gint tile_w, tile_h;
+  OutputStripe stripes[OUTPUT_STRIPES_PER_JOB];
+  OutputStripe end;
+  GAsyncQueue *free_q;
+  GAsyncQueue *full_q;
+  gint cancel;
+  GThread *thread;
+  PixelIO *io;
+} OutputJob;
+
+static void
+output_job_push (OutputJob * job, OutputStripe * stripe, guchar * cols,
+                 gboolean by_row, gint first, gint n)
+{
+  if (by_row)
+    {
+      stripe->x = 0;
+      stripe->y = first;
+      stripe->w = job->w;
+      stripe->h = n;
+    }
+  else
+    {
+      transpose_cols_to_rows (cols, stripe->data, (gsize) n * job->bpp,
+                              n, job->h, job->bpp);
+      stripe->x = first;
+      stripe->y = 0;
+      stripe->w = n;
+      stripe->h = job->h;
+    }
+  g_async_queue_push (job->full_q, stripe);
+}
 
-  bpp = gimp_drawable_bpp (layer_ID);
+static gpointer
+output_job_scan (gpointer data)
+{
+  OutputJob *job = (OutputJob *) data;
+  OutputStripe *stripe = NULL;
+  gboolean by_row;
+  gint span;
+  gint l, first = 0, n = 0;
+  guchar *line;
+  guchar *cols = NULL;
 
-  LQR_TRY_N_N (buffer = g_try_new (guchar, bpp * w * h));
+  job->end.ret_val = LQR_OK;
 
-  drawable = gimp_drawable_get (layer_ID);
+  by_row = lqr_carver_scan_by_row (job->carver);
+  span = by_row ? job->tile_h : job->tile_w;
 
-  gimp_pixel_rgn_init (&rgn_in, drawable, 0, 0, w, h, FALSE, FALSE);
+  if (!by_row)
+    {
+      cols = g_try_new (guchar, (gsize) span * job->h * job->bpp);
+      if (cols == NULL)
+        {
+          job->end.ret_val = LQR_NOMEM;
+          g_async_queue_push (job->full_q, &job->end);
+          return NULL;
+        }
+    }
 
-  for (y = 0; y < h; y++)
+  while (lqr_carver_scan_line (job->carver, &l, &line))
     {
-      gimp_pixel_rgn_get_row (&rgn_in, buffer + y * w * bpp, 0, y, w);
+      if ((stripe != NULL) && ((l != first + n) || (l % span == 0)))
+        {
+          output_job_push (job, stripe, cols, by_row, first, n);
+          stripe = NULL;
+        }
+      if (stripe == NULL)
+        {
+          stripe = g_async_queue_pop (job->free_q);
+          if (g_atomic_int_get (&job->cancel))
+            {
+              stripe = NULL;
+              break;
+            }
+          first = l;
+          n = 0;
+        }
 
-      update_step = MAX ((h - 1) / 20, 1);
-      if (y % update_step == 0)
+      if (by_row)
         {
-          gimp_progress_update ((gdouble) y / (h - 1));
+          memcpy (stripe->data + (gsize) n * job->w * job->bpp, line,
+                  (gsize) job->w * job->bpp);
+        }
+      else
+        {
+          memcpy (cols + (gsize) n * job->h * job->bpp, line,
+                  (gsize) job->h * job->bpp);
         }
+      n++;
     }
 
-  gimp_drawable_detach (drawable);
+  if ((stripe != NULL) && (n > 0))
+    {
+      output_job_push (job, stripe, cols, by_row, first, n);
+    }
 
-  gimp_progress_end();
+  g_free (cols);
 
-  return buffer;
+  g_async_queue_push (job->full_q, &job->end);
+
+  return NULL;
 }
 
+/* Writes each carver to the corresponding layer (which must already
+ * have the carver's size), overlapping the scan of every carver with
+ * the transfers to the core */
 LqrRetVal
-update_bias (LqrCarver * r, gint32 layer_ID, gint bias_factor,
-             gint base_x_off, gint base_y_off)
+write_carvers_to_layers (LqrCarver ** carvers, gint32 * layer_IDs, gint n_jobs)
 {
-  guchar *rgb;
-  gint w, h, bpp;
-  gint x_off, y_off;
+  OutputJob *jobs;
+  OutputJob *job;
+  OutputStripe *stripe;
+  GAsyncQueue *full_q;
+  gint i, k;
+  gint n_running = 0;
+  gint n_stripes = 0;
+  gint n_done = 0;
+  gint update_step;
+  gsize stripe_size;
+  LqrRetVal ret_val = LQR_OK;
+
+  CATCH_MEM (jobs = g_try_new0 (OutputJob, n_jobs));
+  full_q = g_async_queue_new ();
+
+  gimp_progress_init (_("Applying changes..."));
 
-  if ((layer_ID == 0) || (bias_factor == 0))
+  for (i = 0; (i < n_jobs) && (ret_val == LQR_OK); i++)
     {
-      return LQR_OK;
+      job = &jobs[i];
+      job->carver = carvers[i];
+      job->layer_ID = layer_IDs[i];
+      job->w = gimp_drawable_width (job->layer_ID);
+      job->h = gimp_drawable_height (job->layer_ID);
+      job->bpp = drawable_channels (job->layer_ID);
+      job->tile_w = gimp_tile_width ();
+      job->tile_h = gimp_tile_height ();
+      job->full_q = full_q;
+      job->free_q = g_async_queue_new ();
+      job->end.job = i;
+      job->end.last = TRUE;
+
+      if (lqr_carver_scan_by_row (job->carver))
+        {
+          stripe_size = (gsize) job->w * job->tile_h * job->bpp;
+          n_stripes += (job->h + job->tile_h - 1) / job->tile_h;
+        }
+      else
+        {
+          stripe_size = (gsize) job->tile_w * job->h * job->bpp;
+          n_stripes += (job->w + job->tile_w - 1) / job->tile_w;
+        }
+
+      for (k = 0; k < OUTPUT_STRIPES_PER_JOB; k++)
+        {
+          job->stripes[k].job = i;
+          job->stripes[k].data = g_try_new (guchar, stripe_size);
+          if (job->stripes[k].data == NULL)
+            {
+              ret_val = LQR_NOMEM;
+              break;
+            }
+          g_async_queue_push (job->free_q, &job->stripes[k]);
+        }
+      if (ret_val != LQR_OK)
+        {
+          break;
+        }
+
+      job->io = pixel_io_open (job->layer_ID, PIXEL_IO_WRITE);
+      if (job->io == NULL)
+        {
+          ret_val = LQR_NOMEM;
+          break;
+        }
+
+      job->thread = g_thread_try_new ("lqr-output", output_job_scan, job, NULL);
+      if (job->thread == NULL)
+        {
+          ret_val = LQR_NOMEM;
+          break;
+        }
+      n_running++;
     }
 
-  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
-  x_off -= base_x_off;
-  y_off -= base_y_off;
+  if (ret_val != LQR_OK)
+    {
+      for (i = 0; i < n_jobs; i++)
+        {
+          g_atomic_int_set (&jobs[i].cancel, TRUE);
+        }
+    }
 
-  w = gimp_drawable_width (layer_ID);
-  h = gimp_drawable_height (layer_ID);
+  update_step = MAX (n_stripes / 20, 1);
+
+  while (n_running > 0)
+    {
+      stripe = g_async_queue_pop (full_q);
+      job = &jobs[stripe->job];
+
+      if (stripe->last)
+        {
+          n_running--;
+          if ((stripe->ret_val != LQR_OK) && (ret_val == LQR_OK))
+            {
+              ret_val = stripe->ret_val;
+              for (i = 0; i < n_jobs; i++)
+                {
+                  g_atomic_int_set (&jobs[i].cancel, TRUE);
+                }
+            }
+          continue;
+        }
 
-  bpp = gimp_drawable_bpp (layer_ID);
+      if (ret_val == LQR_OK)
+        {
+          pixel_io_set_rect (job->io, stripe->data, (gsize) stripe->w * job->bpp,
+                             stripe->x, stripe->y, stripe->w, stripe->h);
+          n_done++;
+          if (n_done % update_step == 0)
+            {
+              gimp_progress_update ((gdouble) n_done / n_stripes);
+            }
+        }
 
-  rgb = rgb_buffer_from_layer (layer_ID);
+      g_async_queue_push (job->free_q, stripe);
+    }
 
-  CATCH (lqr_carver_bias_add_rgb_area
-         (r, rgb, bias_factor, bpp, w, h, x_off, y_off));
+  for (i = 0; i < n_jobs; i++)
+    {
+      job = &jobs[i];
+      if (job->thread)
+        {
+          g_thread_join (job->thread);
+        }
+      if (job->io)
+        {
+          pixel_io_close (job->io, ret_val == LQR_OK);
+          if (ret_val == LQR_OK)
+            {
+              gimp_drawable_update (job->layer_ID, 0, 0, job->w, job->h);
+            }
+        }
+      for (k = 0; k < OUTPUT_STRIPES_PER_JOB; k++)
+        {
+          g_free (job->stripes[k].data);
+        }
+      if (job->free_q)
+        {
+          g_async_queue_unref (job->free_q);
+        }
+    }
 
-  g_free(rgb);
+  g_async_queue_unref (full_q);
+  g_free (jobs);
 
-  return LQR_OK;
+  gimp_progress_end();
+
+  return ret_val;
 }
 
-LqrRetVal
-set_rigmask (LqrCarver * r, gint32 layer_ID, gint base_x_off, gint base_y_off)
+/* Scans the whole carver into a row-major buffer of size w x h */
+static LqrRetVal
+carver_to_buffer (LqrCarver * r, guchar * buffer, gint w, gint h, gint bpp)
 {
-  guchar *rgb;
-  gint w, h, bpp;
-  gint x_off, y_off;
+  gint x, y, x0 = 0;
+  gint ncols = 0;
+  gint stripe_w;
+  guchar *out_line;
+  guchar *cols;
 
-  if (layer_ID == 0)
+  if (lqr_carver_scan_by_row (r))
     {
+      while (lqr_carver_scan_line (r, &y, &out_line))
+        {
+          memcpy (buffer + (gsize) y * w * bpp, out_line, (gsize) w * bpp);
+        }
       return LQR_OK;
     }
 
-  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
-  x_off -= base_x_off;
-  y_off -= base_y_off;
-
-  w = gimp_drawable_width (layer_ID);
-  h = gimp_drawable_height (layer_ID);
-
-  bpp = gimp_drawable_bpp (layer_ID);
+  stripe_w = gimp_tile_width ();
+  CATCH_MEM (cols = g_try_new (guchar, (gsize) stripe_w * h * bpp));
 
-  rgb = rgb_buffer_from_layer (layer_ID);
+  while (lqr_carver_scan_line (r, &x, &out_line))
+    {
+      if ((ncols > 0) && ((x != x0 + ncols) || (x % stripe_w == 0)))
+        {
+          transpose_cols_to_rows (cols, buffer + (gsize) x0 * bpp,
+                                  (gsize) w * bpp, ncols, h, bpp);
+          ncols = 0;
+        }
+      if (ncols == 0)
+        {
+          x0 = x;
+        }
+      memcpy (cols + (gsize) ncols * h * bpp, out_line, (gsize) h * bpp);
+      ncols++;
+    }
 
-  CATCH (lqr_carver_rigmask_add_rgb_area
-         (r, rgb, bpp, w, h, x_off, y_off));
+  if (ncols > 0)
+    {
+      transpose_cols_to_rows (cols, buffer + (gsize) x0 * bpp,
+                              (gsize) w * bpp, ncols, h, bpp);
+    }
 
-  g_free(rgb);
+  g_free (cols);
 
   return LQR_OK;
 }
 
-
-LqrRetVal
-write_carver_to_layer (LqrCarver * r, gint32 layer_ID)
+/* A tile is clean if it lies within the previously committed
+ * area and all of its rows are unchanged; since layers are always
+ * resized keeping their top-left corner, committed pixels keep
+ * their coordinates across resizes */
+static gboolean
+tile_is_dirty (LayerCommit * commit, guchar * buffer, gint w,
+               gint x0, gint y0, gint tw, gint th)
 {
-  GimpDrawable * drawable;
   gint y;
-  gint w, h;
-  GimpPixelRgn rgn_out;
-  guchar *out_line;
-  gint update_step;
+  gsize row_size;
 
-  gimp_progress_init (_("Applying changes..."));
-  update_step = MAX ((lqr_carver_get_height(r) - 1) / 20, 1);
+  if ((commit->buffer == NULL) || (x0 + tw > commit->w) || (y0 + th > commit->h))
+    {
+      return TRUE;
+    }
+
+  row_size = (gsize) tw * commit->bpp;
+  for (y = y0; y < y0 + th; y++)
+    {
+      if (memcmp (buffer + ((gsize) y * w + x0) * commit->bpp,
+                  commit->buffer + ((gsize) y * commit->w + x0) * commit->bpp,
+                  row_size) != 0)
+        {
+          return TRUE;
+        }
+    }
 
-  drawable = gimp_drawable_get (layer_ID);
+  return FALSE;
+}
+
+/* Like write_carver_to_layer, but only the tiles which differ from
+ * the last commit are transferred and updated. Tiles are written
+ * directly (not through the shadow buffer, which would be merged
+ * as a whole); undo is still covered by the resize of the layer
+ * which precedes each interactive write. The commit is updated to
+ * the new layer contents. */
+LqrRetVal
+write_carver_to_layer_diff (LqrCarver * r, gint32 layer_ID, LayerCommit * commit)
+{
+  PixelIO *io;
+  gint w, h, bpp;
+  gint tw, th;
+  gint x0, y0, x1, rect_w, rect_h;
+  guchar *buffer;
+  LqrRetVal ret_val;
 
   w = gimp_drawable_width (layer_ID);
   h = gimp_drawable_height (layer_ID);
+  bpp = drawable_channels (layer_ID);
+
+  if ((commit->buffer != NULL) && (commit->bpp != bpp))
+    {
+      layer_commit_clear (commit);
+    }
+
+  tw = gimp_tile_width ();
+  th = gimp_tile_height ();
 
-  gimp_pixel_rgn_init (&rgn_out, drawable, 0, 0, w, h, TRUE, TRUE);
+  CATCH_MEM (buffer = g_try_new (guchar, (gsize) w * h * bpp));
 
+  gimp_progress_init (_("Applying changes..."));
 
-  while (lqr_carver_scan_line (r, &y, &out_line))
+  ret_val = carver_to_buffer (r, buffer, w, h, bpp);
+  io = (ret_val == LQR_OK) ? pixel_io_open (layer_ID, PIXEL_IO_WRITE_DIRECT) : NULL;
+  if (io == NULL)
     {
-      if (lqr_carver_scan_by_row(r))
-        {
-          gimp_pixel_rgn_set_row (&rgn_out, out_line, 0, y, w);
-        }
-      else
-        {
-          gimp_pixel_rgn_set_col (&rgn_out, out_line, y, 0, h);
-        }
+      g_free (buffer);
+      gimp_progress_end ();
+      return (ret_val == LQR_OK) ? LQR_NOMEM : ret_val;
+    }
 
-      if (y % update_step == 0)
+  for (y0 = 0; y0 < h; y0 += th)
+    {
+      rect_h = MIN (th, h - y0);
+      x0 = 0;
+      while (x0 < w)
         {
-          gimp_progress_update ((gdouble) y / (lqr_carver_get_height(r) - 1));
-        }
+          /* find the next run of dirty tiles in this tile row */
+          if (!tile_is_dirty (commit, buffer, w, x0, y0, MIN (tw, w - x0), rect_h))
+            {
+              x0 += tw;
+              continue;
+            }
+          x1 = MIN (x0 + tw, w);
+          while ((x1 < w) &&
+                 tile_is_dirty (commit, buffer, w, x1, y0, MIN (tw, w - x1), rect_h))
+            {
+              x1 = MIN (x1 + tw, w);
+            }
+          rect_w = x1 - x0;
 
-    }
+          pixel_io_set_rect (io, buffer + ((gsize) y0 * w + x0) * bpp,
+                             (gsize) w * bpp, x0, y0, rect_w, rect_h);
+          gimp_drawable_update (layer_ID, x0, y0, rect_w, rect_h);
 
-  gimp_drawable_flush (drawable);
-  gimp_drawable_merge_shadow (layer_ID, TRUE);
-  gimp_drawable_update (layer_ID, 0, 0, w, h);
+          x0 = x1;
+        }
+      gimp_progress_update ((gdouble) MIN (y0 + th, h) / h);
+    }
 
-  gimp_drawable_detach (drawable);
+  pixel_io_close (io, TRUE);
 
   gimp_progress_end();
 
+  g_free (commit->buffer);
+  commit->buffer = buffer;
+  commit->w = w;
+  commit->h = h;
+  commit->bpp = bpp;
+
   return LQR_OK;
 }
 
+void
+layer_commit_clear (LayerCommit * commit)
+{
+  g_free (commit->buffer);
+  commit->buffer = NULL;
+  commit->w = 0;
+  commit->h = 0;
+  commit->bpp = 0;
+}
+
 LqrRetVal
 write_vmap_to_layer (LqrVMap * vmap, gpointer data)
 {
@@ -190,11 +1526,10 @@ write_vmap_to_layer (LqrVMap * vmap, gpointer data)
   gint32 seam_layer_ID;
   gint32 * seam_layer_p;
   gint32 image_ID;
-  GimpDrawable *drawable;
+  PixelIO *io;
   gint x_off, y_off;
   gchar *name;
   GimpRGB col_start, col_end;
-  GimpPixelRgn rgn_out;
   guchar *outrow;
   gdouble value, rd, gr, bl, al;
   gint vs, y, x, k;
@@ -238,19 +1573,21 @@ write_vmap_to_layer (LqrVMap * vmap, gpointer data)
     {
       gimp_layer_resize  (seam_layer_ID, w, h, 0, 0);
     }
-  drawable = gimp_drawable_get (seam_layer_ID);
-
   bpp = 4;
 
-  gimp_pixel_rgn_init (&rgn_out, drawable, 0, 0, w, h, TRUE, TRUE);
-
-  CATCH_MEM (outrow = g_try_new (guchar, w * bpp));
+  CATCH_MEM (outrow = g_try_new (guchar, (gsize) w * bpp));
+  io = pixel_io_open (seam_layer_ID, PIXEL_IO_WRITE);
+  if (io == NULL)
+    {
+      g_free (outrow);
+      return LQR_NOMEM;
+    }
 
   for (y = 0; y < h; y++)
     {
       for (x = 0; x < w; x++)
         {
-          vs = buffer[y * w + x];
+          vs = buffer[(gsize) y * w + x];
           if (vs == 0)
             {
               for (k = 0; k < bpp; k++)
@@ -271,18 +1608,17 @@ write_vmap_to_layer (LqrVMap * vmap, gpointer data)
               outrow[x * bpp + 3] = 255 * al;
             }
         }
-      gimp_pixel_rgn_set_row (&rgn_out, outrow, 0, y, w);
+      pixel_io_set_rect (io, outrow, (gsize) w * bpp, 0, y, w, 1);
       if (y % update_step == 0)
         {
           gimp_progress_update ((gdouble) y / (h - 1));
         }
     }
 
-  gimp_drawable_flush (drawable);
-  gimp_drawable_merge_shadow (seam_layer_ID, TRUE);
+  pixel_io_close (io, TRUE);
+  g_free (outrow);
   gimp_drawable_update (seam_layer_ID, 0, 0, w, h);
   gimp_drawable_set_visible (seam_layer_ID, TRUE);
-  gimp_drawable_detach (drawable);
 
   gimp_progress_end();
 
@@ -312,3 +1648,232 @@ write_all_vmaps (LqrVMapList * list, gint32 image_ID, gchar * orig_name,
   return lqr_vmap_list_foreach (list, write_vmap_to_layer,
                                 (gpointer) (&data));
 }
+
+/* Seam map files (see vmapfile/lqr-vmap-file.h): the first map
+ * goes to the given file, the following ones (one for each
+ * direction and enlargement step) get a numbered suffix */
+
+typedef struct
+{
+  const gchar *filename;
+  gint index;
+} VMapFileArg;
+
+static LqrRetVal
+write_vmap_to_file (LqrVMap * vmap, gpointer data)
+{
+  VMapFileArg *arg = (VMapFileArg *) data;
+  gchar *filename;
+
+  if (arg->index == 0)
+    {
+      filename = g_strdup (arg->filename);
+    }
+  else
+    {
+      filename = g_strdup_printf ("%s.%d", arg->filename, arg->index);
+    }
+  arg->index++;
+
+  /* not fatal, the image is resized anyway */
+  if (lqr_vmap_file_write (filename, lqr_vmap_get_data (vmap),
+                           lqr_vmap_get_width (vmap), lqr_vmap_get_height (vmap),
+                           lqr_vmap_get_depth (vmap),
+                           lqr_vmap_get_orientation (vmap)) != 0)
+    {
+      g_message (_("Could not write the seam map to %s"),
+                 gimp_filename_to_utf8 (filename));
+    }
+
+  g_free (filename);
+  return LQR_OK;
+}
+
+LqrRetVal
+write_all_vmaps_to_file (LqrVMapList * list, const gchar * filename)
+{
+  VMapFileArg data;
+
+  data.filename = filename;
+  data.index = 0;
+
+  return lqr_vmap_list_foreach (list, write_vmap_to_file,
+                                (gpointer) (&data));
+}
+
+/* Reads back a map written by write_all_vmaps_to_file */
+LqrVMap *
+vmap_from_file (const gchar * filename)
+{
+  LqrVMapFile *vf;
+  LqrVMap *vmap;
+  gint *buffer;
+  gint w, h, x, y;
+
+  vf = lqr_vmap_file_open (filename);
+  if (vf == NULL)
+    {
+      g_message (_("Could not read the seam map from %s"),
+                 gimp_filename_to_utf8 (filename));
+      return NULL;
+    }
+
+  w = lqr_vmap_file_get_width (vf);
+  h = lqr_vmap_file_get_height (vf);
+  buffer = g_try_new (gint, (gsize) w * h);
+  if (buffer == NULL)
+    {
+      lqr_vmap_file_close (vf);
+      return NULL;
+    }
+  for (y = 0; y < h; y++)
+    {
+      for (x = 0; x < w; x++)
+        {
+          buffer[(gsize) y * w + x] = lqr_vmap_file_get_rank (vf, x, y);
+        }
+    }
+
+  vmap = lqr_vmap_new (buffer, w, h, lqr_vmap_file_get_depth (vf),
+                       lqr_vmap_file_get_orientation (vf));
+  if (vmap == NULL)
+    {
+      g_free (buffer);
+    }
+  lqr_vmap_file_close (vf);
+
+  return vmap;
+}
+
+/* Seam map cache: the visibility map of the last non-interactive
+ * shrink is attached to the image, together with a key identifying
+ * the inputs and settings which produced it (see vmap_cache_key in
+ * render.c), so that retargeting the same image again can skip the
+ * seams computation. The parasite is persistent, so the map is
+ * saved along with the image in XCF files. */
+
+#define VMAP_CACHE_PARASITE "plug-in-lqr-vmap-cache"
+
+typedef struct
+{
+  gchar key[80];
+  gint32 width;
+  gint32 height;
+  gint32 depth;
+  gint32 orientation;
+  gint32 reach;
+} VMapCacheHeader;
+
+/* Feeds the identity of a mask (its tattoo, its placement with
+ * respect to the carved layer and its contents) to a checksum; the
+ * contents are read like update_bias and set_rigmask do, so that
+ * layers are left in the cache for them */
+void
+checksum_mask (GChecksum * sum, gint32 drawable_ID, gint base_x_off, gint base_y_off,
+               AuxLayerCache * cache)
+{
+  gint32 ident[6] = { 0, 0, 0, 0, 0, 0 };
+  guchar *mask = NULL;
+
+  if (drawable_ID)
+    {
+      ident[0] = gimp_drawable_get_tattoo (drawable_ID);
+      mask = read_mask (drawable_ID, cache, base_x_off, base_y_off,
+                        &ident[5], &ident[3], &ident[4], &ident[1], &ident[2]);
+    }
+
+  g_checksum_update (sum, (const guchar *) ident, sizeof (ident));
+  if (mask)
+    {
+      g_checksum_update (sum, mask, (gsize) ident[3] * ident[4] * ident[5]);
+      if (cache == NULL)
+        {
+          g_free (mask);
+        }
+    }
+}
+
+/* Returns the cached map if it was produced by the same inputs and
+ * it covers at least reach seams along the given orientation */
+LqrVMap *
+vmap_cache_load (gint32 image_ID, const gchar * key, gint orientation, gint reach)
+{
+  GimpParasite *parasite;
+  VMapCacheHeader header;
+  const guchar *data;
+  gsize size;
+  gint *buffer;
+  LqrVMap *vmap = NULL;
+
+  parasite = gimp_image_get_parasite (image_ID, VMAP_CACHE_PARASITE);
+  if (parasite == NULL)
+    {
+      return NULL;
+    }
+
+  data = gimp_parasite_data (parasite);
+  if (gimp_parasite_data_size (parasite) >= sizeof (VMapCacheHeader))
+    {
+      memcpy (&header, data, sizeof (VMapCacheHeader));
+      size = (gsize) header.width * header.height * sizeof (gint);
+      if ((strncmp (header.key, key, sizeof (header.key)) == 0) &&
+          (header.orientation == orientation) && (header.reach >= reach) &&
+          (gimp_parasite_data_size (parasite) == sizeof (VMapCacheHeader) + size))
+        {
+          buffer = g_try_malloc (size);
+          if (buffer)
+            {
+              memcpy (buffer, data + sizeof (VMapCacheHeader), size);
+              vmap = lqr_vmap_new (buffer, header.width, header.height,
+                                   header.depth, header.orientation);
+              if (vmap == NULL)
+                {
+                  g_free (buffer);
+                }
+            }
+        }
+    }
+
+  gimp_parasite_free (parasite);
+
+  return vmap;
+}
+
+/* Replaces the cached map; failures are not fatal, the next run
+ * will just recompute the seams */
+void
+vmap_cache_store (gint32 image_ID, const gchar * key, LqrVMap * vmap, gint reach)
+{
+  VMapCacheHeader header;
+  GimpParasite *parasite;
+  guint64 size;
+  guchar *data;
+
+  memset (&header, 0, sizeof (VMapCacheHeader));
+  g_strlcpy (header.key, key, sizeof (header.key));
+  header.width = lqr_vmap_get_width (vmap);
+  header.height = lqr_vmap_get_height (vmap);
+  header.depth = lqr_vmap_get_depth (vmap);
+  header.orientation = lqr_vmap_get_orientation (vmap);
+  header.reach = reach;
+
+  size = (guint64) header.width * header.height * sizeof (gint);
+  if (sizeof (VMapCacheHeader) + size > G_MAXUINT32)
+    {
+      return;
+    }
+
+  data = g_try_malloc (sizeof (VMapCacheHeader) + size);
+  if (data == NULL)
+    {
+      return;
+    }
+  memcpy (data, &header, sizeof (VMapCacheHeader));
+  memcpy (data + sizeof (VMapCacheHeader), lqr_vmap_get_data (vmap), size);
+
+  parasite = gimp_parasite_new (VMAP_CACHE_PARASITE, GIMP_PARASITE_PERSISTENT,
+                                sizeof (VMapCacheHeader) + size, data);
+  gimp_image_attach_parasite (image_ID, parasite);
+  gimp_parasite_free (parasite);
+  g_free (data);
+}
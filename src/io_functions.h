@@ -23,6 +23,8 @@
 #error "lqr/lqr.h must be included prior to io_functions.h"
 #endif /* __LQR_H__ */
 
+struct _CarveBackend;            /* see engine.h */
+
 struct _VMapFuncArg;
 
 typedef struct _VMapFuncArg VMapFuncArg;
@@ -40,16 +42,109 @@ struct _VMapFuncArg
 
 #define VMAP_FUNC_ARG(data) ((VMapFuncArg*)(data))
 
+struct _LayerCommit;
+
+typedef struct _LayerCommit LayerCommit;
+
+/* Copy of the pixels last written to a layer, used to only
+ * transfer what changed between interactive renders */
+struct _LayerCommit
+{
+  guchar *buffer;
+  gint w;
+  gint h;
+  gint bpp;
+};
+
+#define AUX_LAYER_CACHE_SIZE (3)
+
+struct _AuxLayerCache;
+
+typedef struct _AuxLayerCache AuxLayerCache;
+
+/* Contents of the aux layers read during a render, so that
+ * each one is read only once; with full set, layers cover the area
+ * of the selected layer (width x height at x_off, y_off in the
+ * image), otherwise they are kept as compact masks like channels */
+struct _AuxLayerCache
+{
+  gint width;
+  gint height;
+  gint x_off;
+  gint y_off;
+  gboolean full;
+  gint n;
+  gint32 layer_ID[AUX_LAYER_CACHE_SIZE];
+  guchar *buffer[AUX_LAYER_CACHE_SIZE];
+  gboolean taken[AUX_LAYER_CACHE_SIZE];
+};
+
+/* PIXEL TRANSFERS */
+
+typedef enum
+{
+  PIXEL_IO_READ,
+  PIXEL_IO_WRITE,               /* through the shadow buffer */
+  PIXEL_IO_WRITE_DIRECT         /* straight into the drawable */
+} PixelIOMode;
+
+struct _PixelIO;
+
+typedef struct _PixelIO PixelIO;
+
+gint drawable_channels (gint32 drawable_ID);
+PixelIO *pixel_io_open (gint32 drawable_ID, PixelIOMode mode);
+void pixel_io_get_rect (PixelIO * io, guchar * dest, gsize rowstride,
+                        gint x, gint y, gint w, gint h);
+void pixel_io_set_rect (PixelIO * io, const guchar * src, gsize rowstride,
+                        gint x, gint y, gint w, gint h);
+void pixel_io_close (PixelIO * io, gboolean commit);
+
+/* BUFFERS */
+
+guchar *pixel_buffer_new (gint bpp, gint w, gint h, gboolean clear);
+gboolean pixel_buffer_is_mapped (guchar * buffer);
+void pixel_buffer_free (guchar * buffer);
+void pixel_buffers_release_mapped (void);
+
 /* INPUT/OUTPUT FUNCTIONS */
 
 guchar *rgb_buffer_from_layer (gint32 layer_ID);
-LqrRetVal update_bias (LqrCarver * r, gint32 layer_ID, gint bias_factor,
-                       gint base_x_off, gint base_y_off);
-LqrRetVal set_rigmask (LqrCarver * r, gint32 layer_ID, gint base_x_off, gint base_y_off);
+guchar *rgb_buffer_from_layer_area (gint32 layer_ID, gint x0, gint y0, gint w, gint h);
+guchar *mask_buffer_from_drawable (gint32 drawable_ID);
+guchar *mask_buffer_scaled_from_drawable (gint32 drawable_ID, gint base_x_off, gint base_y_off,
+                                          gint width, gint height, gint factor);
+LqrRetVal update_bias (const struct _CarveBackend * backend, gpointer carver,
+                       gint width, gint height,
+                       gint32 pres_layer_ID, gint pres_coeff,
+                       gint32 disc_layer_ID, gint disc_coeff,
+                       gint base_x_off, gint base_y_off, AuxLayerCache * cache);
+LqrRetVal set_rigmask (const struct _CarveBackend * backend, gpointer carver,
+                       gint32 layer_ID, gint base_x_off, gint base_y_off,
+                       AuxLayerCache * cache);
+guchar *aux_layer_cache_get (AuxLayerCache * cache, gint32 layer_ID);
+guchar *aux_layer_cache_take (AuxLayerCache * cache, gint32 layer_ID);
+void aux_layer_cache_clear (AuxLayerCache * cache);
 LqrRetVal write_carver_to_layer (LqrCarver * r, gint32 layer_ID);
+LqrRetVal write_carver_to_layer_diff (LqrCarver * r, gint32 layer_ID,
+                                      LayerCommit * commit);
+void layer_commit_clear (LayerCommit * commit);
+LqrRetVal write_carvers_to_layers (LqrCarver ** carvers, gint32 * layer_IDs,
+                                   gint n_jobs);
 LqrRetVal write_vmap_to_layer (LqrVMap * vmap, gpointer data);
 LqrRetVal write_all_vmaps (LqrVMapList * list, gint32 image_ID,
                            gchar * orig_name, gint x_off, gint y_off,
                            GimpRGB col_start, GimpRGB col_end);
+LqrRetVal write_all_vmaps_to_file (LqrVMapList * list, const gchar * filename);
+LqrVMap *vmap_from_file (const gchar * filename);
+
+/* SEAM MAP CACHE */
+
+void checksum_mask (GChecksum * sum, gint32 drawable_ID,
+                    gint base_x_off, gint base_y_off, AuxLayerCache * cache);
+LqrVMap *vmap_cache_load (gint32 image_ID, const gchar * key,
+                          gint orientation, gint reach);
+void vmap_cache_store (gint32 image_ID, const gchar * key,
+                       LqrVMap * vmap, gint reach);
 
 #endif /* __IO_FUNCTIONS__ */
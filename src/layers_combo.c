@@ -24,6 +24,8 @@
 
 #include <lqr.h>
 
+#include "io_functions.h"
+
 #include "plugin-intl.h"
 
 #include "main.h"
@@ -275,14 +277,13 @@ gint
 guess_new_size (GtkWidget * button, PreviewData * p_data, GuessDir direction)
 {
   gint32 disc_layer_ID;
-  GimpDrawable *drawable;
+  PixelIO *io;
   gint z1, z2, k;
   gint z1min, z1max, z2max;
   gint width, height;
   gint lw, lh;
   gint x_off, y_off;
   gint bpp, c_bpp;
-  GimpPixelRgn rgn_in;
   guchar *line;
   gboolean has_alpha;
   gdouble sum;
@@ -310,11 +311,14 @@ guess_new_size (GtkWidget * button, PreviewData * p_data, GuessDir direction)
   width = gimp_drawable_width (disc_layer_ID);
   height = gimp_drawable_height (disc_layer_ID);
   has_alpha = gimp_drawable_has_alpha (disc_layer_ID);
-  bpp = gimp_drawable_bpp (disc_layer_ID);
+  bpp = drawable_channels (disc_layer_ID);
   c_bpp = bpp - (has_alpha ? 1 : 0);
 
-  drawable = gimp_drawable_get (disc_layer_ID);
-  gimp_pixel_rgn_init (&rgn_in, drawable, 0, 0, width, height, FALSE, FALSE);
+  io = pixel_io_open (disc_layer_ID, PIXEL_IO_READ);
+  if (io == NULL)
+    {
+      return old_size;
+    }
 
 
   gimp_drawable_offsets (disc_layer_ID, &x_off, &y_off);
@@ -349,10 +353,12 @@ guess_new_size (GtkWidget * button, PreviewData * p_data, GuessDir direction)
       switch (direction)
         {
           case GUESS_DIR_HOR:
-            gimp_pixel_rgn_get_row (&rgn_in, line, MAX (0, -x_off), z1 - y_off, z2max);
+            pixel_io_get_rect (io, line, (gsize) bpp * z2max,
+                               MAX (0, -x_off), z1 - y_off, z2max, 1);
             break;
           case GUESS_DIR_VERT:
-            gimp_pixel_rgn_get_col (&rgn_in, line, z1 - x_off, MAX (0, -y_off), z2max);
+            pixel_io_get_rect (io, line, bpp,
+                               z1 - x_off, MAX (0, -y_off), 1, z2max);
             break;
         }
 
@@ -386,7 +392,7 @@ guess_new_size (GtkWidget * button, PreviewData * p_data, GuessDir direction)
   new_size = old_size - max_mask_size;
 
   g_free (line);
-  gimp_drawable_detach (drawable);
+  pixel_io_close (io, FALSE);
 
   return new_size;
 }
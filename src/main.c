@@ -26,12 +26,18 @@
 #include <libgimp/gimp.h>
 #include <libgimp/gimpui.h>
 #include <lqr.h>
+#ifdef LQR_GEGL_IO
+#include <gegl.h>
+#endif /* LQR_GEGL_IO */
 #include "altsizeentry.h"
 
 #include "plugin-intl.h"
 
 #include "main.h"
+#include "energy.h"
+#include "engine.h"
 #include "interface.h"
+#include "io_functions.h"
 #include "render.h"
 #include "interface_I.h"
 #include "interface_aux.h"
@@ -43,9 +49,16 @@ static void set_aux_layer_name(gint layer_ID, gboolean status, gchar * name);
 static void save_vals (void);
 static void retrieve_vals (void);
 static void retrieve_vals_use_aux_layers_names (gint32 image_ID);
-static void noninteractive_read_vals (const GimpParam * param);
+static void noninteractive_read_vals (const GimpParam * param, gint n_params,
+                                      gboolean read_size);
 static void install_custom_signals();
 static void cancel_work_on_aux_layer(void);
+static void run_multi (GimpRunMode run_mode, gint n_params, const GimpParam * param,
+                       gint * nreturn_vals, GimpParam ** return_vals);
+static void run_benchmark (gint n_params, const GimpParam * param,
+                           gint * nreturn_vals, GimpParam ** return_vals);
+static void run_replay (GimpRunMode run_mode, gint n_params, const GimpParam * param,
+                        gint * nreturn_vals, GimpParam ** return_vals);
 #if defined(G_OS_WIN32)
 static gchar * get_gimp_share_directory_on_windows();
 #endif
@@ -80,10 +93,21 @@ const PlugInVals default_vals = {
   FALSE,                        /* scaleback */
   SCALEBACK_MODE_LQRBACK,       /* scaleback mode */
   TRUE,                         /* no disc upon enlarging */
+  1,                            /* proxy factor */
+  0,                            /* memory limit */
+  PRESCALE_MODE_NONE,           /* prescale mode */
+  1,                            /* prescale ratio */
+  0,                            /* max seconds */
+  CARVE_BACKEND_LQR,            /* backend */
+  0,                            /* threads */
+  ALL_LAYERS_NONE,              /* all layers */
+  FALSE,                        /* independent layers */
+  0,                            /* energy cache */
   "",	                        /* pres_layer_name */
   "",                           /* disc_layer_name */
   "",                           /* rigmask_layer_name */
   "",                           /* selected layer name */
+  "",                           /* seams file */
 };
 
 const PlugInColVals default_col_vals = {
@@ -168,12 +192,12 @@ static GimpParamDef args[] = {
   {GIMP_PDB_DRAWABLE, "drawable", "Input drawable"},
   {GIMP_PDB_INT32, "width", "Final width"},
   {GIMP_PDB_INT32, "height", "Final height"},
-  {GIMP_PDB_INT32, "pres_layer", "Layer that marks preserved areas"},
+  {GIMP_PDB_INT32, "pres_layer", "Layer or channel that marks preserved areas"},
   {GIMP_PDB_INT32, "pres_coeff", "Preservation coefficient"},
-  {GIMP_PDB_INT32, "disc_layer", "Layer that marks areas to discard"},
+  {GIMP_PDB_INT32, "disc_layer", "Layer or channel that marks areas to discard"},
   {GIMP_PDB_INT32, "disc_coeff", "Discard coefficient"},
   {GIMP_PDB_FLOAT, "rigidity", "Rigidity coefficient"},
-  {GIMP_PDB_INT32, "rigidity_mask_layer", "Layer used as rigidity mask"},
+  {GIMP_PDB_INT32, "rigidity_mask_layer", "Layer or channel used as rigidity mask"},
   {GIMP_PDB_INT32, "delta_x", "max displacement of seams"},
   {GIMP_PDB_FLOAT, "enl_step", "enlargment step (ratio)"},
   {GIMP_PDB_INT32, "resize_aux_layers",
@@ -181,7 +205,7 @@ static GimpParamDef args[] = {
   {GIMP_PDB_INT32, "resize_canvas", "Whether to resize canvas"},
   {GIMP_PDB_INT32, "output_target", "Output target (same layer, new layer, new image)"},
   {GIMP_PDB_INT32, "seams", "Whether to output the seam map"},
-  {GIMP_PDB_INT32, "nrg_func", "Energy function to use"},
+  {GIMP_PDB_INT32, "nrg_func", "Energy function to use: liblqr's gradients (0-5), null (6), or the plug-in's Sobel (16), Scharr (17), forward energy (18), local entropy (19)"},
   {GIMP_PDB_INT32, "res_order", "Resize order"},
   {GIMP_PDB_INT32, "mask_behavior", "What to do with masks"},
   {GIMP_PDB_INT32, "scaleback", "Whether to scale back when done"},
@@ -191,10 +215,64 @@ static GimpParamDef args[] = {
   {GIMP_PDB_STRING, "disc_layer_name", "Discard layer name (for noninteractive mode only)"},
   {GIMP_PDB_STRING, "rigmask_layer_name", "Rigidity mask layer name (for noninteractive mode only)"},
   {GIMP_PDB_STRING, "selected_layer_name", "Selected layer name (for noninteractive mode only)"},
+  {GIMP_PDB_STRING, "seams_file", "File to write the seam map(s) to, in binary form (empty for none, for noninteractive mode only)"},
+  {GIMP_PDB_INT32, "proxy_factor", "Search the seams on a copy of the layer scaled down by this factor, then refine them at full size: faster but less accurate (1 for none, shrinks along one direction only)"},
+  {GIMP_PDB_INT32, "memory_limit", "Memory limit in MiB (0 for none): runs which would exceed it go without liblqr's cache, then without seams output, then shrinks are carved in strips on a proxy refined band by band; anything else is refused"},
+  {GIMP_PDB_INT32, "prescale_mode", "Plain scaling before carving, when both sides shrink or both grow: none (0), automatic (1, leaves at most 40% of change to carving), or by prescale_ratio (2); ignored with scaleback"},
+  {GIMP_PDB_FLOAT, "prescale_ratio", "Scaling ratio for prescale mode 2, limited so that carving goes the same way as the resize"},
+  {GIMP_PDB_INT32, "max_seconds", "Time budget in seconds (0 for none): one-side shrinks use a coarser proxy, resizes of both sides more prescaling, to fit in it"},
+  {GIMP_PDB_INT32, "backend", "Seam search backend: liblqr (0) or threaded (1, shrinks along one direction only, the others fall back to liblqr)"},
+  {GIMP_PDB_INT32, "threads", "Number of threads of the threaded backend, and of the workers carving independent layers (0 for one per processor)"},
+  {GIMP_PDB_INT32, "all_layers", "Carve the other layers along, with the seams of the selected layer, cropped to its area: none (0), all the layers of the image (1), the layers of its group (2); aux layers follow resize_aux_layers instead"},
+  {GIMP_PDB_INT32, "independent_layers", "With all_layers, carve each of the other layers with its own seams, on up to threads worker threads, instead of with the seams of the selected layer (TRUE or FALSE)"},
+  {GIMP_PDB_INT32, "energy_cache", "Size limit in MiB of the on-disk cache of the energy maps computed by the threaded backend, kept across runs under the user's cache directory (0 for no cache)"},
+};
+
+/* plug-in-lqr-multi takes the same arguments as plug-in-lqr,
+ * except for the final size */
+static GimpParamDef multi_size_args[] = {
+  {GIMP_PDB_INT32, "num_sizes", "Length of the sizes array (twice the number of sizes)"},
+  {GIMP_PDB_INT32ARRAY, "sizes", "Final sizes, as width, height pairs"},
+};
+
+static GimpParamDef multi_return_vals[] = {
+  {GIMP_PDB_INT32, "num_layers", "Number of output layers"},
+  {GIMP_PDB_INT32ARRAY, "layers", "Output layers, one for each size"},
+};
+
+static GimpParamDef lqr_return_vals[] = {
+  {GIMP_PDB_INT32, "degradations", "What was given up to meet max_seconds: 1 proxy, 2 prescaling, 4 still expected over time"},
+  {GIMP_PDB_INT32, "proxy_factor", "Proxy factor used (1 for none)"},
+  {GIMP_PDB_FLOAT, "prescale_ratio", "Scaling ratio applied before carving (1 for none)"},
+};
+
+static GimpParamDef replay_args[] = {
+  {GIMP_PDB_INT32, "run_mode", "Interactive, non-interactive"},
+  {GIMP_PDB_IMAGE, "image", "Input image"},
+  {GIMP_PDB_DRAWABLE, "drawable", "Input drawable"},
+  {GIMP_PDB_STRING, "seams_file", "Seam map file, as written by " PLUG_IN_NAME},
+  {GIMP_PDB_INT32, "size", "Final width (or height, for maps of horizontal seams)"},
+  {GIMP_PDB_INT32, "resize_canvas", "Whether to resize canvas"},
+  {GIMP_PDB_INT32, "output_target", "Output target (same layer, new layer, new image)"},
+};
+
+static GimpParamDef benchmark_args[] = {
+  {GIMP_PDB_INT32, "run_mode", "Interactive, non-interactive"},
+  {GIMP_PDB_IMAGE, "image", "Input image"},
+  {GIMP_PDB_DRAWABLE, "drawable", "Input drawable"},
+  {GIMP_PDB_INT32, "runs", "Runs of each energy function, the best one is reported"},
+};
+
+static GimpParamDef replay_return_vals[] = {
+  {GIMP_PDB_LAYER, "layer", "Output layer"},
 };
 
 static int args_num;
 
+/* the arguments up to selected_layer_name; scripts written before the
+ * later ones were added may leave them out, they keep their defaults */
+#define ARGS_NUM_MIN 27
+
 GimpPlugInInfo PLUG_IN_INFO = {
   NULL,                         /* init_proc  */
   NULL,                         /* quit_proc  */
@@ -211,6 +289,7 @@ static void query (void)
 #endif
   gchar *help_path;
   gchar *help_uri;
+  GimpParamDef *multi_args;
 
   args_num = G_N_ELEMENTS (args);
 
@@ -236,9 +315,61 @@ static void query (void)
                           "Carlo Baldassi <carlobaldassi@gmail.com>",
                           "Carlo Baldassi <carlobaldassi@gmail.com>", "2010",
                           N_("Li_quid rescale..."), "RGB*, GRAY*",
-                          GIMP_PLUGIN, args_num, 0, args, NULL);
+                          GIMP_PLUGIN, args_num, G_N_ELEMENTS (lqr_return_vals),
+                          args, lqr_return_vals);
 
   gimp_plugin_menu_register (PLUG_IN_NAME, "<Image>/Layer/");
+
+  multi_args = g_memdup (args, sizeof (args));
+  multi_args[3] = multi_size_args[0];
+  multi_args[4] = multi_size_args[1];
+
+  gimp_install_procedure (PLUG_IN_MULTI_NAME,
+                          "Resize a layer to several sizes at once",
+                          "Same as " PLUG_IN_NAME ", but the final width and height are "
+                          "replaced by a list of sizes. Each size is written to a new "
+                          "layer, or to a new image if the output target is a new image; "
+                          "the seams are computed once for all the sizes with the same "
+                          "extent along the first resize direction. Aux layers are only "
+                          "used as masks. The following arguments are ignored: seams, "
+                          "seams_file, scaleback, scaleback_mode, proxy_factor, "
+                          "memory_limit, prescale_mode, prescale_ratio, max_seconds, "
+                          "backend, threads, all_layers, independent_layers and "
+                          "energy_cache.",
+                          "Carlo Baldassi <carlobaldassi@gmail.com>",
+                          "Carlo Baldassi <carlobaldassi@gmail.com>", "2010",
+                          NULL, "RGB*, GRAY*",
+                          GIMP_PLUGIN, args_num, G_N_ELEMENTS (multi_return_vals),
+                          multi_args, multi_return_vals);
+
+  g_free (multi_args);
+
+  gimp_install_procedure (PLUG_IN_REPLAY_NAME,
+                          "Resize a layer along a saved seam map",
+                          "Applies a seam map written by " PLUG_IN_NAME " (see its seams_file "
+                          "argument) to a layer of the same size, e.g. another exposure or "
+                          "channel aligned with the original one. The seams are not computed "
+                          "again, so the layer is carved exactly like the original one; "
+                          "the final size must be within the depth of the map.",
+                          "Carlo Baldassi <carlobaldassi@gmail.com>",
+                          "Carlo Baldassi <carlobaldassi@gmail.com>", "2010",
+                          NULL, "RGB*, GRAY*",
+                          GIMP_PLUGIN, G_N_ELEMENTS (replay_args),
+                          G_N_ELEMENTS (replay_return_vals),
+                          replay_args, replay_return_vals);
+
+  gimp_install_procedure (PLUG_IN_BENCHMARK_NAME,
+                          "Time the energy functions on a layer",
+                          "Computes the energy map of the layer with each of liblqr's "
+                          "builtin energy functions and each of the plug-in's kernels, "
+                          "through liblqr, and for the kernels also a row at a time as "
+                          "the threaded backend does, and prints the times to the "
+                          "standard error. The layer is not changed.",
+                          "Carlo Baldassi <carlobaldassi@gmail.com>",
+                          "Carlo Baldassi <carlobaldassi@gmail.com>", "2010",
+                          NULL, "RGB*, GRAY*",
+                          GIMP_PLUGIN, G_N_ELEMENTS (benchmark_args), 0,
+                          benchmark_args, NULL);
 }
 
 
@@ -247,7 +378,7 @@ run (const gchar * name,
      gint n_params,
      const GimpParam * param, gint * nreturn_vals, GimpParam ** return_vals)
 {
-  static GimpParam values[1];
+  static GimpParam values[4];
   gint32 layer_ID;
 
   gint32 image_ID;
@@ -275,6 +406,10 @@ run (const gchar * name,
 #endif
   textdomain (GETTEXT_PACKAGE);
 
+#ifdef LQR_GEGL_IO
+  gegl_init (NULL, NULL);
+#endif /* LQR_GEGL_IO */
+
   args_num = G_N_ELEMENTS (args);
 
   run_mode = param[0].data.d_int32;
@@ -301,12 +436,30 @@ run (const gchar * name,
   image_vals.image_ID = image_ID;
   drawable_vals.layer_ID = layer_ID;
 
+  if (strcmp (name, PLUG_IN_MULTI_NAME) == 0)
+    {
+      run_multi (run_mode, n_params, param, nreturn_vals, return_vals);
+      return;
+    }
+
+  if (strcmp (name, PLUG_IN_REPLAY_NAME) == 0)
+    {
+      run_replay (run_mode, n_params, param, nreturn_vals, return_vals);
+      return;
+    }
+
+  if (strcmp (name, PLUG_IN_BENCHMARK_NAME) == 0)
+    {
+      run_benchmark (n_params, param, nreturn_vals, return_vals);
+      return;
+    }
+
   if (strcmp (name, PLUG_IN_NAME) == 0)
     {
       switch (run_mode)
         {
         case GIMP_RUN_NONINTERACTIVE:
-          if (n_params != args_num)
+          if ((n_params < ARGS_NUM_MIN) || (n_params > args_num))
             {
               fprintf(stderr, "gimp-lqr-plugin: error: wrong number of arguments\n");
               fflush(stderr);
@@ -314,7 +467,7 @@ run (const gchar * name,
             }
           else
             {
-              noninteractive_read_vals (param);
+              noninteractive_read_vals (param, n_params, TRUE);
               layer_ID = drawable_vals.layer_ID;
             }
           break;
@@ -429,6 +582,23 @@ run (const gchar * name,
                   gimp_image_undo_group_start (image_ID);
                 }
               render_success = render_noninteractive (&vals, &col_vals, carver_data);
+              if (render_success)
+                {
+                  *nreturn_vals = 4;
+                  values[1].type = GIMP_PDB_INT32;
+                  values[1].data.d_int32 = carver_data->degradations;
+                  values[2].type = GIMP_PDB_INT32;
+                  values[2].data.d_int32 = MAX (carver_data->proxy_factor, 1);
+                  values[3].type = GIMP_PDB_FLOAT;
+                  values[3].data.d_float = carver_data->prescale_ratio;
+                }
+              /* new images are only shown once they are complete,
+               * and not at all from scripts */
+              if ((vals.output_target == OUTPUT_TARGET_NEW_IMAGE) &&
+                  (run_mode != GIMP_RUN_NONINTERACTIVE))
+                {
+                  gimp_display_new (image_ID);
+                }
             }
         }
 
@@ -468,6 +638,15 @@ layer_from_name(gint32 image_ID, gchar * name)
         return layer_list[i];
       }
   }
+
+  /* channels can be used as masks too */
+  layer_list = gimp_image_get_channels(image_ID, &num_layers);
+  for (i = 0; i < num_layers; i++) {
+    if (strncmp(name, gimp_drawable_get_name(layer_list[i]), VALS_MAX_NAME_LENGTH) == 0)
+      {
+        return layer_list[i];
+      }
+  }
   return 0;
 }
 
@@ -517,7 +696,7 @@ retrieve_vals_use_aux_layers_names (gint32 image_ID)
 }
 
 static void
-noninteractive_read_vals (const GimpParam * param)
+noninteractive_read_vals (const GimpParam * param, gint n_params, gboolean read_size)
 {
   gint32 image_ID;
   gint32 aux_pres_layer_ID;
@@ -528,8 +707,12 @@ noninteractive_read_vals (const GimpParam * param)
 
   image_ID = image_vals.image_ID;
 
-  vals.new_width = param[val_ind++].data.d_int32;
-  vals.new_height = param[val_ind++].data.d_int32;
+  if (read_size)
+    {
+      vals.new_width = param[val_ind].data.d_int32;
+      vals.new_height = param[val_ind + 1].data.d_int32;
+    }
+  val_ind += 2;
   vals.pres_layer_ID = param[val_ind++].data.d_int32;
   vals.pres_coeff = param[val_ind++].data.d_int32;
   vals.disc_layer_ID = param[val_ind++].data.d_int32;
@@ -552,6 +735,29 @@ noninteractive_read_vals (const GimpParam * param)
   g_strlcpy(vals.disc_layer_name, param[val_ind++].data.d_string, VALS_MAX_NAME_LENGTH);
   g_strlcpy(vals.rigmask_layer_name, param[val_ind++].data.d_string, VALS_MAX_NAME_LENGTH);
   g_strlcpy(vals.selected_layer_name, param[val_ind++].data.d_string, VALS_MAX_NAME_LENGTH);
+  /* past ARGS_NUM_MIN, the arguments left out keep the defaults */
+  if (val_ind < n_params)
+    g_strlcpy(vals.seams_file, param[val_ind++].data.d_string, VALS_MAX_NAME_LENGTH);
+  if (val_ind < n_params)
+    vals.proxy_factor = MAX (param[val_ind++].data.d_int32, 1);
+  if (val_ind < n_params)
+    vals.memory_limit = MAX (param[val_ind++].data.d_int32, 0);
+  if (val_ind < n_params)
+    vals.prescale_mode = param[val_ind++].data.d_int32;
+  if (val_ind < n_params)
+    vals.prescale_ratio = param[val_ind++].data.d_float;
+  if (val_ind < n_params)
+    vals.max_seconds = MAX (param[val_ind++].data.d_int32, 0);
+  if (val_ind < n_params)
+    vals.backend = param[val_ind++].data.d_int32;
+  if (val_ind < n_params)
+    vals.n_threads = MAX (param[val_ind++].data.d_int32, 0);
+  if (val_ind < n_params)
+    vals.all_layers = param[val_ind++].data.d_int32;
+  if (val_ind < n_params)
+    vals.independent_layers = param[val_ind++].data.d_int32;
+  if (val_ind < n_params)
+    vals.energy_cache = MAX (param[val_ind++].data.d_int32, 0);
 
   aux_pres_layer_ID = layer_from_name(image_ID, vals.pres_layer_name);
   aux_disc_layer_ID = layer_from_name(image_ID, vals.disc_layer_name);
@@ -589,6 +795,171 @@ noninteractive_read_vals (const GimpParam * param)
     }
 }
 
+static void
+run_multi (GimpRunMode run_mode, gint n_params, const GimpParam * param,
+           gint * nreturn_vals, GimpParam ** return_vals)
+{
+  static GimpParam values[3];
+  static gint32 *out_layer_IDs = NULL;
+  gint32 image_ID;
+  gint n_sizes = 0;
+  gint *sizes = NULL;
+  gint i;
+  GimpPDBStatusType status = GIMP_PDB_SUCCESS;
+
+  *nreturn_vals = 1;
+  *return_vals = values;
+
+  if ((n_params < ARGS_NUM_MIN) || (n_params > args_num))
+    {
+      fprintf(stderr, "gimp-lqr-plugin: error: wrong number of arguments\n");
+      fflush(stderr);
+      status = GIMP_PDB_CALLING_ERROR;
+    }
+  else
+    {
+      n_sizes = param[3].data.d_int32 / 2;
+      sizes = param[4].data.d_int32array;
+      if ((n_sizes < 1) || (param[3].data.d_int32 % 2 != 0))
+        {
+          status = GIMP_PDB_CALLING_ERROR;
+        }
+      for (i = 0; i < 2 * n_sizes; i++)
+        {
+          if (sizes[i] < 1)
+            {
+              status = GIMP_PDB_CALLING_ERROR;
+            }
+        }
+      if (!gimp_image_is_valid (image_vals.image_ID))
+        {
+          g_message (_("Error: invalid image"));
+          status = GIMP_PDB_CALLING_ERROR;
+        }
+    }
+
+  if (status == GIMP_PDB_SUCCESS)
+    {
+      noninteractive_read_vals (param, n_params, FALSE);
+      vals.new_width = sizes[0];
+      vals.new_height = sizes[1];
+
+      image_ID = image_vals.image_ID;
+      AUX_LAYER_STATUS(vals.pres_layer_ID, ui_vals.pres_status);
+      AUX_LAYER_STATUS(vals.disc_layer_ID, ui_vals.disc_status);
+      AUX_LAYER_STATUS(vals.rigmask_layer_ID, ui_vals.rigmask_status);
+
+      g_free (out_layer_IDs);
+      out_layer_IDs = g_new0 (gint32, n_sizes);
+
+      gimp_image_undo_group_start (image_ID);
+      if (!render_multi_noninteractive (&image_vals, &drawable_vals, &vals, sizes, n_sizes,
+                                        run_mode != GIMP_RUN_NONINTERACTIVE, out_layer_IDs))
+        {
+          status = GIMP_PDB_EXECUTION_ERROR;
+        }
+      if (run_mode != GIMP_RUN_NONINTERACTIVE)
+        gimp_displays_flush ();
+      gimp_image_undo_group_end (image_ID);
+    }
+
+  values[0].type = GIMP_PDB_STATUS;
+  values[0].data.d_status = status;
+
+  if (status == GIMP_PDB_SUCCESS)
+    {
+      *nreturn_vals = 3;
+      values[1].type = GIMP_PDB_INT32;
+      values[1].data.d_int32 = n_sizes;
+      values[2].type = GIMP_PDB_INT32ARRAY;
+      values[2].data.d_int32array = out_layer_IDs;
+    }
+}
+
+static void
+run_replay (GimpRunMode run_mode, gint n_params, const GimpParam * param,
+            gint * nreturn_vals, GimpParam ** return_vals)
+{
+  static GimpParam values[2];
+  gint32 image_ID;
+  gint32 out_layer_ID = -1;
+  const gchar *seams_file = NULL;
+  gint size = 0;
+  GimpPDBStatusType status = GIMP_PDB_SUCCESS;
+
+  *nreturn_vals = 1;
+  *return_vals = values;
+
+  if (n_params != G_N_ELEMENTS (replay_args))
+    {
+      fprintf(stderr, "gimp-lqr-plugin: error: wrong number of arguments\n");
+      fflush(stderr);
+      status = GIMP_PDB_CALLING_ERROR;
+    }
+  else
+    {
+      seams_file = param[3].data.d_string;
+      size = param[4].data.d_int32;
+      vals.resize_canvas = param[5].data.d_int32;
+      vals.output_target = param[6].data.d_int32;
+      if ((seams_file == NULL) || (size < 1) ||
+          !gimp_image_is_valid (image_vals.image_ID) ||
+          !gimp_drawable_is_layer (drawable_vals.layer_ID))
+        {
+          status = GIMP_PDB_CALLING_ERROR;
+        }
+    }
+
+  if (status == GIMP_PDB_SUCCESS)
+    {
+      image_ID = image_vals.image_ID;
+      gimp_image_undo_group_start (image_ID);
+      if (!render_replay (&image_vals, &drawable_vals, &vals, seams_file, size,
+                          run_mode != GIMP_RUN_NONINTERACTIVE, &out_layer_ID))
+        {
+          status = GIMP_PDB_EXECUTION_ERROR;
+        }
+      if (run_mode != GIMP_RUN_NONINTERACTIVE)
+        gimp_displays_flush ();
+      gimp_image_undo_group_end (image_ID);
+    }
+
+  values[0].type = GIMP_PDB_STATUS;
+  values[0].data.d_status = status;
+
+  if (status == GIMP_PDB_SUCCESS)
+    {
+      *nreturn_vals = 2;
+      values[1].type = GIMP_PDB_LAYER;
+      values[1].data.d_layer = out_layer_ID;
+    }
+}
+
+static void
+run_benchmark (gint n_params, const GimpParam * param,
+               gint * nreturn_vals, GimpParam ** return_vals)
+{
+  static GimpParam values[1];
+  GimpPDBStatusType status = GIMP_PDB_SUCCESS;
+
+  *nreturn_vals = 1;
+  *return_vals = values;
+
+  if ((n_params != G_N_ELEMENTS (benchmark_args)) || (param[3].data.d_int32 < 1) ||
+      !gimp_drawable_is_layer (drawable_vals.layer_ID))
+    {
+      status = GIMP_PDB_CALLING_ERROR;
+    }
+  else if (!energy_benchmark (drawable_vals.layer_ID, param[3].data.d_int32))
+    {
+      g_message (_("Not enough memory"));
+      status = GIMP_PDB_EXECUTION_ERROR;
+    }
+
+  values[0].type = GIMP_PDB_STATUS;
+  values[0].data.d_status = status;
+}
+
 static void
 install_custom_signals()
 {
@@ -117,6 +117,33 @@ enum _ScalebackMode
 typedef enum _ScalebackMode ScalebackMode;
 
 
+/* Prescale modes: how much of a resize along both directions is done
+ * by plain scaling before carving */
+
+enum _PrescaleMode
+{
+  PRESCALE_MODE_NONE,
+  PRESCALE_MODE_AUTO,           /* leave PRESCALE_AUTO_CHANGE to carving */
+  PRESCALE_MODE_RATIO           /* scale by prescale_ratio */
+};
+
+typedef enum _PrescaleMode PrescaleMode;
+
+#define PRESCALE_AUTO_CHANGE (0.4)
+
+
+/* Layers carved along with the selected one, following its seams */
+
+enum _AllLayersMode
+{
+  ALL_LAYERS_NONE,
+  ALL_LAYERS_IMAGE,
+  ALL_LAYERS_GROUP              /* the group of the selected layer */
+};
+
+typedef enum _AllLayersMode AllLayersMode;
+
+
 /*  Default values  */
 
 extern const PlugInVals default_vals;
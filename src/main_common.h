@@ -22,6 +22,9 @@
 /*  Constants  */
 
 #define PLUG_IN_NAME   "plug-in-lqr"
+#define PLUG_IN_MULTI_NAME "plug-in-lqr-multi"
+#define PLUG_IN_REPLAY_NAME "plug-in-lqr-replay"
+#define PLUG_IN_BENCHMARK_NAME "plug-in-lqr-energy-benchmark"
 
 #define DATA_KEY_VALS    "plug_in_lqr"
 #define DATA_KEY_UI_VALS "plug_in_lqr_ui"
@@ -53,10 +56,21 @@ typedef struct
   gboolean scaleback;
   gint scaleback_mode;
   gboolean no_disc_on_enlarge;
+  gint proxy_factor;
+  gint memory_limit;
+  gint prescale_mode;
+  gfloat prescale_ratio;
+  gint max_seconds;
+  gint backend;
+  gint n_threads;
+  gint all_layers;
+  gboolean independent_layers;
+  gint energy_cache;
   gchar pres_layer_name[VALS_MAX_NAME_LENGTH];
   gchar disc_layer_name[VALS_MAX_NAME_LENGTH];
   gchar rigmask_layer_name[VALS_MAX_NAME_LENGTH];
   gchar selected_layer_name[VALS_MAX_NAME_LENGTH];
+  gchar seams_file[VALS_MAX_NAME_LENGTH];
 } PlugInVals;
 
 #endif /* __MAIN_COMMON_H__ */
@@ -0,0 +1,479 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <libgimp/gimp.h>
+#include <lqr.h>
+
+#include "plugin-intl.h"
+
+#include "main.h"
+#include "io_functions.h"
+#include "energy.h"
+#include "proxy.h"
+
+/* Each pixel of the proxy stands for a block of factor x factor
+ * pixels of the layer (the last row and column of blocks take the
+ * remainder), and each seam of the proxy for factor seams of the
+ * layer. These are refined one at a time: a seam is the cheapest
+ * path through the pixels left in a band around the blocks its
+ * proxy seam goes through, where the energy is the gradient across
+ * the seams on the full size pixels. The masks only steer the seams
+ * through the proxy. */
+
+/* cost of each pixel a refined seam moves beyond delta_x from one
+ * row to the next */
+#define PROXY_STEP_PENALTY (256)
+
+/* static functions declarations */
+
+static LqrRetVal proxy_bias (LqrCarver * r, gint32 layer_ID, gint bias_factor,
+                             gint x_off, gint y_off, gint width, gint height, gint factor);
+static LqrRetVal proxy_rigmask (LqrCarver * r, gint32 layer_ID,
+                                gint x_off, gint y_off, gint width, gint height, gint factor);
+static gint * proxy_guides (LqrVMap * vmap, gint p_reach);
+static gboolean grow_candidates (gint ** cand, gint ** from, gint64 ** cost, gint * max_cand);
+
+
+LqrVMap *
+proxy_vmap_new (PlugInVals * vals, guchar * rgb_buffer,
+                gint width, gint height, gint bpp,
+                gint x_off, gint y_off, gfloat rigidity,
+                gboolean ignore_disc_mask, gint orientation, gint reach,
+                LqrProgress * progress)
+{
+  LqrVMap *vmap;
+  guchar *p_buffer;
+  guint32 *sums;
+  gint *guides;
+  gint *ranks;
+  gint factor;
+  gint pw, ph, py, y0, y1;
+  gint p_n_u, p_n_v;
+  gint p_reach;
+
+  factor = vals->proxy_factor;
+  if (factor < 2)
+    {
+      return NULL;
+    }
+
+  pw = width / factor;
+  ph = height / factor;
+  p_n_u = (orientation == 0) ? pw : ph;
+  p_n_v = (orientation == 0) ? ph : pw;
+  p_reach = (reach + factor - 1) / factor;
+
+  /* too small to be worth it, the caller carves at full size */
+  if ((p_n_v < 1) || (p_reach >= p_n_u))
+    {
+      return NULL;
+    }
+
+  LQR_TRY_N_N (sums = g_try_new (guint32, (gsize) pw * bpp));
+  p_buffer = g_try_new (guchar, (gsize) pw * ph * bpp);
+  if (p_buffer == NULL)
+    {
+      g_free (sums);
+      return NULL;
+    }
+  for (py = 0; py < ph; py++)
+    {
+      y0 = py * factor;
+      y1 = (py == ph - 1) ? height : y0 + factor;
+      proxy_reduce_rows (rgb_buffer + (gsize) y0 * width * bpp, y1 - y0, width, bpp,
+                         factor, sums, p_buffer + (gsize) py * pw * bpp);
+    }
+  g_free (sums);
+
+  LQR_TRY_N_N (guides = proxy_guides_new (vals, p_buffer, width, height, bpp, x_off, y_off,
+                                          rigidity, ignore_disc_mask, orientation, p_reach,
+                                          progress));
+
+  ranks = g_try_new0 (gint, (gsize) width * height);
+  if (ranks == NULL)
+    {
+      g_free (guides);
+      return NULL;
+    }
+
+  gimp_progress_init (_("Refining seams..."));
+  if (!proxy_refine_band (rgb_buffer, width, bpp, orientation,
+                          orientation == 0 ? width : height, 0, orientation == 0 ? height : width,
+                          reach, factor, vals->delta_x, guides, p_reach, p_n_v, ranks, NULL, 0))
+    {
+      g_free (ranks);
+      ranks = NULL;
+    }
+  gimp_progress_end ();
+  g_free (guides);
+  LQR_TRY_N_N (ranks);
+
+  vmap = lqr_vmap_new (ranks, width, height, reach, orientation);
+  if (vmap == NULL)
+    {
+      g_free (ranks);
+    }
+
+  return vmap;
+}
+
+/* Averages n_rows rows of the layer (a row of blocks) into one row
+ * of the proxy; sums must hold width / factor * bpp values */
+void
+proxy_reduce_rows (const guchar * rows, gint n_rows, gint width, gint bpp, gint factor,
+                   guint32 * sums, guchar * dest)
+{
+  gint pw;
+  gint x, y, px, k, n;
+  const guchar *src;
+
+  pw = width / factor;
+
+  memset (sums, 0, (gsize) pw * bpp * sizeof (guint32));
+  for (y = 0; y < n_rows; y++)
+    {
+      src = rows + (gsize) y * width * bpp;
+      for (x = 0; x < width; x++)
+        {
+          px = MIN (x / factor, pw - 1);
+          for (k = 0; k < bpp; k++)
+            {
+              sums[px * bpp + k] += src[(gsize) x * bpp + k];
+            }
+        }
+    }
+  for (px = 0; px < pw; px++)
+    {
+      n = n_rows * ((px == pw - 1) ? width - px * factor : factor);
+      for (k = 0; k < bpp; k++)
+        {
+          dest[(gsize) px * bpp + k] = (sums[px * bpp + k] + n / 2) / n;
+        }
+    }
+}
+
+static LqrRetVal
+proxy_bias (LqrCarver * r, gint32 layer_ID, gint bias_factor,
+            gint x_off, gint y_off, gint width, gint height, gint factor)
+{
+  guchar *mask;
+
+  if ((layer_ID == 0) || (bias_factor == 0))
+    {
+      return LQR_OK;
+    }
+
+  CATCH_MEM (mask = mask_buffer_scaled_from_drawable (layer_ID, x_off, y_off,
+                                                      width, height, factor));
+  CATCH (lqr_carver_bias_add_rgb_area (r, mask, bias_factor, 1,
+                                       width / factor, height / factor, 0, 0));
+  g_free (mask);
+
+  return LQR_OK;
+}
+
+static LqrRetVal
+proxy_rigmask (LqrCarver * r, gint32 layer_ID,
+               gint x_off, gint y_off, gint width, gint height, gint factor)
+{
+  guchar *mask;
+
+  if (layer_ID == 0)
+    {
+      return LQR_OK;
+    }
+
+  CATCH_MEM (mask = mask_buffer_scaled_from_drawable (layer_ID, x_off, y_off,
+                                                      width, height, factor));
+  CATCH (lqr_carver_rigmask_add_rgb_area (r, mask, 1,
+                                          width / factor, height / factor, 0, 0));
+  g_free (mask);
+
+  return LQR_OK;
+}
+
+/* Carves the proxy p_buffer (which is taken over) of a width x height
+ * layer, masks included, by p_reach seams; returns, for each row of
+ * the proxy along the seams and each of its seams, the position of
+ * the seam across the row */
+gint *
+proxy_guides_new (PlugInVals * vals, guchar * p_buffer,
+                  gint width, gint height, gint bpp,
+                  gint x_off, gint y_off, gfloat rigidity,
+                  gboolean ignore_disc_mask, gint orientation, gint p_reach,
+                  LqrProgress * progress)
+{
+  LqrCarver *carver;
+  LqrVMap *vmap = NULL;
+  gint *guides;
+  gint factor;
+  gint pw, ph;
+
+  factor = vals->proxy_factor;
+  pw = width / factor;
+  ph = height / factor;
+
+  carver = lqr_carver_new (p_buffer, pw, ph, bpp);
+  if (carver == NULL)
+    {
+      g_free (p_buffer);
+      return NULL;
+    }
+
+  if ((lqr_carver_init (carver, vals->delta_x, rigidity) == LQR_OK) &&
+      (proxy_bias (carver, vals->pres_layer_ID, vals->pres_coeff,
+                   x_off, y_off, width, height, factor) == LQR_OK) &&
+      (ignore_disc_mask ||
+       (proxy_bias (carver, vals->disc_layer_ID, -vals->disc_coeff,
+                    x_off, y_off, width, height, factor) == LQR_OK)) &&
+      (proxy_rigmask (carver, vals->rigmask_layer_ID,
+                      x_off, y_off, width, height, factor) == LQR_OK))
+    {
+      energy_set_function (carver, vals->nrg_func);
+      lqr_carver_set_progress (carver, progress);
+      lqr_carver_set_side_switch_frequency (carver, 2);
+      if (lqr_carver_resize (carver,
+                             orientation == 0 ? pw - p_reach : pw,
+                             orientation == 0 ? ph : ph - p_reach) == LQR_OK)
+        {
+          vmap = lqr_vmap_dump (carver);
+        }
+    }
+
+  lqr_carver_destroy (carver);
+
+  LQR_TRY_N_N (vmap);
+  guides = proxy_guides (vmap, p_reach);
+  lqr_vmap_destroy (vmap);
+
+  return guides;
+}
+
+static gint *
+proxy_guides (LqrVMap * vmap, gint p_reach)
+{
+  gint *data;
+  gint *guides;
+  gint w, h, orientation;
+  gint n_u, n_v;
+  gint u, v, rank;
+
+  data = lqr_vmap_get_data (vmap);
+  w = lqr_vmap_get_width (vmap);
+  h = lqr_vmap_get_height (vmap);
+  orientation = lqr_vmap_get_orientation (vmap);
+  n_u = (orientation == 0) ? w : h;
+  n_v = (orientation == 0) ? h : w;
+
+  LQR_TRY_N_N (guides = g_try_new0 (gint, (gsize) n_v * p_reach));
+
+  for (v = 0; v < n_v; v++)
+    {
+      for (u = 0; u < n_u; u++)
+        {
+          rank = data[PROXY_INDEX (u, v, w, orientation)];
+          if ((rank >= 1) && (rank <= p_reach))
+            {
+              guides[(gsize) v * p_reach + rank - 1] = u;
+            }
+        }
+    }
+
+  return guides;
+}
+
+static inline gint
+luma (const guchar * rgb_buffer, gsize index, gint bpp)
+{
+  const guchar *p = rgb_buffer + index * bpp;
+
+  return (bpp < 3) ? 3 * p[0] : p[0] + p[1] + p[2];
+}
+
+/* Gradient across the seams, on the original pixels */
+static inline gint
+energy (const guchar * rgb_buffer, gint buf_width, gint bpp, gint orientation,
+        gint n_u, gint u, gint v)
+{
+  gint u0 = MAX (u - 1, 0);
+  gint u1 = MIN (u + 1, n_u - 1);
+
+  return ABS (luma (rgb_buffer, PROXY_INDEX (u1, v, buf_width, orientation), bpp) -
+              luma (rgb_buffer, PROXY_INDEX (u0, v, buf_width, orientation), bpp));
+}
+
+/* Doubles the room for the candidates; on failure, the buffers
+ * are left as they were, to be freed by the caller */
+static gboolean
+grow_candidates (gint ** cand, gint ** from, gint64 ** cost, gint * max_cand)
+{
+  gpointer p;
+  gint n = 2 * *max_cand;
+
+  if ((p = g_try_renew (gint, *cand, n)) == NULL)
+    {
+      return FALSE;
+    }
+  *cand = p;
+  if ((p = g_try_renew (gint, *from, n)) == NULL)
+    {
+      return FALSE;
+    }
+  *from = p;
+  if ((p = g_try_renew (gint64, *cost, n)) == NULL)
+    {
+      return FALSE;
+    }
+  *cost = p;
+  *max_cand = n;
+
+  return TRUE;
+}
+
+/* Refines the seams over a band of n_rows rows along the seams,
+ * starting at row v0 of the layer; rgb_buffer and ranks (zeroed by
+ * the caller) hold the band, with rows n_u pixels long. The r-th
+ * seam follows proxy seam (r - 1) / factor, and its pixels get rank
+ * r. If last is not NULL, seam r starts next to last[r - 1] (if not
+ * negative), where a previous band left it, and last[r - 1] is set
+ * to its position at row last_row of the band. */
+gboolean
+proxy_refine_band (const guchar * rgb_buffer, gint buf_width, gint bpp, gint orientation,
+                   gint n_u, gint v0, gint n_rows, gint reach, gint factor, gint delta_x,
+                   const gint * guides, gint p_reach, gint p_n_v,
+                   gint * ranks, gint * last, gint last_row)
+{
+  gint *start;
+  gint *cand;
+  gint *from;
+  gint64 *cost;
+  gint n_cand, max_cand;
+  gint r, k, u, v, i, j, c, lo, hi, half, step, best_j;
+  gint64 best, cj;
+  gboolean ok = FALSE;
+
+  /* a band is 3 blocks wide, widened only where the neighbouring
+   * seams took all of it */
+  max_cand = n_rows * 3 * factor;
+
+  start = g_try_new (gint, n_rows + 1);
+  cand = g_try_new (gint, max_cand);
+  from = g_try_new (gint, max_cand);
+  cost = g_try_new (gint64, max_cand);
+  if ((start == NULL) || (cand == NULL) || (from == NULL) || (cost == NULL))
+    {
+      goto out;
+    }
+
+  for (r = 1; r <= reach; r++)
+    {
+      k = (r - 1) / factor;
+
+      /* the pixels left in the band */
+      n_cand = 0;
+      for (v = 0; v < n_rows; v++)
+        {
+          start[v] = n_cand;
+          c = guides[(gsize) MIN ((v0 + v) / factor, p_n_v - 1) * p_reach + k] * factor;
+          for (half = factor; n_cand == start[v]; half += factor)
+            {
+              lo = MAX (c - half, 0);
+              hi = MIN (c + factor + half, n_u);
+              for (u = lo; u < hi; u++)
+                {
+                  if (ranks[PROXY_INDEX (u, v, buf_width, orientation)] != 0)
+                    {
+                      continue;
+                    }
+                  if ((n_cand == max_cand) &&
+                      !grow_candidates (&cand, &from, &cost, &max_cand))
+                    {
+                      goto out;
+                    }
+                  cand[n_cand++] = u;
+                }
+            }
+        }
+      start[n_rows] = n_cand;
+
+      /* cheapest path through the band */
+      for (v = 0; v < n_rows; v++)
+        {
+          for (i = start[v]; i < start[v + 1]; i++)
+            {
+              best = 0;
+              best_j = -1;
+              if (v > 0)
+                {
+                  best = G_MAXINT64;
+                  for (j = start[v - 1]; j < start[v]; j++)
+                    {
+                      step = ABS (cand[i] - cand[j]) - delta_x;
+                      cj = cost[j] + (step > 0 ? (gint64) step * PROXY_STEP_PENALTY : 0);
+                      if (cj < best)
+                        {
+                          best = cj;
+                          best_j = j;
+                        }
+                    }
+                }
+              else if ((last != NULL) && (last[r - 1] >= 0))
+                {
+                  step = ABS (cand[i] - last[r - 1]) - delta_x;
+                  best = (step > 0 ? (gint64) step * PROXY_STEP_PENALTY : 0);
+                }
+              cost[i] = best + energy (rgb_buffer, buf_width, bpp, orientation, n_u, cand[i], v);
+              from[i] = best_j;
+            }
+        }
+
+      i = start[n_rows - 1];
+      for (j = start[n_rows - 1] + 1; j < start[n_rows]; j++)
+        {
+          if (cost[j] < cost[i])
+            {
+              i = j;
+            }
+        }
+      for (v = n_rows - 1; v >= 0; v--)
+        {
+          ranks[PROXY_INDEX (cand[i], v, buf_width, orientation)] = r;
+          if ((last != NULL) && (v == last_row))
+            {
+              last[r - 1] = cand[i];
+            }
+          i = from[i];
+        }
+
+      gimp_progress_update ((gdouble) r / reach);
+    }
+
+  ok = TRUE;
+
+out:
+  g_free (start);
+  g_free (cand);
+  g_free (from);
+  g_free (cost);
+
+  return ok;
+}
@@ -0,0 +1,57 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+#ifndef __PROXY_H__
+#define __PROXY_H__
+
+#ifndef __LQR_H__
+#error "lqr/lqr.h must be included prior to proxy.h"
+#endif /* __LQR_H__ */
+
+/* Proxy carving: the seams of a shrink along one direction are
+ * searched for on a copy of the layer scaled down by
+ * vals->proxy_factor, then brought back to full size and refined
+ * there; the result is a visibility map for the full size layer */
+
+/* position in a buffer of the pixel u across the seams and v along
+ * them */
+#define PROXY_INDEX(u, v, width, orientation) \
+  ((orientation) == 0 ? (gsize) (v) * (width) + (u) : (gsize) (u) * (width) + (v))
+
+LqrVMap *proxy_vmap_new (PlugInVals * vals, guchar * rgb_buffer,
+                         gint width, gint height, gint bpp,
+                         gint x_off, gint y_off, gfloat rigidity,
+                         gboolean ignore_disc_mask, gint orientation, gint reach,
+                         LqrProgress * progress);
+
+/* The steps of proxy_vmap_new, for callers which do not hold the
+ * whole layer (see strips.c) */
+
+void proxy_reduce_rows (const guchar * rows, gint n_rows, gint width, gint bpp, gint factor,
+                        guint32 * sums, guchar * dest);
+gint *proxy_guides_new (PlugInVals * vals, guchar * p_buffer,
+                        gint width, gint height, gint bpp,
+                        gint x_off, gint y_off, gfloat rigidity,
+                        gboolean ignore_disc_mask, gint orientation, gint p_reach,
+                        LqrProgress * progress);
+gboolean proxy_refine_band (const guchar * rgb_buffer, gint buf_width, gint bpp, gint orientation,
+                            gint n_u, gint v0, gint n_rows, gint reach, gint factor, gint delta_x,
+                            const gint * guides, gint p_reach, gint p_n_v,
+                            gint * ranks, gint * last, gint last_row);
+
+#endif /* __PROXY_H__ */
@@ -30,13 +30,100 @@
 #include "plugin-intl.h"
 
 #include "main.h"
+#include "energy.h"
+#include "engine.h"
+#include "proxy.h"
 #include "render.h"
+#include "strips.h"
 
 
 #if 0
 #  define __CLOCK_IT__
 #endif
 
+/* the selected layer plus the three aux layers */
+#define MAX_OUTPUT_LAYERS (4)
+
+/* liblqr's read cache holds a double for each pixel of the layer */
+#define CARVER_CACHE_PIXEL_BYTES (sizeof (gdouble))
+
+/* How a non-interactive run is carried out within the memory limit,
+ * from the most to the least demanding */
+typedef enum
+{
+  CARVE_PLAN_FULL,              /* as without a limit */
+  CARVE_PLAN_NO_CACHE,          /* without liblqr's read cache */
+  CARVE_PLAN_NO_SEAMS,          /* also without keeping the seams for output */
+  CARVE_PLAN_STRIPS,            /* in strips, see strips.h */
+  CARVE_PLAN_REFUSE
+} CarvePlan;
+
+/* A layer carved on its own with vals->independent_layers, on one of
+ * the workers of render_noninteractive; the workers only call liblqr,
+ * libgimp is left to the main thread */
+typedef struct
+{
+  LqrCarver *carver;
+  gint new_width, new_height;
+  gint back_width, back_height; /* 0 unless scaling back with liblqr */
+  LqrRetVal ret;
+} FollowerJob;
+
+/* The state of render_init_carver along its steps; whatever is still
+ * held here when it returns is undone by carver_init_cleanup */
+typedef struct
+{
+  PlugInVals *vals;
+  gboolean interactive;
+  gint32 image_ID;
+  gint32 layer_ID;
+  gint old_width, old_height;   /* of the carver, once prescaled */
+  gint new_width, new_height;
+  gint x_off, y_off;
+  gint bpp;
+  gfloat rigidity;
+  CarvePlan plan;
+  gboolean keep_seams;
+  gboolean ignore_disc_mask;
+  gint proxy_factor;
+  gint degradations;
+  gdouble ratio;
+  gint pre_width, pre_height;
+  gboolean prescaled;
+  gdouble pre_ratio_x, pre_ratio_y;
+  gboolean copies;              /* the prescaled copies are in the image */
+  gint32 read_layer_ID;
+  gint32 *aux_IDs[3];           /* the vals entries, set to the copies meanwhile */
+  gint32 src_aux_IDs[3];
+  gint32 *followers;
+  gint n_followers;
+  guint64 follower_bytes;
+  gboolean independent;
+  LqrCarver **follower_carvers;
+  AuxLayerCache aux_cache;
+  AuxLayerCache *masks;         /* &aux_cache if the masks are read through it */
+  LqrProgress *progress;        /* until the carver takes it */
+  guchar *rgb_buffer;
+  LqrVMap *vmap;
+  gboolean vmap_cached;
+  gchar *vmap_key;
+  gint32 vmap_image_ID;
+  gint vmap_reach;
+  gint vmap_orientation;
+  LqrCarver *carver;
+  gboolean seams_loaded;
+} CarverInit;
+
+/* Deadline mode: the run time is estimated from the pixels scanned
+ * for each seam (carve_ns each, calibrated on the previous runs and
+ * stored under DEADLINE_DATA), plus the pixels read and written */
+#define DEADLINE_DATA "plug-in-lqr-carve-ns"
+#define DEADLINE_CARVE_NS (10.0)
+#define DEADLINE_IO_NS (100.0)
+#define DEADLINE_REFINE_NS (2.0)
+#define DEADLINE_MAX_PROXY_FACTOR (16)
+#define DEADLINE_PRESCALE_STEPS (20)
+
 /* Convenience macros for checking and general cleanup */
 
 #define MEM_CHECK_N(x) if ((x) == NULL) { g_message(_("Not enough memory")); return NULL; }
@@ -46,7 +133,7 @@
 #define MEM_CHECK2(x) if ((x) == FALSE) { g_message(_("Not enough memory")); return FALSE; }
 
 #define BPP_CHECK(layer_ID, carver) G_STMT_START { \
-  if (gimp_drawable_bpp(layer_ID) != lqr_carver_get_channels(carver)) \
+  if (drawable_channels (layer_ID) != lqr_carver_get_channels(carver)) \
     { \
       g_message(_("Error: number of colour channels changed")); \
       return FALSE; \
@@ -75,6 +162,25 @@
     } \
   } G_STMT_END
 
+/* only layers are resized along with the selected layer;
+ * channels are just read as masks */
+#define IS_AUX_LAYER(layer_ID) ((layer_ID) && gimp_drawable_is_layer (layer_ID))
+
+/* file-backed buffers are released by us, not by liblqr */
+#define PRESERVE_MAPPED(carver, buffer) G_STMT_START { \
+  if (pixel_buffer_is_mapped (buffer)) \
+    { \
+      lqr_carver_set_preserve_input_image (carver); \
+    } \
+  } G_STMT_END
+
+/* a size is a (width, height) pair; the first extent is the one
+ * along the direction which is carved first */
+#define SIZE_FIRST(sizes, i, res_order) \
+  ((res_order) == LQR_RES_ORDER_HOR ? (sizes)[2 * (i)] : (sizes)[2 * (i) + 1])
+#define SIZE_SECOND(sizes, i, res_order) \
+  ((res_order) == LQR_RES_ORDER_HOR ? (sizes)[2 * (i) + 1] : (sizes)[2 * (i)])
+
 #define SELECTION_SAVE(image_ID) G_STMT_START { \
   if (!gimp_selection_is_empty (image_ID)) \
     { \
@@ -88,16 +194,119 @@
 /* static functions declarations */
 
 static gboolean my_progress_end (const gchar * message);
+static gboolean carver_init_plan (CarverInit * ci);
+static gboolean carver_init_read (CarverInit * ci);
+static gboolean carver_init_build (CarverInit * ci);
+static void carver_init_unprescale (CarverInit * ci);
+static CarverData * carver_init_targets (CarverInit * ci, const gchar * layer_name,
+                                         gboolean alpha_lock);
+static void carver_init_cleanup (CarverInit * ci);
 static LqrProgress * progress_init (void);
 static gfloat rigidity_init (PlugInVals * vals);
 static gboolean compute_ignore_disc_mask (PlugInVals * vals, gint old_width, gint old_height, gint new_width, gint new_height);
 static void set_tiles (gint width);
 static gboolean check_aux_layer_bpp (LqrCarverList ** carver_list_p, gint32 layer_ID);
-static gboolean copy_aux_layer_to_new_image (gint32 image_ID, gint32 * layer_ID, gint x_off, gint y_off);
-static gboolean resize_unlock_aux_layer (gint32 layer_ID, gint width, gint height, gint x_off, gint y_off);
-static LqrCarver* attach_aux_carver (LqrCarver * carver, gint32 layer_ID, gint width, gint height);
-static gboolean write_aux_carver (LqrCarverList ** carver_list_p, gint32 layer_ID, gint width, gint height);
+static gint32 new_target_layer (gint32 image_ID, gint32 src_layer_ID, const gchar * name,
+                                gint width, gint height, gint x_off, gint y_off);
+static gboolean new_aux_target_layer (gint32 image_ID, gint32 * layer_ID_p, gint width, gint height);
+static gboolean unlock_aux_layer (gint32 layer_ID);
+static void fit_aux_layer (gint32 layer_ID, gint32 ref_layer_ID, gint width, gint height);
+static LqrCarver* attach_aux_carver (LqrCarver * carver, gint32 layer_ID, gint width, gint height, AuxLayerCache * cache);
+static void followers_add (GArray * followers, gint32 * layers, gint n_layers,
+                           gint32 layer_ID, PlugInVals * vals);
+static gint32 * followers_new (gint32 image_ID, gint32 layer_ID, PlugInVals * vals,
+                               gint * n_followers);
+static LqrCarver * follower_carver_new (gint32 image_ID, gint32 layer_ID,
+                                        gdouble ratio_x, gdouble ratio_y,
+                                        gint width, gint height, gint x_off, gint y_off,
+                                        gint mask_behavior);
+static FollowerJob * followers_carve_start (PlugInVals * vals, CarverData * carver_data,
+                                            gint width, gint height, gint new_width, gint new_height,
+                                            GThreadPool ** pool_p);
+static void follower_carve (gpointer data, gpointer user_data);
+static gboolean followers_carve_finish (FollowerJob * jobs, gint n_jobs, GThreadPool * pool);
+static gboolean write_aux_carver (LqrCarverList ** carver_list_p, gint32 layer_ID, gint32 ref_layer_ID,
+                                  gint width, gint height, LayerCommit * commit);
+static gint add_aux_output (LqrCarverList ** carver_list_p, gint32 layer_ID, gint32 ref_layer_ID,
+                            gint width, gint height,
+                            LqrCarver ** carvers, gint32 * layer_IDs, gint n_outputs);
 static void scale_layer_translated (gint32 layer_ID, gint width, gint height, gint x_off, gint y_off);
+static gboolean scale_back_std (PlugInVals * vals, gint32 image_ID, gint32 layer_ID,
+                                gint old_width, gint old_height, gint new_width, gint new_height,
+                                gint x_off, gint y_off, gint32 * followers, gint n_followers);
+static guint64 carver_memory_estimate (PlugInVals * vals, gint width, gint height, gint bpp,
+                                       guint64 follower_bytes);
+static CarvePlan carve_plan_choose (PlugInVals * vals, gint old_width, gint old_height,
+                                    gint new_width, gint new_height, gint bpp,
+                                    guint64 follower_bytes);
+static gboolean strips_allowed (PlugInVals * vals, gint old_width, gint old_height,
+                                gint new_width, gint new_height, guint64 follower_bytes);
+static CarverData * strips_init (PlugInVals * vals, gint32 image_ID, gint32 layer_ID,
+                                 const gchar * layer_name, gboolean alpha_lock);
+static gboolean render_strips (PlugInVals * vals, CarverData * carver_data);
+static gboolean prescale_full_ratio (gint old_width, gint old_height,
+                                     gint new_width, gint new_height, gdouble * full);
+static gdouble prescale_ratio (PlugInVals * vals, gint old_width, gint old_height,
+                               gint new_width, gint new_height);
+static gdouble deadline_estimate (gint old_width, gint old_height, gint new_width, gint new_height,
+                                  gdouble ratio, gint proxy_factor, gdouble carve_ns);
+static gint deadline_adapt (PlugInVals * vals, gint old_width, gint old_height,
+                            gint new_width, gint new_height, gboolean proxy_allowed,
+                            gint * proxy_factor, gdouble * ratio);
+static void deadline_calibrate (gint width, gint height, gint new_width, gint new_height,
+                                gdouble seconds);
+static gint32 prescaled_copy (gint32 image_ID, gint32 drawable_ID,
+                              gdouble ratio_x, gdouble ratio_y, gint x_off, gint y_off);
+static void prescaled_remove (gint32 image_ID, gint32 drawable_ID);
+static void selection_to_aux_channel (gint32 image_ID, PlugInVals * vals);
+static gpointer lqr_backend_new (guchar * rgb_buffer, gint width, gint height, gint bpp,
+                                 gint n_threads);
+static LqrRetVal lqr_backend_init (gpointer carver, gint delta_x, gfloat rigidity, gint nrg_func);
+static LqrRetVal lqr_backend_bias_add (gpointer carver, gdouble * buffer);
+static LqrRetVal lqr_backend_rigmask_add (gpointer carver, guchar * rgb, gint channels,
+                                          gint width, gint height, gint x_off, gint y_off);
+static void lqr_backend_energy_cache (gpointer carver, const gchar * key, guint64 max_bytes);
+static LqrRetVal lqr_backend_resize (gpointer carver, gint width, gint height);
+static LqrVMap * lqr_backend_vmap (gpointer carver);
+static void lqr_backend_destroy (gpointer carver);
+static const CarveBackend * carve_backend_get (PlugInVals * vals);
+static LqrVMap * backend_vmap_new (const CarveBackend * backend, PlugInVals * vals,
+                                   guchar * rgb_buffer, gint width, gint height, gint bpp,
+                                   gint x_off, gint y_off, gfloat rigidity,
+                                   gboolean ignore_disc_mask, gint new_width, gint new_height,
+                                   const gchar * digest, AuxLayerCache * cache);
+static gint vmap_shrink_reach (PlugInVals * vals, gint old_width, gint old_height,
+                               gint new_width, gint new_height, gint * orientation);
+static gint vmap_cache_reach (PlugInVals * vals, gint old_width, gint old_height,
+                              gint new_width, gint new_height, gint * orientation);
+static gchar * content_digest (guchar * rgb_buffer, gint width, gint height, gint bpp);
+static gchar * vmap_cache_key (PlugInVals * vals, const gchar * digest, gint width, gint height,
+                               gint bpp, gfloat rigidity, gboolean ignore_disc_mask,
+                               gint proxy_factor, const CarveBackend * backend,
+                               gint x_off, gint y_off, AuxLayerCache * cache);
+static void sort_sizes (gint * sizes, gint n_sizes, gint res_order, gint * order);
+static LqrCarver * carver_setup (PlugInVals * vals, LqrCarver * carver, gfloat rigidity,
+                                 gint x_off, gint y_off, gboolean ignore_disc_mask,
+                                 AuxLayerCache * cache, LqrProgress * progress);
+static LqrCarver * multi_carver_new (PlugInVals * vals, gint32 layer_ID, guchar * rgb_buffer,
+                                     gint width, gint height, gint bpp, gint x_off, gint y_off,
+                                     gboolean ignore_disc_mask, LqrProgress * progress);
+static gint32 multi_output_layer (gint32 image_ID, gint32 layer_ID, PlugInVals * vals,
+                                  gint width, gint height, gint x_off, gint y_off);
+
+/* liblqr as a carving backend: the carvers of liblqr runs are set
+ * up directly, this is the way the masks go in */
+static const CarveBackend lqr_backend = {
+  "liblqr",
+  lqr_backend_new,
+  lqr_backend_init,
+  lqr_backend_bias_add,
+  lqr_backend_rigmask_add,
+  lqr_backend_energy_cache,
+  lqr_backend_resize,
+  lqr_backend_vmap,
+  lqr_backend_destroy
+};
 
 /* render functions */
 
@@ -107,819 +316,2767 @@ render_init_carver (PlugInImageVals * image_vals,
         PlugInVals * vals,
         gboolean interactive)
 {
-  CarverData *carver_data;
-  LqrCarver *carver;
-  gint32 image_ID;
-  gint32 layer_ID;
+  CarverInit ci = { 0 };
+  CarverData *carver_data = NULL;
   gchar layer_name[LQR_MAX_NAME_LENGTH];
-  gchar new_layer_name[LQR_MAX_NAME_LENGTH];
-  guchar *rgb_buffer;
   gboolean alpha_lock;
-  gboolean alpha_lock_pres = FALSE, alpha_lock_disc = FALSE, alpha_lock_rigmask = FALSE;
-  gfloat rigidity;
-  gint old_width, old_height;
-  gint new_width, new_height;
-  gint bpp;
-  gint x_off, y_off;
-  gboolean ignore_disc_mask = FALSE;
-  LqrProgress *progress;
 #ifdef __CLOCK_IT__
   double clock1, clock2;
 #endif /* __CLOCK_IT__ */
 
-  image_ID = image_vals->image_ID;
-  layer_ID = drawable_vals->layer_ID;
+  ci.vals = vals;
+  ci.interactive = interactive;
+  ci.image_ID = image_vals->image_ID;
+  ci.layer_ID = drawable_vals->layer_ID;
 
-  IMAGE_CHECK (image_ID, NULL);
+  IMAGE_CHECK (ci.image_ID, NULL);
 
-  if (!layer_ID)
+  if (!ci.layer_ID)
     {
-      layer_ID = gimp_image_get_active_layer (image_ID);
+      ci.layer_ID = gimp_image_get_active_layer (ci.image_ID);
     }
 
-  LAYER_CHECK (layer_ID, NULL);
+  LAYER_CHECK (ci.layer_ID, NULL);
   LAYER_CHECK0 (vals->pres_layer_ID, NULL);
   LAYER_CHECK0 (vals->disc_layer_ID, NULL);
   LAYER_CHECK0 (vals->rigmask_layer_ID, NULL);
 
-  UNFLOAT (layer_ID);
-  SELECTION_SAVE (image_ID);
-  UNMASK (layer_ID);
+  UNFLOAT (ci.layer_ID);
+  selection_to_aux_channel (ci.image_ID, vals);
+  SELECTION_SAVE (ci.image_ID);
+  UNMASK (ci.layer_ID);
 
   g_snprintf (layer_name, LQR_MAX_NAME_LENGTH, "%s",
-            gimp_drawable_get_name (layer_ID));
-
-  old_width = gimp_drawable_width (layer_ID);
-  old_height = gimp_drawable_height (layer_ID);
-  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
-  bpp = gimp_drawable_bpp (layer_ID);
-
-  new_width = vals->new_width;
-  new_height = vals->new_height;
-  rigidity = rigidity_init(vals);
+            gimp_drawable_get_name (ci.layer_ID));
 
-  if (!interactive)
+  if (!carver_init_plan (&ci))
     {
-      ignore_disc_mask = compute_ignore_disc_mask (vals, old_width, old_height, new_width, new_height);
-      if ((vals->output_seams) && (gimp_image_base_type(image_ID) != GIMP_RGB))
-        {
-          gimp_image_convert_rgb (image_ID);
-        }
+      goto out;
     }
 
-  if (vals->output_target == OUTPUT_TARGET_NEW_LAYER)
-    {
-      g_snprintf (new_layer_name, LQR_MAX_NAME_LENGTH, "%s LqR", layer_name);
-      layer_ID = gimp_layer_copy (layer_ID);
-      gimp_image_insert_layer (image_ID, layer_ID, 0, -1);
-      gimp_drawable_set_name (layer_ID, new_layer_name);
-      gimp_drawable_set_visible (layer_ID, FALSE);
-    }
-  else if (vals->output_target == OUTPUT_TARGET_NEW_IMAGE)
+  /* the carver is always read from the source drawables, new
+   * targets are only created afterwards */
+  alpha_lock = gimp_layer_get_lock_alpha (ci.layer_ID);
+
+  set_tiles (ci.old_width);
+
+  /* strips are carved from the layer itself, without prescaling */
+  if (ci.plan == CARVE_PLAN_STRIPS)
     {
-      image_ID = gimp_image_new (old_width, old_height, gimp_image_base_type(image_ID));
-      gimp_image_undo_group_start(image_ID);
-      layer_ID = gimp_layer_new_from_drawable (layer_ID, image_ID);
-      gimp_image_insert_layer (image_ID, layer_ID, 0, -1);
-      gimp_layer_translate(layer_ID, -x_off, -y_off);
-      gimp_drawable_set_visible (layer_ID, TRUE);
-      if (vals->resize_aux_layers)
+      carver_data = strips_init (vals, ci.image_ID, ci.layer_ID, layer_name, alpha_lock);
+      if (carver_data)
         {
-          copy_aux_layer_to_new_image (image_ID, &vals->pres_layer_ID, x_off, y_off);
-          copy_aux_layer_to_new_image (image_ID, &vals->disc_layer_ID, x_off, y_off);
-          copy_aux_layer_to_new_image (image_ID, &vals->rigmask_layer_ID, x_off, y_off);
-          x_off = 0;
-          y_off = 0;
+          carver_data->proxy_factor = ci.proxy_factor;
+          carver_data->prescale_ratio = 1;
         }
-      gimp_display_new(image_ID);
-      gimp_image_undo_group_end(image_ID);
+      goto out;
     }
 
-  /* unset lock alpha */
-  alpha_lock = gimp_layer_get_lock_alpha (layer_ID);
-  gimp_layer_set_lock_alpha (layer_ID, FALSE);
-
-  if (vals->resize_aux_layers == TRUE)
+  ci.progress = progress_init();
+  if (ci.progress == NULL)
     {
-      alpha_lock_pres = resize_unlock_aux_layer (vals->pres_layer_ID, old_width, old_height, x_off, y_off);
-      alpha_lock_disc = resize_unlock_aux_layer (vals->disc_layer_ID, old_width, old_height, x_off, y_off);
-      alpha_lock_rigmask = resize_unlock_aux_layer (vals->rigmask_layer_ID, old_width, old_height, x_off, y_off);
+      goto out;
     }
 
-  set_tiles (old_width);
-
-  progress = progress_init();
-  MEM_CHECK_N (progress);
-
 #ifdef __CLOCK_IT__
   clock1 = (double) clock () / CLOCKS_PER_SEC;
   printf ("[ begin ]\n");
 #endif /* __CLOCK_IT__ */
 
-  /* lqr carver initialization */
-  rgb_buffer = rgb_buffer_from_layer (layer_ID);
-  MEM_CHECK_N (rgb_buffer);
-  carver = lqr_carver_new (rgb_buffer, old_width, old_height, bpp);
-  MEM_CHECK_N (carver);
-  MEM_CHECK1_N (lqr_carver_init (carver, vals->delta_x, rigidity));
-  MEM_CHECK1_N (update_bias
-               (carver, vals->pres_layer_ID, vals->pres_coeff, x_off, y_off));
-  if (!ignore_disc_mask)
-    {
-      MEM_CHECK1_N (update_bias
-                 (carver, vals->disc_layer_ID, -vals->disc_coeff, x_off, y_off));
-    }
-  MEM_CHECK1_N (set_rigmask
-               (carver, vals->rigmask_layer_ID, x_off, y_off));
-  lqr_carver_set_energy_function_builtin (carver, vals->nrg_func);
-  lqr_carver_set_resize_order (carver, vals->res_order);
-  lqr_carver_set_progress (carver, progress);
-  lqr_carver_set_side_switch_frequency (carver, 2);
-  lqr_carver_set_enl_step (carver, vals->enl_step / 100);
-  if ((!interactive) && (vals->output_seams))
-    {
-      lqr_carver_set_dump_vmaps (carver);
-    }
-  if (vals->resize_aux_layers)
+  if ((!carver_init_read (&ci)) || (!carver_init_build (&ci)))
     {
-      attach_aux_carver (carver, vals->pres_layer_ID, old_width, old_height);
-      attach_aux_carver (carver, vals->disc_layer_ID, old_width, old_height);
-      attach_aux_carver (carver, vals->rigmask_layer_ID, old_width, old_height);
+      goto out;
     }
+  carver_init_unprescale (&ci);
+
+  carver_data = carver_init_targets (&ci, layer_name, alpha_lock);
 
 #ifdef __CLOCK_IT__
   clock2 = (double) clock () / CLOCKS_PER_SEC;
   printf ("[ read: %g ]\n", clock2 - clock1);
 #endif /* __CLOCK_IT__ */
 
-  MEM_CHECK_N(carver_data = calloc(1, sizeof(CarverData)));
-
-  carver_data->carver = carver;
-  carver_data->image_ID = image_ID;
-  carver_data->layer_ID = layer_ID;
-  carver_data->base_type = gimp_image_base_type (image_ID);
-  carver_data->alpha_lock = alpha_lock;
-  carver_data->alpha_lock_pres = alpha_lock_pres;
-  carver_data->alpha_lock_disc = alpha_lock_disc;
-  carver_data->alpha_lock_rigmask = alpha_lock_rigmask;
-
-  carver_data->ref_w = old_width;
-  carver_data->ref_h = old_height;
-  carver_data->orientation = 0;
-  carver_data->depth = 0;
-  carver_data->enl_step = vals->enl_step / 100;
-
+out:
+  carver_init_cleanup (&ci);
   return carver_data;
 }
 
-gboolean
-render_noninteractive (PlugInVals * vals,
-        PlugInColVals * col_vals,
-        CarverData * carver_data)
+/* Sizes the run: how much is done by plain scaling or on a proxy,
+ * which layers are carved along and how the memory limit is met */
+static gboolean
+carver_init_plan (CarverInit * ci)
 {
-  LqrCarver *carver;
-  LqrCarverList *carver_list;
-  gint32 image_ID;
-  gint32 layer_ID;
-  gchar layer_name[LQR_MAX_NAME_LENGTH];
-  gboolean alpha_lock;
-  gboolean alpha_lock_pres = FALSE, alpha_lock_disc = FALSE, alpha_lock_rigmask = FALSE;
-  gint old_width, old_height;
-  gint new_width, new_height;
-  gint sb_width, sb_height;
-  gint x_off, y_off;
-  GimpRGB colour_start, colour_end;
-#ifdef __CLOCK_IT__
-  double clock1, clock2, clock3;
-#endif /* __CLOCK_IT__ */
-
-  carver = carver_data->carver;
-  image_ID = carver_data->image_ID;
-  layer_ID = carver_data->layer_ID;
-  alpha_lock = carver_data->alpha_lock;
-  alpha_lock_pres = carver_data->alpha_lock_pres;
-  alpha_lock_disc = carver_data->alpha_lock_disc;
-  alpha_lock_rigmask = carver_data->alpha_lock_rigmask;
-
-  g_snprintf (layer_name, LQR_MAX_NAME_LENGTH, "%s",
-              gimp_drawable_get_name (layer_ID));
-
-  old_width = gimp_drawable_width (layer_ID);
-  old_height = gimp_drawable_height (layer_ID);
-  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
-
-  new_width = vals->new_width;
-  new_height = vals->new_height;
-
-#ifdef __CLOCK_IT__
-  clock1 = (double) clock () / CLOCKS_PER_SEC;
-#endif /* __CLOCK_IT__ */
+  PlugInVals *vals = ci->vals;
+  gint i;
+
+  ci->old_width = gimp_drawable_width (ci->layer_ID);
+  ci->old_height = gimp_drawable_height (ci->layer_ID);
+  gimp_drawable_offsets (ci->layer_ID, &ci->x_off, &ci->y_off);
+  ci->bpp = drawable_channels (ci->layer_ID);
+
+  ci->new_width = vals->new_width;
+  ci->new_height = vals->new_height;
+  ci->rigidity = rigidity_init(vals);
+
+  /* the layer is carved after plain scaling to pre_width x pre_height;
+   * both that and the proxy factor may be pushed further to meet a
+   * deadline */
+  ci->ratio = 1;
+  ci->pre_width = ci->old_width;
+  ci->pre_height = ci->old_height;
+  ci->proxy_factor = vals->proxy_factor;
+  if (!ci->interactive)
+    {
+      ci->ratio = prescale_ratio (vals, ci->old_width, ci->old_height,
+                                  ci->new_width, ci->new_height);
+      if (vals->max_seconds > 0)
+        {
+          ci->degradations = deadline_adapt (vals, ci->old_width, ci->old_height,
+                                             ci->new_width, ci->new_height,
+                                             vmap_cache_reach (vals, ci->old_width, ci->old_height,
+                                                               ci->new_width, ci->new_height,
+                                                               &ci->vmap_orientation) > 0,
+                                             &ci->proxy_factor, &ci->ratio);
+        }
+      ci->pre_width = CLAMP ((gint) (ci->old_width * ci->ratio + 0.5),
+                             MIN (ci->old_width, ci->new_width),
+                             MAX (ci->old_width, ci->new_width));
+      ci->pre_height = CLAMP ((gint) (ci->old_height * ci->ratio + 0.5),
+                              MIN (ci->old_height, ci->new_height),
+                              MAX (ci->old_height, ci->new_height));
+    }
 
-  MEM_CHECK1 (lqr_carver_resize (carver, new_width, new_height));
+  /* the other layers carved along are read like the aux layers,
+   * through the area of the selected one; independent ones also
+   * keep a read cache of their own */
+  if ((!ci->interactive) && (vals->all_layers != ALL_LAYERS_NONE))
+    {
+      ci->followers = followers_new (ci->image_ID, ci->layer_ID, vals, &ci->n_followers);
+      for (i = 0; i < ci->n_followers; i++)
+        {
+          ci->follower_bytes += drawable_channels (ci->followers[i]) + CARVER_PIXEL_BYTES +
+            (vals->independent_layers ? CARVER_CACHE_PIXEL_BYTES : 0);
+        }
+    }
+  ci->independent = (ci->n_followers > 0) && (vals->independent_layers);
 
-  if (vals->scaleback)
+  if ((!ci->interactive) && (vals->memory_limit > 0))
     {
-      switch (vals->scaleback_mode)
+      ci->plan = carve_plan_choose (vals, ci->pre_width, ci->pre_height,
+                                    ci->new_width, ci->new_height, ci->bpp,
+                                    ci->follower_bytes);
+      if (ci->plan == CARVE_PLAN_REFUSE)
         {
-        case SCALEBACK_MODE_LQRBACK:
-          MEM_CHECK1 (lqr_carver_flatten (carver));
-          new_width = old_width;
-          new_height = old_height;
-          MEM_CHECK1 (lqr_carver_resize (carver, new_width, new_height));
-          break;
-        case SCALEBACK_MODE_STD:
-        case SCALEBACK_MODE_STDW:
-        case SCALEBACK_MODE_STDH:
-          break;
-        default:
-          g_message ("error: unknown mode");
           return FALSE;
         }
     }
+  ci->keep_seams = (!ci->interactive) && (ci->plan < CARVE_PLAN_NO_SEAMS) &&
+    ((vals->output_seams) || (vals->seams_file[0] != '\0'));
 
-  if (vals->output_seams) {
-    gimp_rgba_set (&colour_start, col_vals->r1, col_vals->g1, col_vals->b1, 1);
-    gimp_rgba_set (&colour_end, col_vals->r2, col_vals->g2, col_vals->b2, 1);
+  if (!ci->interactive)
+    {
+      ci->ignore_disc_mask = compute_ignore_disc_mask (vals, ci->old_width, ci->old_height,
+                                                       ci->new_width, ci->new_height);
+      if ((vals->output_seams) && (ci->keep_seams) &&
+          (gimp_image_base_type(ci->image_ID) != GIMP_RGB))
+        {
+          gimp_image_convert_rgb (ci->image_ID);
+        }
+    }
 
-    MEM_CHECK1 (write_all_vmaps (lqr_vmap_list_start (carver), image_ID, layer_name, x_off,
-                     y_off, colour_start, colour_end));
-  }
+  return TRUE;
+}
 
-  if (vals->resize_canvas)
+/* Reads the layer, and looks for its seams in the seam map cache, on
+ * a proxy or with another backend than liblqr */
+static gboolean
+carver_init_read (CarverInit * ci)
+{
+  PlugInVals *vals = ci->vals;
+  PlugInVals proxy_vals;
+  const CarveBackend *backend;
+  gchar *digest = NULL;
+  gint backend_reach;
+  gint backend_orientation = 0;
+  gint i, j;
+#ifdef __CLOCK_IT__
+  gint64 read_start;
+#endif /* __CLOCK_IT__ */
+
+  /* when prescaling, the layer and the aux layers are read from
+   * scaled copies, which are dropped once the carver is set up */
+  ci->read_layer_ID = ci->layer_ID;
+  ci->aux_IDs[0] = &vals->pres_layer_ID;
+  ci->aux_IDs[1] = &vals->disc_layer_ID;
+  ci->aux_IDs[2] = &vals->rigmask_layer_ID;
+  ci->prescaled = (ci->pre_width != ci->old_width) || (ci->pre_height != ci->old_height);
+  if (ci->prescaled)
     {
-      gimp_image_resize (image_ID, new_width, new_height, -x_off, -y_off);
-      gimp_layer_resize_to_image_size (layer_ID);
+      ci->pre_ratio_x = (gdouble) ci->pre_width / ci->old_width;
+      ci->pre_ratio_y = (gdouble) ci->pre_height / ci->old_height;
+      ci->read_layer_ID = prescaled_copy (ci->image_ID, ci->layer_ID,
+                                          ci->pre_ratio_x, ci->pre_ratio_y,
+                                          ci->x_off, ci->y_off);
+      for (i = 0; i < 3; i++)
+        {
+          ci->src_aux_IDs[i] = *ci->aux_IDs[i];
+          for (j = 0; (j < i) && (ci->src_aux_IDs[j] != ci->src_aux_IDs[i]); j++);
+          *ci->aux_IDs[i] = (j < i) ? *ci->aux_IDs[j] :
+            prescaled_copy (ci->image_ID, ci->src_aux_IDs[i], ci->pre_ratio_x, ci->pre_ratio_y,
+                            ci->x_off, ci->y_off);
+        }
+      ci->copies = TRUE;
+      ci->old_width = ci->pre_width;
+      ci->old_height = ci->pre_height;
     }
   else
     {
-      gimp_layer_resize (layer_ID, new_width, new_height, 0, 0);
+      ci->pre_ratio_x = 1;
+      ci->pre_ratio_y = 1;
     }
 
-#ifdef __CLOCK_IT__
-  clock2 = (double) clock () / CLOCKS_PER_SEC;
-  printf ("[ resized: %g ]\n", clock2 - clock1);
-  fflush (stdout);
-#endif /* __CLOCK_IT__ */
-
-  set_tiles (new_width);
-
-  MEM_CHECK1 (write_carver_to_layer (carver, layer_ID));
-
-  if (vals->resize_aux_layers)
+  backend = ci->interactive ? &lqr_backend : carve_backend_get (vals);
+  ci->vmap_image_ID = ci->image_ID;
+  if (!ci->interactive)
     {
-      carver_list = lqr_carver_list_start (carver);
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->pres_layer_ID, new_width, new_height));
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->disc_layer_ID, new_width, new_height));
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->rigmask_layer_ID, new_width, new_height));
+      ci->vmap_reach = vmap_cache_reach (vals, ci->old_width, ci->old_height,
+                                         ci->new_width, ci->new_height, &ci->vmap_orientation);
     }
 
-  lqr_carver_destroy (carver);
-
-  if (vals->scaleback)
+  /* aux layers which are attached to the carver are read in full
+   * once, through the area of the layer, the others only as masks;
+   * masks hashed into the seam map key are kept for the bias too */
+  ci->aux_cache.width = ci->old_width;
+  ci->aux_cache.height = ci->old_height;
+  ci->aux_cache.x_off = ci->x_off;
+  ci->aux_cache.y_off = ci->y_off;
+  ci->aux_cache.full = vals->resize_aux_layers;
+  if ((vals->resize_aux_layers) || (ci->vmap_reach > 0))
     {
-      switch (vals->scaleback_mode)
-        {
-        case SCALEBACK_MODE_LQRBACK:
-          break;
-        case SCALEBACK_MODE_STD:
-        case SCALEBACK_MODE_STDW:
-        case SCALEBACK_MODE_STDH:
-          switch (vals->scaleback_mode)
-            {
-              case SCALEBACK_MODE_STD:
-                sb_width = old_width;
-                sb_height = old_height;
-                break;
-              case SCALEBACK_MODE_STDW:
-                sb_width = old_width;
-                sb_height = (int) ((double) new_height * old_width / new_width);
-                break;
-              case SCALEBACK_MODE_STDH:
-                sb_width = (int) ((double) new_width * old_height / new_height);
-                sb_height = old_height;
-                break;
-              default:
-                return FALSE;
-            }
-
-          if (vals->resize_canvas == TRUE)
-            {
-              gimp_image_resize (image_ID, sb_width, sb_height, 0, 0);
-              gimp_layer_scale (layer_ID, sb_width, sb_height, FALSE);
-            }
-          else
-            {
-              scale_layer_translated (layer_ID, sb_width, sb_height, x_off, y_off);
-            }
-          if (vals->resize_aux_layers == TRUE)
-            {
-              if (vals->pres_layer_ID != 0)
-                {
-                  scale_layer_translated (vals->pres_layer_ID, sb_width, sb_height, x_off, y_off);
-                }
-              if (vals->disc_layer_ID != 0)
-                {
-                  scale_layer_translated (vals->disc_layer_ID, sb_width, sb_height, x_off, y_off);
-                }
-              if (vals->rigmask_layer_ID != 0)
-                {
-                  scale_layer_translated (vals->rigmask_layer_ID, sb_width, sb_height, x_off, y_off);
-                }
-            }
-          break;
-        default:
-          g_message ("error: unknown mode");
-          return FALSE;
-        }
+      ci->masks = &ci->aux_cache;
     }
 
-
 #ifdef __CLOCK_IT__
-  clock3 = (double) clock () / CLOCKS_PER_SEC;
-  printf ("[ finish: %g ]\n\n", clock3 - clock2);
+  read_start = g_get_monotonic_time ();
+#endif /* __CLOCK_IT__ */
+  ci->rgb_buffer = rgb_buffer_from_layer (ci->read_layer_ID);
+  MEM_CHECK (ci->rgb_buffer);
+#ifdef __CLOCK_IT__
+  /* wall time, most of it is spent waiting for the tiles from the
+   * core, which clock () does not see */
+  printf ("[ layer read: %g s, %dx%d, %d channels ]\n",
+          (g_get_monotonic_time () - read_start) / 1e6,
+          ci->old_width, ci->old_height, ci->bpp);
+  fflush (stdout);
 #endif /* __CLOCK_IT__ */
 
-  gimp_drawable_set_visible (layer_ID, TRUE);
-  gimp_image_set_active_layer (image_ID, layer_ID);
-
-  gimp_layer_set_lock_alpha (layer_ID, alpha_lock);
-  if (vals->resize_aux_layers == TRUE)
+  /* look for the seams of a previous run on the same inputs,
+   * or search for them on a proxy if requested, or with another
+   * backend than liblqr */
+  if (ci->vmap_reach > 0)
     {
-      if (vals->pres_layer_ID != 0)
+      digest = content_digest (ci->rgb_buffer, ci->old_width, ci->old_height, ci->bpp);
+      ci->vmap_key = vmap_cache_key (vals, digest, ci->old_width, ci->old_height, ci->bpp,
+                                     ci->rigidity, ci->ignore_disc_mask, ci->proxy_factor,
+                                     (ci->proxy_factor > 1) ? &lqr_backend : backend,
+                                     ci->x_off, ci->y_off, ci->masks);
+      ci->vmap = vmap_cache_load (ci->vmap_image_ID, ci->vmap_key, ci->vmap_orientation,
+                                  ci->vmap_reach);
+      ci->vmap_cached = (ci->vmap != NULL);
+      if ((ci->vmap == NULL) && (ci->proxy_factor > 1))
         {
-          gimp_layer_set_lock_alpha (vals->pres_layer_ID, alpha_lock_pres);
+          proxy_vals = *vals;
+          proxy_vals.proxy_factor = ci->proxy_factor;
+          ci->vmap = proxy_vmap_new (&proxy_vals, ci->rgb_buffer, ci->old_width, ci->old_height,
+                                     ci->bpp, ci->x_off, ci->y_off, ci->rigidity,
+                                     ci->ignore_disc_mask, ci->vmap_orientation, ci->vmap_reach,
+                                     ci->progress);
         }
-      if (vals->disc_layer_ID != 0)
+    }
+  if ((ci->vmap == NULL) && (backend != &lqr_backend))
+    {
+      backend_reach = vmap_shrink_reach (vals, ci->old_width, ci->old_height,
+                                         ci->new_width, ci->new_height, &backend_orientation);
+      if ((backend_reach > 0) && (vals->energy_cache > 0) && (digest == NULL))
         {
-          gimp_layer_set_lock_alpha (vals->disc_layer_ID, alpha_lock_disc);
+          digest = content_digest (ci->rgb_buffer, ci->old_width, ci->old_height, ci->bpp);
         }
-      if (vals->rigmask_layer_ID != 0)
+      if (backend_reach > 0)
         {
-          gimp_layer_set_lock_alpha (vals->rigmask_layer_ID, alpha_lock_rigmask);
+          ci->vmap = backend_vmap_new (backend, vals, ci->rgb_buffer,
+                                       ci->old_width, ci->old_height, ci->bpp,
+                                       ci->x_off, ci->y_off, ci->rigidity, ci->ignore_disc_mask,
+                                       ci->new_width, ci->new_height,
+                                       (vals->energy_cache > 0) ? digest : NULL, ci->masks);
         }
+#ifdef __CLOCK_IT__
+      printf ("[ %s backend: %s ]\n", backend->name,
+              ci->vmap ? "searched for the seams" : "not used, carving with liblqr");
+      fflush (stdout);
+#endif /* __CLOCK_IT__ */
     }
+  g_free (digest);
 
   return TRUE;
 }
 
-gboolean
-render_interactive (PlugInVals * vals,
-        CarverData * carver_data)
+/* Sets up the carver of the layer, with the seams found by
+ * carver_init_read if any, and the carvers of the aux layers and of
+ * the layers carved along */
+static gboolean
+carver_init_build (CarverInit * ci)
 {
-  LqrCarver *carver;
-  LqrCarverList *carver_list;
-  gint32 image_ID;
-  gint32 layer_ID;
-  gchar layer_name[LQR_MAX_NAME_LENGTH];
+  PlugInVals *vals = ci->vals;
+  LqrCarver *aux_carver;
+  gint i;
+
+  ci->carver = lqr_carver_new (ci->rgb_buffer, ci->old_width, ci->old_height, ci->bpp);
+  MEM_CHECK (ci->carver);
+  PRESERVE_MAPPED (ci->carver, ci->rgb_buffer);
+  if (ci->plan >= CARVE_PLAN_NO_CACHE)
+    {
+      lqr_carver_set_use_cache (ci->carver, FALSE);
+    }
+  if ((ci->vmap != NULL) && (lqr_vmap_load (ci->carver, ci->vmap) == LQR_OK))
+    {
+      ci->seams_loaded = TRUE;
+      /* no need to store it again */
+      if (ci->vmap_cached)
+        {
+          g_free (ci->vmap_key);
+          ci->vmap_key = NULL;
+        }
+    }
+  if (ci->vmap != NULL)
+    {
+      lqr_vmap_destroy (ci->vmap);
+      ci->vmap = NULL;
+    }
+  if (!ci->seams_loaded)
+    {
+      MEM_CHECK1 (lqr_carver_init (ci->carver, vals->delta_x, ci->rigidity));
+      MEM_CHECK1 (update_bias (&lqr_backend, ci->carver, ci->old_width, ci->old_height,
+                               vals->pres_layer_ID, vals->pres_coeff,
+                               ci->ignore_disc_mask ? 0 : vals->disc_layer_ID, -vals->disc_coeff,
+                               ci->x_off, ci->y_off, ci->masks));
+      MEM_CHECK1 (set_rigmask (&lqr_backend, ci->carver, vals->rigmask_layer_ID,
+                               ci->x_off, ci->y_off, ci->masks));
+    }
+  energy_set_function (ci->carver, vals->nrg_func);
+  lqr_carver_set_resize_order (ci->carver, vals->res_order);
+  lqr_carver_set_progress (ci->carver, ci->progress);
+  ci->progress = NULL;
+  lqr_carver_set_side_switch_frequency (ci->carver, 2);
+  lqr_carver_set_enl_step (ci->carver, vals->enl_step / 100);
+  if (ci->keep_seams)
+    {
+      lqr_carver_set_dump_vmaps (ci->carver);
+    }
+  /* independent layers search for their own seams, with the same
+   * masks as the selected one; the masks are read from the cache
+   * before the aux carvers take it over */
+  if (ci->independent)
+    {
+      MEM_CHECK (ci->follower_carvers = g_try_new0 (LqrCarver *, ci->n_followers));
+      for (i = 0; i < ci->n_followers; i++)
+        {
+          aux_carver = follower_carver_new (ci->image_ID, ci->followers[i],
+                                            ci->pre_ratio_x, ci->pre_ratio_y,
+                                            ci->old_width, ci->old_height, ci->x_off, ci->y_off,
+                                            vals->mask_behavior);
+          MEM_CHECK (aux_carver);
+          ci->follower_carvers[i] = aux_carver;
+          if (ci->plan >= CARVE_PLAN_NO_CACHE)
+            {
+              lqr_carver_set_use_cache (aux_carver, FALSE);
+            }
+          MEM_CHECK (carver_setup (vals, aux_carver, ci->rigidity, ci->x_off, ci->y_off,
+                                   ci->ignore_disc_mask, ci->masks, NULL));
+        }
+    }
+  /* attached carvers go with the root one, see carver_init_cleanup */
+  if ((vals->resize_aux_layers) &&
+      ((attach_aux_carver (ci->carver, vals->pres_layer_ID, ci->old_width, ci->old_height,
+                           &ci->aux_cache) == NULL) ||
+       (attach_aux_carver (ci->carver, vals->disc_layer_ID, ci->old_width, ci->old_height,
+                           &ci->aux_cache) == NULL) ||
+       (attach_aux_carver (ci->carver, vals->rigmask_layer_ID, ci->old_width, ci->old_height,
+                           &ci->aux_cache) == NULL)))
+    {
+      return FALSE;
+    }
+  for (i = 0; (i < ci->n_followers) && (!ci->independent); i++)
+    {
+      aux_carver = follower_carver_new (ci->image_ID, ci->followers[i],
+                                        ci->pre_ratio_x, ci->pre_ratio_y,
+                                        ci->old_width, ci->old_height, ci->x_off, ci->y_off,
+                                        vals->mask_behavior);
+      MEM_CHECK (aux_carver);
+      if (lqr_carver_attach (ci->carver, aux_carver) == LQR_NOMEM)
+        {
+          lqr_carver_destroy (aux_carver);
+          g_message(_("Not enough memory"));
+          return FALSE;
+        }
+    }
+  aux_layer_cache_clear (&ci->aux_cache);
+
+  return TRUE;
+}
+
+/* Drops the prescaled copies read by carver_init_read, and points the
+ * vals back to the aux layers they were made from */
+static void
+carver_init_unprescale (CarverInit * ci)
+{
+  gint i, j;
+
+  if (!ci->copies)
+    {
+      return;
+    }
+  prescaled_remove (ci->image_ID, ci->read_layer_ID);
+  for (i = 0; i < 3; i++)
+    {
+      for (j = 0; (j < i) && (ci->src_aux_IDs[j] != ci->src_aux_IDs[i]); j++);
+      if (j == i)
+        {
+          prescaled_remove (ci->image_ID, *ci->aux_IDs[i]);
+        }
+      *ci->aux_IDs[i] = ci->src_aux_IDs[i];
+    }
+  ci->copies = FALSE;
+}
+
+/* Creates the new targets and hands the carvers and layers over to the
+ * carver data; nothing is changed in the image if that can't be
+ * allocated */
+static CarverData *
+carver_init_targets (CarverInit * ci, const gchar * layer_name, gboolean alpha_lock)
+{
+  PlugInVals *vals = ci->vals;
+  CarverData *carver_data;
+  gboolean *alpha_lock_followers = NULL;
+  gboolean alpha_lock_pres = FALSE, alpha_lock_disc = FALSE, alpha_lock_rigmask = FALSE;
+  gchar new_layer_name[LQR_MAX_NAME_LENGTH];
+  gint32 image_ID = ci->image_ID;
+  gint32 layer_ID = ci->layer_ID;
+  gint out_width, out_height;
+  gint i;
+
+  MEM_CHECK_N (carver_data = calloc(1, sizeof(CarverData)));
+  if (ci->n_followers > 0)
+    {
+      alpha_lock_followers = g_try_new (gboolean, ci->n_followers);
+      if (alpha_lock_followers == NULL)
+        {
+          free (carver_data);
+          g_message(_("Not enough memory"));
+          return NULL;
+        }
+    }
+
+  /* the masks of the layers carved along were only applied to the
+   * copies read by follower_carver_new so far */
+  for (i = 0; i < ci->n_followers; i++)
+    {
+      UNMASK (ci->followers[i]);
+    }
+
+  /* new targets are allocated empty, at the size they will be
+   * written at; in interactive mode that is not known yet */
+  if (ci->interactive ||
+      ((vals->scaleback) && (vals->scaleback_mode == SCALEBACK_MODE_LQRBACK)))
+    {
+      out_width = ci->old_width;
+      out_height = ci->old_height;
+    }
+  else
+    {
+      out_width = ci->new_width;
+      out_height = ci->new_height;
+    }
+
+  if (vals->output_target == OUTPUT_TARGET_NEW_LAYER)
+    {
+      g_snprintf (new_layer_name, LQR_MAX_NAME_LENGTH, "%s LqR", layer_name);
+      layer_ID = new_target_layer (image_ID, layer_ID, new_layer_name,
+                                   out_width, out_height, ci->x_off, ci->y_off);
+      gimp_drawable_set_visible (layer_ID, FALSE);
+    }
+  else if (vals->output_target == OUTPUT_TARGET_NEW_IMAGE)
+    {
+      image_ID = gimp_image_new (ci->old_width, ci->old_height, gimp_image_base_type(image_ID));
+      gimp_image_undo_group_start(image_ID);
+      layer_ID = new_target_layer (image_ID, layer_ID, layer_name,
+                                   out_width, out_height, 0, 0);
+      gimp_drawable_set_visible (layer_ID, TRUE);
+      if (vals->resize_aux_layers)
+        {
+          new_aux_target_layer (image_ID, &vals->pres_layer_ID, out_width, out_height);
+          new_aux_target_layer (image_ID, &vals->disc_layer_ID, out_width, out_height);
+          new_aux_target_layer (image_ID, &vals->rigmask_layer_ID, out_width, out_height);
+        }
+      for (i = 0; i < ci->n_followers; i++)
+        {
+          new_aux_target_layer (image_ID, &ci->followers[i], out_width, out_height);
+        }
+      /* non-interactive callers decide about the display themselves */
+      if (ci->interactive)
+        {
+          gimp_display_new(image_ID);
+        }
+      gimp_image_undo_group_end(image_ID);
+    }
+
+  /* unset lock alpha */
+  gimp_layer_set_lock_alpha (layer_ID, FALSE);
+
+  if (vals->resize_aux_layers == TRUE)
+    {
+      alpha_lock_pres = unlock_aux_layer (vals->pres_layer_ID);
+      alpha_lock_disc = unlock_aux_layer (vals->disc_layer_ID);
+      alpha_lock_rigmask = unlock_aux_layer (vals->rigmask_layer_ID);
+    }
+  for (i = 0; i < ci->n_followers; i++)
+    {
+      alpha_lock_followers[i] = unlock_aux_layer (ci->followers[i]);
+    }
+
+  carver_data->carver = ci->carver;
+  carver_data->image_ID = image_ID;
+  carver_data->layer_ID = layer_ID;
+  carver_data->base_type = gimp_image_base_type (image_ID);
+  carver_data->alpha_lock = alpha_lock;
+  carver_data->alpha_lock_pres = alpha_lock_pres;
+  carver_data->alpha_lock_disc = alpha_lock_disc;
+  carver_data->alpha_lock_rigmask = alpha_lock_rigmask;
+  carver_data->followers = ci->followers;
+  carver_data->alpha_lock_followers = alpha_lock_followers;
+  carver_data->n_followers = ci->n_followers;
+  carver_data->follower_carvers = ci->follower_carvers;
+
+  carver_data->ref_w = ci->old_width;
+  carver_data->ref_h = ci->old_height;
+  carver_data->x_off = ci->x_off;
+  carver_data->y_off = ci->y_off;
+  carver_data->no_seams = !ci->keep_seams;
+  carver_data->degradations = ci->degradations;
+  carver_data->proxy_factor = ci->proxy_factor;
+  carver_data->prescale_ratio = ci->prescaled ? ci->ratio : 1;
+  /* the workers of independent layers would skew the timing */
+  carver_data->calibrate = (!ci->interactive) && (vals->max_seconds > 0) &&
+    (!ci->seams_loaded) && (!ci->independent);
+  carver_data->orientation = 0;
+  carver_data->depth = 0;
+  carver_data->enl_step = vals->enl_step / 100;
+
+  carver_data->vmap_key = ci->vmap_key;
+  carver_data->vmap_image_ID = ci->vmap_image_ID;
+  carver_data->vmap_reach = ci->vmap_reach;
+
+  /* all of it belongs to the carver data now */
+  ci->carver = NULL;
+  ci->rgb_buffer = NULL;
+  ci->followers = NULL;
+  ci->follower_carvers = NULL;
+  ci->vmap_key = NULL;
+
+  return carver_data;
+}
+
+/* The single way out of render_init_carver: drops the temporary
+ * copies and buffers, and after a failure whatever was not handed
+ * over to the carver data */
+static void
+carver_init_cleanup (CarverInit * ci)
+{
+  gint i;
+
+  aux_layer_cache_clear (&ci->aux_cache);
+  carver_init_unprescale (ci);
+  if (ci->vmap != NULL)
+    {
+      lqr_vmap_destroy (ci->vmap);
+    }
+  if (ci->carver != NULL)
+    {
+      /* this takes the buffer along, unless it is mapped */
+      lqr_carver_destroy (ci->carver);
+      if (pixel_buffer_is_mapped (ci->rgb_buffer))
+        {
+          pixel_buffer_free (ci->rgb_buffer);
+        }
+    }
+  else if (ci->rgb_buffer != NULL)
+    {
+      pixel_buffer_free (ci->rgb_buffer);
+    }
+  if (ci->follower_carvers != NULL)
+    {
+      for (i = 0; i < ci->n_followers; i++)
+        {
+          if (ci->follower_carvers[i] != NULL)
+            {
+              lqr_carver_destroy (ci->follower_carvers[i]);
+            }
+        }
+      g_free (ci->follower_carvers);
+    }
+  g_free (ci->followers);
+  g_free (ci->progress);
+  g_free (ci->vmap_key);
+}
+
+gboolean
+render_noninteractive (PlugInVals * vals,
+        PlugInColVals * col_vals,
+        CarverData * carver_data)
+{
+  LqrCarver *carver;
+  LqrCarverList *carver_list;
+  gint32 image_ID;
+  gint32 layer_ID;
+  gchar layer_name[LQR_MAX_NAME_LENGTH];
+  gboolean alpha_lock;
+  gboolean alpha_lock_pres = FALSE, alpha_lock_disc = FALSE, alpha_lock_rigmask = FALSE;
   gint old_width, old_height;
   gint new_width, new_height;
   gint x_off, y_off;
+  GimpRGB colour_start, colour_end;
+  LqrCarver **out_carvers;
+  gint32 *out_layer_IDs;
+  gint n_outputs;
+  gint i;
+  LqrVMap *vmap;
+  gint64 start_time;
+  FollowerJob *jobs = NULL;
+  GThreadPool *pool = NULL;
+  LqrRetVal ret;
 #ifdef __CLOCK_IT__
   double clock1, clock2, clock3;
 #endif /* __CLOCK_IT__ */
 
-  carver = carver_data->carver;
-  image_ID = carver_data->image_ID;
-  layer_ID = carver_data->layer_ID;
+  if (carver_data->carver == NULL)
+    {
+      return render_strips (vals, carver_data);
+    }
+
+  carver = carver_data->carver;
+  image_ID = carver_data->image_ID;
+  layer_ID = carver_data->layer_ID;
+  alpha_lock = carver_data->alpha_lock;
+  alpha_lock_pres = carver_data->alpha_lock_pres;
+  alpha_lock_disc = carver_data->alpha_lock_disc;
+  alpha_lock_rigmask = carver_data->alpha_lock_rigmask;
+
+  g_snprintf (layer_name, LQR_MAX_NAME_LENGTH, "%s",
+              gimp_drawable_get_name (layer_ID));
+
+  /* new targets may already have the output size, the original
+   * size is the carver's one */
+  old_width = lqr_carver_get_width (carver);
+  old_height = lqr_carver_get_height (carver);
+  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+
+  new_width = vals->new_width;
+  new_height = vals->new_height;
+
+#ifdef __CLOCK_IT__
+  clock1 = (double) clock () / CLOCKS_PER_SEC;
+#endif /* __CLOCK_IT__ */
+
+  /* independent layers are carved by the workers while the selected
+   * one is carved here, since its progress is reported through
+   * libgimp */
+  if (carver_data->follower_carvers)
+    {
+      jobs = followers_carve_start (vals, carver_data, old_width, old_height,
+                                    new_width, new_height, &pool);
+      MEM_CHECK (jobs);
+    }
+
+  start_time = g_get_monotonic_time ();
+  ret = lqr_carver_resize (carver, new_width, new_height);
+  if (jobs)
+    {
+      MEM_CHECK2 (followers_carve_finish (jobs, carver_data->n_followers, pool));
+    }
+  MEM_CHECK1 (ret);
+  if (carver_data->calibrate)
+    {
+      deadline_calibrate (old_width, old_height, new_width, new_height,
+                          (g_get_monotonic_time () - start_time) / 1e6);
+    }
+
+  if (carver_data->vmap_key)
+    {
+      vmap = lqr_vmap_dump (carver);
+      if (vmap)
+        {
+          vmap_cache_store (carver_data->vmap_image_ID, carver_data->vmap_key,
+                            vmap, carver_data->vmap_reach);
+          lqr_vmap_destroy (vmap);
+        }
+      g_free (carver_data->vmap_key);
+      carver_data->vmap_key = NULL;
+    }
+
+  if (vals->scaleback)
+    {
+      switch (vals->scaleback_mode)
+        {
+        case SCALEBACK_MODE_LQRBACK:
+          MEM_CHECK1 (lqr_carver_flatten (carver));
+          new_width = old_width;
+          new_height = old_height;
+          MEM_CHECK1 (lqr_carver_resize (carver, new_width, new_height));
+          break;
+        case SCALEBACK_MODE_STD:
+        case SCALEBACK_MODE_STDW:
+        case SCALEBACK_MODE_STDH:
+          break;
+        default:
+          g_message ("error: unknown mode");
+          return FALSE;
+        }
+    }
+
+  if ((vals->output_seams) && (!carver_data->no_seams)) {
+    gimp_rgba_set (&colour_start, col_vals->r1, col_vals->g1, col_vals->b1, 1);
+    gimp_rgba_set (&colour_end, col_vals->r2, col_vals->g2, col_vals->b2, 1);
+
+    MEM_CHECK1 (write_all_vmaps (lqr_vmap_list_start (carver), image_ID, layer_name, x_off,
+                     y_off, colour_start, colour_end));
+  }
+
+  if ((vals->seams_file[0] != '\0') && (!carver_data->no_seams))
+    {
+      MEM_CHECK1 (write_all_vmaps_to_file (lqr_vmap_list_start (carver), vals->seams_file));
+    }
+
+  if (vals->resize_canvas)
+    {
+      gimp_image_resize (image_ID, new_width, new_height, -x_off, -y_off);
+      gimp_layer_resize_to_image_size (layer_ID);
+    }
+  else if ((gimp_drawable_width (layer_ID) != new_width) ||
+           (gimp_drawable_height (layer_ID) != new_height))
+    {
+      gimp_layer_resize (layer_ID, new_width, new_height, 0, 0);
+    }
+
+#ifdef __CLOCK_IT__
+  clock2 = (double) clock () / CLOCKS_PER_SEC;
+  printf ("[ resized: %g ]\n", clock2 - clock1);
+  fflush (stdout);
+#endif /* __CLOCK_IT__ */
+
+  MEM_CHECK (out_carvers = g_try_new (LqrCarver *, MAX_OUTPUT_LAYERS + carver_data->n_followers));
+  MEM_CHECK (out_layer_IDs = g_try_new (gint32, MAX_OUTPUT_LAYERS + carver_data->n_followers));
+  out_carvers[0] = carver;
+  out_layer_IDs[0] = layer_ID;
+  n_outputs = 1;
+
+  /* the attached carvers are in the order of render_init_carver:
+   * the aux layers, then the other layers carved along */
+  carver_list = lqr_carver_list_start (carver);
+  if (vals->resize_aux_layers)
+    {
+      n_outputs = add_aux_output (&carver_list, vals->pres_layer_ID, layer_ID, new_width, new_height,
+                                  out_carvers, out_layer_IDs, n_outputs);
+      n_outputs = add_aux_output (&carver_list, vals->disc_layer_ID, layer_ID, new_width, new_height,
+                                  out_carvers, out_layer_IDs, n_outputs);
+      n_outputs = add_aux_output (&carver_list, vals->rigmask_layer_ID, layer_ID, new_width, new_height,
+                                  out_carvers, out_layer_IDs, n_outputs);
+    }
+  for (i = 0; i < carver_data->n_followers; i++)
+    {
+      if (carver_data->follower_carvers)
+        {
+          fit_aux_layer (carver_data->followers[i], layer_ID, new_width, new_height);
+          out_carvers[n_outputs] = carver_data->follower_carvers[i];
+          out_layer_IDs[n_outputs++] = carver_data->followers[i];
+        }
+      else
+        {
+          n_outputs = add_aux_output (&carver_list, carver_data->followers[i], layer_ID,
+                                      new_width, new_height, out_carvers, out_layer_IDs,
+                                      n_outputs);
+        }
+    }
+
+  /* all the layers are written at the same time, make room
+   * for a row of tiles for each one */
+  set_tiles (new_width * n_outputs);
+
+  MEM_CHECK1 (write_carvers_to_layers (out_carvers, out_layer_IDs, n_outputs));
+  g_free (out_carvers);
+  g_free (out_layer_IDs);
+
+  lqr_carver_destroy (carver);
+  if (carver_data->follower_carvers)
+    {
+      for (i = 0; i < carver_data->n_followers; i++)
+        {
+          lqr_carver_destroy (carver_data->follower_carvers[i]);
+        }
+      g_free (carver_data->follower_carvers);
+      carver_data->follower_carvers = NULL;
+    }
+  pixel_buffers_release_mapped ();
+
+  if ((vals->scaleback) && (vals->scaleback_mode != SCALEBACK_MODE_LQRBACK))
+    {
+      if (!scale_back_std (vals, image_ID, layer_ID, old_width, old_height,
+                           new_width, new_height, x_off, y_off,
+                           carver_data->followers, carver_data->n_followers))
+        {
+          return FALSE;
+        }
+    }
+
+
+#ifdef __CLOCK_IT__
+  clock3 = (double) clock () / CLOCKS_PER_SEC;
+  printf ("[ finish: %g ]\n\n", clock3 - clock2);
+#endif /* __CLOCK_IT__ */
+
+  gimp_drawable_set_visible (layer_ID, TRUE);
+  gimp_image_set_active_layer (image_ID, layer_ID);
+
+  gimp_layer_set_lock_alpha (layer_ID, alpha_lock);
+  if (vals->resize_aux_layers == TRUE)
+    {
+      if (IS_AUX_LAYER (vals->pres_layer_ID))
+        {
+          gimp_layer_set_lock_alpha (vals->pres_layer_ID, alpha_lock_pres);
+        }
+      if (IS_AUX_LAYER (vals->disc_layer_ID))
+        {
+          gimp_layer_set_lock_alpha (vals->disc_layer_ID, alpha_lock_disc);
+        }
+      if (IS_AUX_LAYER (vals->rigmask_layer_ID))
+        {
+          gimp_layer_set_lock_alpha (vals->rigmask_layer_ID, alpha_lock_rigmask);
+        }
+    }
+  for (i = 0; i < carver_data->n_followers; i++)
+    {
+      gimp_layer_set_lock_alpha (carver_data->followers[i],
+                                 carver_data->alpha_lock_followers[i]);
+    }
+  g_free (carver_data->followers);
+  g_free (carver_data->alpha_lock_followers);
+  carver_data->followers = NULL;
+  carver_data->alpha_lock_followers = NULL;
+  carver_data->n_followers = 0;
+
+  return TRUE;
+}
+
+/* Retargets the layer to several sizes, each written to a new layer
+ * or image. Sizes sharing the first extent share a carver: liblqr
+ * keeps all the sizes within the computed depth available, so after
+ * the smallest one the others come without computing seams again.
+ * The layer is read once for all the carvers. Aux layers are only
+ * used as masks. */
+gboolean
+render_multi_noninteractive (PlugInImageVals * image_vals,
+        PlugInDrawableVals * drawable_vals,
+        PlugInVals * vals,
+        gint * sizes,
+        gint n_sizes,
+        gboolean display,
+        gint32 * out_layer_IDs)
+{
+  LqrCarver *carver;
+  LqrProgress *progress;
+  gint32 image_ID;
+  gint32 layer_ID;
+  guchar *rgb_buffer;
+  gint *order;
+  gint old_width, old_height;
+  gint new_width, new_height;
+  gint bpp;
+  gint x_off, y_off;
+  gboolean ignore_disc_mask;
+  gint i, j, k;
+
+  image_ID = image_vals->image_ID;
+  layer_ID = drawable_vals->layer_ID;
+
+  IMAGE_CHECK (image_ID, FALSE);
+
+  if (!layer_ID)
+    {
+      layer_ID = gimp_image_get_active_layer (image_ID);
+    }
+
+  LAYER_CHECK (layer_ID, FALSE);
+  LAYER_CHECK0 (vals->pres_layer_ID, FALSE);
+  LAYER_CHECK0 (vals->disc_layer_ID, FALSE);
+  LAYER_CHECK0 (vals->rigmask_layer_ID, FALSE);
+
+  UNFLOAT (layer_ID);
+  selection_to_aux_channel (image_ID, vals);
+  SELECTION_SAVE (image_ID);
+  UNMASK (layer_ID);
+
+  old_width = gimp_drawable_width (layer_ID);
+  old_height = gimp_drawable_height (layer_ID);
+  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+  bpp = drawable_channels (layer_ID);
+
+  set_tiles (old_width);
+
+  progress = progress_init();
+  MEM_CHECK (progress);
+
+  rgb_buffer = rgb_buffer_from_layer (layer_ID);
+  MEM_CHECK (rgb_buffer);
+
+  MEM_CHECK (order = g_try_new (gint, n_sizes));
+  sort_sizes (sizes, n_sizes, vals->res_order, order);
+
+  for (i = 0; i < n_sizes; i = j)
+    {
+      for (j = i + 1; j < n_sizes; j++)
+        {
+          if (SIZE_FIRST (sizes, order[j], vals->res_order) !=
+              SIZE_FIRST (sizes, order[i], vals->res_order))
+            {
+              break;
+            }
+        }
+
+      /* the group's smallest size comes first */
+      ignore_disc_mask = compute_ignore_disc_mask (vals, old_width, old_height,
+                                                   sizes[2 * order[i]], sizes[2 * order[i] + 1]);
+      carver = multi_carver_new (vals, layer_ID, rgb_buffer, old_width, old_height, bpp,
+                                 x_off, y_off, ignore_disc_mask, progress);
+      MEM_CHECK (carver);
+
+      for (k = i; k < j; k++)
+        {
+          new_width = sizes[2 * order[k]];
+          new_height = sizes[2 * order[k] + 1];
+          MEM_CHECK1 (lqr_carver_resize (carver, new_width, new_height));
+          out_layer_IDs[order[k]] = multi_output_layer (image_ID, layer_ID, vals,
+                                                        new_width, new_height,
+                                                        x_off, y_off);
+          set_tiles (new_width);
+          MEM_CHECK1 (write_carver_to_layer (carver, out_layer_IDs[order[k]]));
+          gimp_layer_set_lock_alpha (out_layer_IDs[order[k]],
+                                     gimp_layer_get_lock_alpha (layer_ID));
+        }
+
+      lqr_carver_destroy (carver);
+    }
+
+  g_free (order);
+  pixel_buffer_free (rgb_buffer);
+  pixel_buffers_release_mapped ();
+
+  if (vals->output_target == OUTPUT_TARGET_NEW_IMAGE)
+    {
+      for (i = 0; i < n_sizes; i++)
+        {
+          gimp_image_undo_group_end (gimp_drawable_get_image (out_layer_IDs[i]));
+          if (display)
+            {
+              gimp_display_new (gimp_drawable_get_image (out_layer_IDs[i]));
+            }
+        }
+    }
+
+  gimp_image_set_active_layer (image_ID, layer_ID);
+
+  return TRUE;
+}
+
+/* Carves a layer along a seam map saved by a previous run on an
+ * aligned layer of the same size: the seams are not searched for,
+ * the pixels are just copied */
+gboolean
+render_replay (PlugInImageVals * image_vals,
+        PlugInDrawableVals * drawable_vals,
+        PlugInVals * vals,
+        const gchar * seams_file,
+        gint size,
+        gboolean display,
+        gint32 * out_layer_ID_p)
+{
+  LqrCarver *carver;
+  LqrVMap *vmap;
+  gint32 image_ID;
+  gint32 layer_ID;
+  gchar layer_name[LQR_MAX_NAME_LENGTH];
+  gchar new_layer_name[LQR_MAX_NAME_LENGTH];
+  guchar *rgb_buffer;
+  gboolean alpha_lock;
+  gint old_width, old_height;
+  gint new_width, new_height;
+  gint extent, depth;
+  gint x_off, y_off;
+
+  image_ID = image_vals->image_ID;
+  layer_ID = drawable_vals->layer_ID;
+
+  IMAGE_CHECK (image_ID, FALSE);
+  LAYER_CHECK (layer_ID, FALSE);
+
+  UNFLOAT (layer_ID);
+  SELECTION_SAVE (image_ID);
+  UNMASK (layer_ID);
+
+  g_snprintf (layer_name, LQR_MAX_NAME_LENGTH, "%s",
+            gimp_drawable_get_name (layer_ID));
+
+  old_width = gimp_drawable_width (layer_ID);
+  old_height = gimp_drawable_height (layer_ID);
+  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+
+  vmap = vmap_from_file (seams_file);
+  if (vmap == NULL)
+    {
+      return FALSE;
+    }
+
+  if ((lqr_vmap_get_width (vmap) != old_width) ||
+      (lqr_vmap_get_height (vmap) != old_height))
+    {
+      g_message (_("Error: the seam map does not match the layer size"));
+      lqr_vmap_destroy (vmap);
+      return FALSE;
+    }
+
+  new_width = old_width;
+  new_height = old_height;
+  if (lqr_vmap_get_orientation (vmap) == 0)
+    {
+      new_width = size;
+      extent = old_width;
+    }
+  else
+    {
+      new_height = size;
+      extent = old_height;
+    }
+  depth = lqr_vmap_get_depth (vmap);
+  if ((size > extent) || (size < extent - depth))
+    {
+      g_message (_("Error: the seam map only allows sizes from %d to %d"),
+                 extent - depth, extent);
+      lqr_vmap_destroy (vmap);
+      return FALSE;
+    }
+
+  set_tiles (old_width);
+
+  rgb_buffer = rgb_buffer_from_layer (layer_ID);
+  MEM_CHECK (rgb_buffer);
+  carver = lqr_carver_new (rgb_buffer, old_width, old_height, drawable_channels (layer_ID));
+  MEM_CHECK (carver);
+  PRESERVE_MAPPED (carver, rgb_buffer);
+  if (lqr_vmap_load (carver, vmap) != LQR_OK)
+    {
+      g_message (_("Error: could not load the seam map"));
+      lqr_vmap_destroy (vmap);
+      lqr_carver_destroy (carver);
+      pixel_buffers_release_mapped ();
+      return FALSE;
+    }
+  lqr_vmap_destroy (vmap);
+
+  MEM_CHECK1 (lqr_carver_resize (carver, new_width, new_height));
+
+  alpha_lock = gimp_layer_get_lock_alpha (layer_ID);
+
+  if (vals->output_target == OUTPUT_TARGET_NEW_LAYER)
+    {
+      g_snprintf (new_layer_name, LQR_MAX_NAME_LENGTH, "%s LqR", layer_name);
+      layer_ID = new_target_layer (image_ID, layer_ID, new_layer_name,
+                                   new_width, new_height, x_off, y_off);
+    }
+  else if (vals->output_target == OUTPUT_TARGET_NEW_IMAGE)
+    {
+      image_ID = gimp_image_new (new_width, new_height, gimp_image_base_type (image_ID));
+      gimp_image_undo_group_start (image_ID);
+      layer_ID = new_target_layer (image_ID, layer_ID, layer_name,
+                                   new_width, new_height, 0, 0);
+    }
+  else if (vals->resize_canvas)
+    {
+      gimp_image_resize (image_ID, new_width, new_height, -x_off, -y_off);
+      gimp_layer_resize_to_image_size (layer_ID);
+    }
+  else
+    {
+      gimp_layer_resize (layer_ID, new_width, new_height, 0, 0);
+    }
+
+  gimp_layer_set_lock_alpha (layer_ID, FALSE);
+
+  set_tiles (new_width);
+  MEM_CHECK1 (write_carver_to_layer (carver, layer_ID));
+
+  lqr_carver_destroy (carver);
+  pixel_buffers_release_mapped ();
+
+  gimp_layer_set_lock_alpha (layer_ID, alpha_lock);
+  gimp_drawable_set_visible (layer_ID, TRUE);
+  gimp_image_set_active_layer (image_ID, layer_ID);
+
+  if (vals->output_target == OUTPUT_TARGET_NEW_IMAGE)
+    {
+      gimp_image_undo_group_end (image_ID);
+      if (display)
+        {
+          gimp_display_new (image_ID);
+        }
+    }
+
+  *out_layer_ID_p = layer_ID;
+
+  return TRUE;
+}
+
+gboolean
+render_interactive (PlugInVals * vals,
+        CarverData * carver_data)
+{
+  LqrCarver *carver;
+  LqrCarverList *carver_list;
+  gint32 image_ID;
+  gint32 layer_ID;
+  gchar layer_name[LQR_MAX_NAME_LENGTH];
+  gint new_width, new_height;
+  gint x_off, y_off;
+#ifdef __CLOCK_IT__
+  double clock1, clock2, clock3;
+#endif /* __CLOCK_IT__ */
+
+  carver = carver_data->carver;
+  image_ID = carver_data->image_ID;
+  layer_ID = carver_data->layer_ID;
+
+  IMAGE_CHECK (image_ID, FALSE);
+
+  LAYER_CHECK (layer_ID, FALSE);
+  LAYER_CHECK0 (vals->pres_layer_ID, FALSE);
+  LAYER_CHECK0 (vals->disc_layer_ID, FALSE);
+  LAYER_CHECK0 (vals->rigmask_layer_ID, FALSE);
+
+  IMAGE_TYPE_CHECK (image_ID, carver_data->base_type);
+  BPP_CHECK (layer_ID, carver);
+  if (vals->resize_aux_layers == TRUE)
+    {
+      carver_list = lqr_carver_list_start (carver);
+      MEM_CHECK2 (check_aux_layer_bpp (&carver_list, vals->pres_layer_ID));
+      MEM_CHECK2 (check_aux_layer_bpp (&carver_list, vals->disc_layer_ID));
+      MEM_CHECK2 (check_aux_layer_bpp (&carver_list, vals->rigmask_layer_ID));
+    }
+
+  UNFLOAT (layer_ID);
+  SELECTION_SAVE (image_ID);
+  UNMASK (layer_ID);
+
+  g_snprintf (layer_name, LQR_MAX_NAME_LENGTH, "%s",
+            gimp_drawable_get_name (layer_ID));
+
+  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+
+  new_width = vals->new_width;
+  new_height = vals->new_height;
+
+  gimp_layer_set_lock_alpha (layer_ID, FALSE);
+
+  if (vals->resize_aux_layers == TRUE)
+    {
+      unlock_aux_layer (vals->pres_layer_ID);
+      unlock_aux_layer (vals->disc_layer_ID);
+      unlock_aux_layer (vals->rigmask_layer_ID);
+    }
+
+#ifdef __CLOCK_IT__
+  clock1 = (double) clock () / CLOCKS_PER_SEC;
+#endif /* __CLOCK_IT__ */
+
+  MEM_CHECK1 (lqr_carver_resize (carver, new_width, new_height));
+
+  if (vals->resize_canvas == TRUE)
+    {
+      gimp_image_resize (image_ID, new_width, new_height, -x_off, -y_off);
+      gimp_layer_resize_to_image_size (layer_ID);
+    }
+  else
+    {
+      gimp_layer_resize (layer_ID, new_width, new_height, 0, 0);
+    }
+
+#ifdef __CLOCK_IT__
+  clock2 = (double) clock () / CLOCKS_PER_SEC;
+  printf ("[ resized: %g ]\n", clock2 - clock1);
+  fflush (stdout);
+#endif /* __CLOCK_IT__ */
+
+  carver_data->ref_w = lqr_carver_get_ref_width (carver);
+  carver_data->ref_h = lqr_carver_get_ref_height (carver);
+  carver_data->orientation = lqr_carver_get_orientation (carver);
+  carver_data->depth = lqr_carver_get_depth (carver);
+  carver_data->enl_step = lqr_carver_get_enl_step (carver);
+
+  set_tiles (new_width);
+
+  MEM_CHECK1 (write_carver_to_layer_diff (carver, layer_ID, &carver_data->commit));
+
+  if (vals->resize_aux_layers)
+    {
+      carver_list = lqr_carver_list_start (carver);
+      MEM_CHECK2 (write_aux_carver (&carver_list, vals->pres_layer_ID, layer_ID, new_width, new_height,
+                                    &carver_data->commit_pres));
+      MEM_CHECK2 (write_aux_carver (&carver_list, vals->disc_layer_ID, layer_ID, new_width, new_height,
+                                    &carver_data->commit_disc));
+      MEM_CHECK2 (write_aux_carver (&carver_list, vals->rigmask_layer_ID, layer_ID, new_width, new_height,
+                                    &carver_data->commit_rigmask));
+    }
+
+#ifdef __CLOCK_IT__
+  clock3 = (double) clock () / CLOCKS_PER_SEC;
+  printf ("[ finish: %g ]\n\n", clock3 - clock2);
+#endif /* __CLOCK_IT__ */
+
+  gimp_drawable_set_visible (layer_ID, TRUE);
+  gimp_image_set_active_layer (image_ID, layer_ID);
+
+  return TRUE;
+}
+
+gboolean
+render_flatten (PlugInVals * vals,
+        CarverData * carver_data)
+{
+  LqrCarver *carver;
+  LqrCarverList *carver_list;
+  gint32 image_ID;
+  gint32 layer_ID;
+  gchar layer_name[LQR_MAX_NAME_LENGTH];
+  gint old_width, old_height;
+  gint x_off, y_off;
+#ifdef __CLOCK_IT__
+  double clock1, clock2, clock3;
+#endif /* __CLOCK_IT__ */
+
+  carver = carver_data->carver;
+  image_ID = carver_data->image_ID;
+  layer_ID = carver_data->layer_ID;
+
+  IMAGE_CHECK (image_ID, FALSE);
+
+  LAYER_CHECK (layer_ID, FALSE);
+  LAYER_CHECK0 (vals->pres_layer_ID, FALSE);
+  LAYER_CHECK0 (vals->disc_layer_ID, FALSE);
+  LAYER_CHECK0 (vals->rigmask_layer_ID, FALSE);
+
+  IMAGE_TYPE_CHECK (image_ID, carver_data->base_type);
+  BPP_CHECK (layer_ID, carver);
+  if (vals->resize_aux_layers == TRUE)
+    {
+      carver_list = lqr_carver_list_start (carver);
+      MEM_CHECK2 (check_aux_layer_bpp (&carver_list, vals->pres_layer_ID));
+      MEM_CHECK2 (check_aux_layer_bpp (&carver_list, vals->disc_layer_ID));
+      MEM_CHECK2 (check_aux_layer_bpp (&carver_list, vals->rigmask_layer_ID));
+    }
+
+  UNFLOAT (layer_ID);
+  SELECTION_SAVE (image_ID);
+  UNMASK (layer_ID);
+
+  g_snprintf (layer_name, LQR_MAX_NAME_LENGTH, "%s",
+            gimp_drawable_get_name (layer_ID));
+
+  old_width = gimp_drawable_width (layer_ID);
+  old_height = gimp_drawable_height (layer_ID);
+  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+
+  gimp_layer_set_lock_alpha (layer_ID, FALSE);
+
+  if (vals->resize_aux_layers == TRUE)
+    {
+      unlock_aux_layer (vals->pres_layer_ID);
+      unlock_aux_layer (vals->disc_layer_ID);
+      unlock_aux_layer (vals->rigmask_layer_ID);
+    }
+
+#ifdef __CLOCK_IT__
+  clock1 = (double) clock () / CLOCKS_PER_SEC;
+#endif /* __CLOCK_IT__ */
+
+  MEM_CHECK1 (lqr_carver_flatten (carver));
+
+  if (vals->resize_canvas == TRUE)
+    {
+      gimp_image_resize (image_ID, old_width, old_height, -x_off, -y_off);
+      gimp_layer_resize_to_image_size (layer_ID);
+    }
+  else
+    {
+      gimp_layer_resize (layer_ID, old_width, old_height, 0, 0);
+    }
+
+#ifdef __CLOCK_IT__
+  clock2 = (double) clock () / CLOCKS_PER_SEC;
+  printf ("[ flattened: %g ]\n", clock2 - clock1);
+  fflush (stdout);
+#endif /* __CLOCK_IT__ */
+
+  carver_data->ref_w = lqr_carver_get_ref_width (carver);
+  carver_data->ref_h = lqr_carver_get_ref_height (carver);
+  carver_data->orientation = lqr_carver_get_orientation (carver);
+  carver_data->depth = lqr_carver_get_depth (carver);
+  carver_data->enl_step = lqr_carver_get_enl_step (carver);
+
+  set_tiles (old_width);
+
+  MEM_CHECK1 (write_carver_to_layer_diff (carver, layer_ID, &carver_data->commit));
+
+  if (vals->resize_aux_layers)
+    {
+      carver_list = lqr_carver_list_start (carver);
+      MEM_CHECK2 (write_aux_carver (&carver_list, vals->pres_layer_ID, layer_ID, old_width, old_height,
+                                    &carver_data->commit_pres));
+      MEM_CHECK2 (write_aux_carver (&carver_list, vals->disc_layer_ID, layer_ID, old_width, old_height,
+                                    &carver_data->commit_disc));
+      MEM_CHECK2 (write_aux_carver (&carver_list, vals->rigmask_layer_ID, layer_ID, old_width, old_height,
+                                    &carver_data->commit_rigmask));
+    }
+
+#ifdef __CLOCK_IT__
+  clock3 = (double) clock () / CLOCKS_PER_SEC;
+  printf ("[ finish: %g ]\n\n", clock3 - clock2);
+#endif /* __CLOCK_IT__ */
+
+  gimp_drawable_set_visible (layer_ID, TRUE);
+  gimp_image_set_active_layer (image_ID, layer_ID);
+
+  return TRUE;
+}
+
+gboolean
+render_dump_vmap (PlugInVals * vals,
+        PlugInColVals * col_vals,
+        CarverData * carver_data,
+        gint32 * vmap_layer_ID_p)
+{
+  LqrCarver *carver;
+  LqrVMap *vmap;
+  VMapFuncArg vmap_data;
+  gint32 image_ID;
+  gint32 layer_ID;
+  gchar layer_name[LQR_MAX_NAME_LENGTH];
+  gchar vmap_name[LQR_MAX_NAME_LENGTH];
+  gint x_off, y_off;
+  GimpRGB colour_start, colour_end;
+#ifdef __CLOCK_IT__
+  double clock1, clock2, clock3;
+#endif /* __CLOCK_IT__ */
+
+  carver = carver_data->carver;
+  image_ID = carver_data->image_ID;
+  layer_ID = carver_data->layer_ID;
+
+  IMAGE_CHECK (image_ID, FALSE);
+
+  LAYER_CHECK (layer_ID, FALSE);
+
+  IMAGE_TYPE_CHECK (image_ID, carver_data->base_type);
+
+  UNFLOAT (layer_ID);
+  SELECTION_SAVE (image_ID);
+  UNMASK (layer_ID);
+
+  g_snprintf (layer_name, LQR_MAX_NAME_LENGTH, "%s",
+            gimp_drawable_get_name (layer_ID));
+
+  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+
+#ifdef __CLOCK_IT__
+  clock1 = (double) clock () / CLOCKS_PER_SEC;
+#endif /* __CLOCK_IT__ */
+
+  vmap = lqr_vmap_dump (carver);
+  MEM_CHECK (vmap);
+
+  g_snprintf (vmap_name, LQR_MAX_NAME_LENGTH, _("%s seam map"), layer_name);
+
+#ifdef __CLOCK_IT__
+  clock2 = (double) clock () / CLOCKS_PER_SEC;
+  printf ("[ dumped: %g ]\n", clock2 - clock1);
+  fflush (stdout);
+#endif /* __CLOCK_IT__ */
+
+  gimp_rgba_set (&colour_start, col_vals->r1, col_vals->g1, col_vals->b1, 1);
+  gimp_rgba_set (&colour_end, col_vals->r2, col_vals->g2, col_vals->b2, 1);
+
+  vmap_data.image_ID = image_ID;
+  vmap_data.name = vmap_name;
+  vmap_data.x_off = x_off;
+  vmap_data.y_off = y_off;
+  vmap_data.colour_start = colour_start;
+  vmap_data.colour_end = colour_end;
+  vmap_data.vmap_layer_ID_p = vmap_layer_ID_p;
+
+  set_tiles (lqr_vmap_get_width(vmap));
+
+  MEM_CHECK1 (write_vmap_to_layer (vmap, (gpointer) (&vmap_data)));
+
+#ifdef __CLOCK_IT__
+  clock3 = (double) clock () / CLOCKS_PER_SEC;
+  printf ("[ finish: %g ]\n\n", clock3 - clock2);
+#endif /* __CLOCK_IT__ */
+
+  gimp_image_set_active_layer (image_ID, layer_ID);
+
+  return TRUE;
+}
+
+void
+render_clear_commits (CarverData * carver_data)
+{
+  layer_commit_clear (&carver_data->commit);
+  layer_commit_clear (&carver_data->commit_pres);
+  layer_commit_clear (&carver_data->commit_disc);
+  layer_commit_clear (&carver_data->commit_rigmask);
+}
+
+static gboolean
+my_progress_end (const gchar * message)
+{
+  return gimp_progress_end ();
+}
+
+static LqrProgress*
+progress_init (void)
+{
+  LqrProgress * progress = lqr_progress_new ();
+  MEM_CHECK_N (progress);
+  lqr_progress_set_init (progress, (LqrProgressFuncInit) gimp_progress_init);
+  lqr_progress_set_update (progress, (LqrProgressFuncUpdate) gimp_progress_update);
+  lqr_progress_set_end (progress, (LqrProgressFuncEnd) my_progress_end);
+  lqr_progress_set_init_width_message (progress, _("Resizing width..."));
+  lqr_progress_set_init_height_message (progress,
+                                        _("Resizing height..."));
+  return progress;
+}
+
+static gfloat
+rigidity_init (PlugInVals * vals)
+{
+  if (vals->rigmask_layer_ID != 0)
+    {
+      return 3 * vals->rigidity;
+    }
+  else
+    {
+      return vals->rigidity;
+    }
+}
+
+static gboolean
+compute_ignore_disc_mask (PlugInVals * vals, gint old_width, gint old_height, gint new_width, gint new_height)
+{
+  if (!vals->no_disc_on_enlarge)
+    {
+      return FALSE;
+    }
+
+  switch (vals->res_order)
+    {
+      case LQR_RES_ORDER_HOR:
+        if ((new_width > old_width) || ((new_width == old_width) && (new_height > old_height)))
+          {
+            return TRUE;
+          }
+        break;
+      case LQR_RES_ORDER_VERT:
+        if ((new_height > old_height) || ((new_height == old_height) && (new_width > old_width)))
+          {
+            return TRUE;
+          }
+        break;
+      default:
+        g_message ("Error: unknown resize order index");
+        abort();
+    }
+  return FALSE;
+}
+
+static void
+set_tiles (gint width)
+{
+  gint ntiles = width / gimp_tile_width () + 1;
+  gimp_tile_cache_size (((gulong) gimp_tile_width () * gimp_tile_height () * ntiles *
+                         4 * 2) / 1024 + 1);
+}
+
+static gboolean
+check_aux_layer_bpp (LqrCarverList ** carver_list_p, gint32 layer_ID)
+{
+  LqrCarver * aux_carver;
+  if (!IS_AUX_LAYER (layer_ID))
+    {
+      return TRUE;
+    }
+  aux_carver = lqr_carver_list_current (*carver_list_p);
+  BPP_CHECK (layer_ID, aux_carver);
+  *carver_list_p = lqr_carver_list_next (*carver_list_p);
+  return TRUE;
+}
+
+/* Creates an empty layer with the properties of src_layer_ID,
+ * to be filled by the carver */
+static gint32
+new_target_layer (gint32 image_ID, gint32 src_layer_ID, const gchar * name,
+                  gint width, gint height, gint x_off, gint y_off)
+{
+  gint32 layer_ID;
+
+  layer_ID = gimp_layer_new (image_ID, name, width, height,
+                             gimp_drawable_type (src_layer_ID),
+                             gimp_layer_get_opacity (src_layer_ID),
+                             gimp_layer_get_mode (src_layer_ID));
+  gimp_image_insert_layer (image_ID, layer_ID, 0, -1);
+  gimp_layer_set_offsets (layer_ID, x_off, y_off);
+  gimp_layer_set_lock_alpha (layer_ID, gimp_layer_get_lock_alpha (src_layer_ID));
+  return layer_ID;
+}
+
+/* Replaces an aux layer with an empty one in the new image, aligned
+ * to the output layer; channels were only needed as masks, and are
+ * dropped */
+static gboolean
+new_aux_target_layer (gint32 image_ID, gint32 * layer_ID_p, gint width, gint height)
+{
+  gint32 old_layer_ID;
+  gint32 new_layer_ID = 0;
+
+  old_layer_ID = *layer_ID_p;
+  if (IS_AUX_LAYER (old_layer_ID))
+    {
+      new_layer_ID = new_target_layer (image_ID, old_layer_ID,
+                                       gimp_drawable_get_name (old_layer_ID),
+                                       width, height, 0, 0);
+    }
+  *layer_ID_p = new_layer_ID;
+  return TRUE;
+}
+
+static gboolean
+unlock_aux_layer (gint32 layer_ID)
+{
+  gboolean alpha_lock = FALSE;
+  if (IS_AUX_LAYER (layer_ID))
+    {
+      alpha_lock = gimp_layer_get_lock_alpha (layer_ID);
+      gimp_layer_set_lock_alpha (layer_ID, FALSE);
+    }
+  return alpha_lock;
+}
+
+/* Aux layers are read through the area of the reference layer and
+ * keep their own geometry until the output is written, at which
+ * point they are aligned to the (resized) reference layer */
+static void
+fit_aux_layer (gint32 layer_ID, gint32 ref_layer_ID, gint width, gint height)
+{
+  gint aux_x_off, aux_y_off;
+  gint ref_x_off, ref_y_off;
+
+  gimp_drawable_offsets (layer_ID, &aux_x_off, &aux_y_off);
+  gimp_drawable_offsets (ref_layer_ID, &ref_x_off, &ref_y_off);
+  if ((aux_x_off == ref_x_off) && (aux_y_off == ref_y_off) &&
+      (gimp_drawable_width (layer_ID) == width) &&
+      (gimp_drawable_height (layer_ID) == height))
+    {
+      return;
+    }
+  gimp_layer_resize (layer_ID, width, height,
+                     aux_x_off - ref_x_off, aux_y_off - ref_y_off);
+}
+
+static LqrCarver*
+attach_aux_carver (LqrCarver * carver, gint32 layer_ID, gint width, gint height, AuxLayerCache * cache)
+{
+  guchar *rgb_buffer;
+  LqrCarver * aux_carver;
+  gint bpp;
+
+  if (IS_AUX_LAYER (layer_ID))
+    {
+      rgb_buffer = aux_layer_cache_take (cache, layer_ID);
+      MEM_CHECK_N (rgb_buffer);
+      bpp = drawable_channels (layer_ID);
+      aux_carver =
+        lqr_carver_new (rgb_buffer, width, height, bpp);
+
+      if (aux_carver == NULL)
+        {
+          pixel_buffer_free (rgb_buffer);
+          g_message(_("Not enough memory"));
+          return NULL;
+        }
+      PRESERVE_MAPPED (aux_carver, rgb_buffer);
+      if (lqr_carver_attach (carver, aux_carver) == LQR_NOMEM)
+        {
+          lqr_carver_destroy (aux_carver);
+          g_message(_("Not enough memory"));
+          return NULL;
+        }
+    }
+  return carver;
+}
+
+static void
+followers_add (GArray * followers, gint32 * layers, gint n_layers,
+               gint32 layer_ID, PlugInVals * vals)
+{
+  gint32 *children;
+  gint n_children;
+  gint i;
+
+  for (i = 0; i < n_layers; i++)
+    {
+      if (gimp_item_is_group (layers[i]))
+        {
+          children = gimp_item_get_children (layers[i], &n_children);
+          followers_add (followers, children, n_children, layer_ID, vals);
+          g_free (children);
+        }
+      else if ((layers[i] != layer_ID) &&
+               (layers[i] != vals->pres_layer_ID) &&
+               (layers[i] != vals->disc_layer_ID) &&
+               (layers[i] != vals->rigmask_layer_ID) &&
+               (!gimp_layer_is_floating_sel (layers[i])))
+        {
+          g_array_append_val (followers, layers[i]);
+        }
+    }
+}
+
+/* The layers carved along with the selected one, from the whole
+ * image or from its group, groups included down to their layers;
+ * the aux layers are left to resize_aux_layers */
+static gint32 *
+followers_new (gint32 image_ID, gint32 layer_ID, PlugInVals * vals, gint * n_followers)
+{
+  GArray *followers;
+  gint32 *layers;
+  gint32 parent_ID = -1;
+  gint n_layers;
+
+  if (vals->all_layers == ALL_LAYERS_GROUP)
+    {
+      parent_ID = gimp_item_get_parent (layer_ID);
+    }
+  if (parent_ID > 0)
+    {
+      layers = gimp_item_get_children (parent_ID, &n_layers);
+    }
+  else
+    {
+      layers = gimp_image_get_layers (image_ID, &n_layers);
+    }
+
+  followers = g_array_new (FALSE, FALSE, sizeof (gint32));
+  followers_add (followers, layers, n_layers, layer_ID, vals);
+  g_free (layers);
+
+  *n_followers = followers->len;
+  return (gint32 *) g_array_free (followers, FALSE);
+}
+
+/* A layer carved along is read through the area of the selected
+ * layer, from a copy scaled like it when prescaling; a mask is
+ * applied to a copy, as UNMASK will do to the layer itself */
+static LqrCarver *
+follower_carver_new (gint32 image_ID, gint32 layer_ID,
+                     gdouble ratio_x, gdouble ratio_y,
+                     gint width, gint height, gint x_off, gint y_off,
+                     gint mask_behavior)
+{
+  LqrCarver *aux_carver;
+  guchar *rgb_buffer;
+  gint32 read_layer_ID;
+  gint l_x_off, l_y_off;
+
+  read_layer_ID = layer_ID;
+  if ((ratio_x != 1) || (ratio_y != 1))
+    {
+      read_layer_ID = prescaled_copy (image_ID, layer_ID, ratio_x, ratio_y, x_off, y_off);
+    }
+  else if (gimp_layer_get_mask (layer_ID) != -1)
+    {
+      read_layer_ID = gimp_layer_copy (layer_ID);
+      gimp_image_insert_layer (image_ID, read_layer_ID, 0, -1);
+    }
+  /* the layer keeps its mask until the carver data is ready */
+  if (gimp_layer_get_mask (read_layer_ID) != -1)
+    {
+      gimp_layer_remove_mask (read_layer_ID, mask_behavior);
+    }
+  gimp_drawable_offsets (read_layer_ID, &l_x_off, &l_y_off);
+  rgb_buffer = rgb_buffer_from_layer_area (read_layer_ID, x_off - l_x_off, y_off - l_y_off,
+                                           width, height);
+  if (read_layer_ID != layer_ID)
+    {
+      prescaled_remove (image_ID, read_layer_ID);
+    }
+  MEM_CHECK_N (rgb_buffer);
+
+  aux_carver = lqr_carver_new (rgb_buffer, width, height, drawable_channels (layer_ID));
+  if (aux_carver == NULL)
+    {
+      pixel_buffer_free (rgb_buffer);
+      g_message (_("Not enough memory"));
+      return NULL;
+    }
+  PRESERVE_MAPPED (aux_carver, rgb_buffer);
+
+  return aux_carver;
+}
+
+/* Pushes the resize of each independent layer to a pool of workers,
+ * or returns with *pool_p NULL if none could be started; the jobs are
+ * then run by followers_carve_finish */
+static FollowerJob *
+followers_carve_start (PlugInVals * vals, CarverData * carver_data,
+                       gint width, gint height, gint new_width, gint new_height,
+                       GThreadPool ** pool_p)
+{
+  FollowerJob *jobs;
+  GThreadPool *pool;
+  gint n_workers;
+  gint i;
+
+  *pool_p = NULL;
+  MEM_CHECK_N (jobs = g_try_new0 (FollowerJob, carver_data->n_followers));
+
+  n_workers = vals->n_threads > 0 ? vals->n_threads : (gint) g_get_num_processors ();
+  n_workers = CLAMP (n_workers, 1, carver_data->n_followers);
+  pool = g_thread_pool_new (follower_carve, NULL, n_workers, FALSE, NULL);
+
+  for (i = 0; i < carver_data->n_followers; i++)
+    {
+      jobs[i].carver = carver_data->follower_carvers[i];
+      jobs[i].new_width = new_width;
+      jobs[i].new_height = new_height;
+      if ((vals->scaleback) && (vals->scaleback_mode == SCALEBACK_MODE_LQRBACK))
+        {
+          jobs[i].back_width = width;
+          jobs[i].back_height = height;
+        }
+      if (pool)
+        {
+          g_thread_pool_push (pool, &jobs[i], NULL);
+        }
+    }
+
+  *pool_p = pool;
+  return jobs;
+}
+
+static void
+follower_carve (gpointer data, gpointer user_data)
+{
+  FollowerJob *job = data;
+
+  job->ret = lqr_carver_resize (job->carver, job->new_width, job->new_height);
+  if ((job->ret == LQR_OK) && (job->back_width > 0))
+    {
+      job->ret = lqr_carver_flatten (job->carver);
+      if (job->ret == LQR_OK)
+        {
+          job->ret = lqr_carver_resize (job->carver, job->back_width, job->back_height);
+        }
+    }
+}
+
+/* Waits for the workers, or runs the jobs here if there are none */
+static gboolean
+followers_carve_finish (FollowerJob * jobs, gint n_jobs, GThreadPool * pool)
+{
+  gboolean ok = TRUE;
+  gint i;
+
+  if (pool)
+    {
+      g_thread_pool_free (pool, FALSE, TRUE);
+    }
+  else
+    {
+      for (i = 0; i < n_jobs; i++)
+        {
+          follower_carve (&jobs[i], NULL);
+        }
+    }
+
+  for (i = 0; i < n_jobs; i++)
+    {
+      if (jobs[i].ret != LQR_OK)
+        {
+          ok = FALSE;
+        }
+    }
+  g_free (jobs);
+
+  return ok;
+}
+
+static gboolean
+write_aux_carver (LqrCarverList ** carver_list_p, gint32 layer_ID, gint32 ref_layer_ID,
+                  gint width, gint height, LayerCommit * commit)
+{
+  LqrCarver * aux_carver;
+  LqrCarverList * carver_list = *carver_list_p;
+  if (!IS_AUX_LAYER (layer_ID))
+    {
+      return TRUE;
+    }
+  fit_aux_layer (layer_ID, ref_layer_ID, width, height);
+  aux_carver = lqr_carver_list_current (carver_list);
+  if (commit)
+    {
+      MEM_CHECK1 (write_carver_to_layer_diff (aux_carver, layer_ID, commit));
+    }
+  else
+    {
+      MEM_CHECK1 (write_carver_to_layer (aux_carver, layer_ID));
+    }
+  *carver_list_p = lqr_carver_list_next (carver_list);
+  return TRUE;
+}
+
+/* Aligns an aux layer to the output layer and queues it, together
+ * with its carver, for a pipelined write */
+static gint
+add_aux_output (LqrCarverList ** carver_list_p, gint32 layer_ID, gint32 ref_layer_ID,
+                gint width, gint height,
+                LqrCarver ** carvers, gint32 * layer_IDs, gint n_outputs)
+{
+  if (!IS_AUX_LAYER (layer_ID))
+    {
+      return n_outputs;
+    }
+  fit_aux_layer (layer_ID, ref_layer_ID, width, height);
+  carvers[n_outputs] = lqr_carver_list_current (*carver_list_p);
+  layer_IDs[n_outputs] = layer_ID;
+  *carver_list_p = lqr_carver_list_next (*carver_list_p);
+  return n_outputs + 1;
+}
+
+
+static void
+scale_layer_translated (gint32 layer_ID, gint width, gint height, gint x_off, gint y_off)
+{
+  gimp_layer_translate (layer_ID, -x_off, -y_off);
+  gimp_layer_scale (layer_ID, width, height, FALSE);
+  gimp_layer_translate (layer_ID, x_off, y_off);
+}
+
+/* Scales the output layer (and the aux layers) back after carving,
+ * to the original size or to the original width or height */
+static gboolean
+scale_back_std (PlugInVals * vals, gint32 image_ID, gint32 layer_ID,
+                gint old_width, gint old_height, gint new_width, gint new_height,
+                gint x_off, gint y_off, gint32 * followers, gint n_followers)
+{
+  gint sb_width, sb_height;
+  gint i;
+
+  switch (vals->scaleback_mode)
+    {
+      case SCALEBACK_MODE_STD:
+        sb_width = old_width;
+        sb_height = old_height;
+        break;
+      case SCALEBACK_MODE_STDW:
+        sb_width = old_width;
+        sb_height = (int) ((double) new_height * old_width / new_width);
+        break;
+      case SCALEBACK_MODE_STDH:
+        sb_width = (int) ((double) new_width * old_height / new_height);
+        sb_height = old_height;
+        break;
+      default:
+        g_message ("error: unknown mode");
+        return FALSE;
+    }
+
+  if (vals->resize_canvas == TRUE)
+    {
+      gimp_image_resize (image_ID, sb_width, sb_height, 0, 0);
+      gimp_layer_scale (layer_ID, sb_width, sb_height, FALSE);
+    }
+  else
+    {
+      scale_layer_translated (layer_ID, sb_width, sb_height, x_off, y_off);
+    }
+  if (vals->resize_aux_layers == TRUE)
+    {
+      if (IS_AUX_LAYER (vals->pres_layer_ID))
+        {
+          scale_layer_translated (vals->pres_layer_ID, sb_width, sb_height, x_off, y_off);
+        }
+      if (IS_AUX_LAYER (vals->disc_layer_ID))
+        {
+          scale_layer_translated (vals->disc_layer_ID, sb_width, sb_height, x_off, y_off);
+        }
+      if (IS_AUX_LAYER (vals->rigmask_layer_ID))
+        {
+          scale_layer_translated (vals->rigmask_layer_ID, sb_width, sb_height, x_off, y_off);
+        }
+    }
+  for (i = 0; i < n_followers; i++)
+    {
+      scale_layer_translated (followers[i], sb_width, sb_height, x_off, y_off);
+    }
 
-  IMAGE_CHECK (image_ID, FALSE);
+  return TRUE;
+}
 
-  LAYER_CHECK (layer_ID, FALSE);
-  LAYER_CHECK0 (vals->pres_layer_ID, FALSE);
-  LAYER_CHECK0 (vals->disc_layer_ID, FALSE);
-  LAYER_CHECK0 (vals->rigmask_layer_ID, FALSE);
+/* The selection is cleared before rendering, so if it is used as a
+ * mask it is saved to a channel first, which is used instead */
+static void
+selection_to_aux_channel (gint32 image_ID, PlugInVals * vals)
+{
+  gint32 selection_ID;
+  gint32 channel_ID;
 
-  IMAGE_TYPE_CHECK (image_ID, carver_data->base_type);
-  BPP_CHECK (layer_ID, carver);
-  if (vals->resize_aux_layers == TRUE)
+  selection_ID = gimp_image_get_selection (image_ID);
+  if ((vals->pres_layer_ID != selection_ID) &&
+      (vals->disc_layer_ID != selection_ID) &&
+      (vals->rigmask_layer_ID != selection_ID))
     {
-      carver_list = lqr_carver_list_start (carver);
-      MEM_CHECK2 (check_aux_layer_bpp (&carver_list, vals->pres_layer_ID));
-      MEM_CHECK2 (check_aux_layer_bpp (&carver_list, vals->disc_layer_ID));
-      MEM_CHECK2 (check_aux_layer_bpp (&carver_list, vals->rigmask_layer_ID));
+      return;
     }
 
-  UNFLOAT (layer_ID);
-  SELECTION_SAVE (image_ID);
-  UNMASK (layer_ID);
+  channel_ID = gimp_selection_save (image_ID);
+  gimp_selection_none (image_ID);
+  gimp_image_unset_active_channel (image_ID);
 
-  g_snprintf (layer_name, LQR_MAX_NAME_LENGTH, "%s",
-            gimp_drawable_get_name (layer_ID));
+  if (vals->pres_layer_ID == selection_ID)
+    {
+      vals->pres_layer_ID = channel_ID;
+    }
+  if (vals->disc_layer_ID == selection_ID)
+    {
+      vals->disc_layer_ID = channel_ID;
+    }
+  if (vals->rigmask_layer_ID == selection_ID)
+    {
+      vals->rigmask_layer_ID = channel_ID;
+    }
+}
 
-  old_width = gimp_drawable_width (layer_ID);
-  old_height = gimp_drawable_height (layer_ID);
-  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+static gpointer
+lqr_backend_new (guchar * rgb_buffer, gint width, gint height, gint bpp, gint n_threads)
+{
+  LqrCarver *carver;
 
-  new_width = vals->new_width;
-  new_height = vals->new_height;
+  LQR_TRY_N_N (carver = lqr_carver_new (rgb_buffer, width, height, bpp));
+  lqr_carver_set_preserve_input_image (carver);
 
-  gimp_layer_set_lock_alpha (layer_ID, FALSE);
+  return carver;
+}
 
-  if (vals->resize_aux_layers == TRUE)
+static LqrRetVal
+lqr_backend_init (gpointer carver, gint delta_x, gfloat rigidity, gint nrg_func)
+{
+  CATCH (lqr_carver_init (carver, delta_x, rigidity));
+
+  return energy_set_function (carver, nrg_func);
+}
+
+static LqrRetVal
+lqr_backend_bias_add (gpointer carver, gdouble * buffer)
+{
+  return lqr_carver_bias_add (carver, buffer, 1);
+}
+
+static LqrRetVal
+lqr_backend_rigmask_add (gpointer carver, guchar * rgb, gint channels,
+                         gint width, gint height, gint x_off, gint y_off)
+{
+  return lqr_carver_rigmask_add_rgb_area (carver, rgb, channels,
+                                          width, height, x_off, y_off);
+}
+
+/* liblqr computes the energy by itself */
+static void
+lqr_backend_energy_cache (gpointer carver, const gchar * key, guint64 max_bytes)
+{
+}
+
+static LqrRetVal
+lqr_backend_resize (gpointer carver, gint width, gint height)
+{
+  return lqr_carver_resize (carver, width, height);
+}
+
+static LqrVMap *
+lqr_backend_vmap (gpointer carver)
+{
+  return lqr_vmap_dump (carver);
+}
+
+static void
+lqr_backend_destroy (gpointer carver)
+{
+  lqr_carver_destroy (carver);
+}
+
+static const CarveBackend *
+carve_backend_get (PlugInVals * vals)
+{
+  switch (vals->backend)
     {
-      resize_unlock_aux_layer (vals->pres_layer_ID, old_width, old_height, x_off, y_off);
-      resize_unlock_aux_layer (vals->disc_layer_ID, old_width, old_height, x_off, y_off);
-      resize_unlock_aux_layer (vals->rigmask_layer_ID, old_width, old_height, x_off, y_off);
+    case CARVE_BACKEND_THREADS:
+      return &engine_threads_backend;
+    default:
+      return &lqr_backend;
     }
+}
 
-#ifdef __CLOCK_IT__
-  clock1 = (double) clock () / CLOCKS_PER_SEC;
-#endif /* __CLOCK_IT__ */
+/* Searches for the seams of a resize to new_width x new_height with
+ * a backend, masks included; the visibility map is to be loaded
+ * into the liblqr carver. With the digest of the layer contents, the
+ * energy goes through the energy cache */
+static LqrVMap *
+backend_vmap_new (const CarveBackend * backend, PlugInVals * vals,
+                  guchar * rgb_buffer, gint width, gint height, gint bpp,
+                  gint x_off, gint y_off, gfloat rigidity,
+                  gboolean ignore_disc_mask, gint new_width, gint new_height,
+                  const gchar * digest, AuxLayerCache * cache)
+{
+  gpointer carver;
+  LqrVMap *vmap = NULL;
+  gchar *nrg_key;
 
-  MEM_CHECK1 (lqr_carver_resize (carver, new_width, new_height));
+  LQR_TRY_N_N (carver = backend->carver_new (rgb_buffer, width, height, bpp, vals->n_threads));
 
-  if (vals->resize_canvas == TRUE)
+  if (digest)
     {
-      gimp_image_resize (image_ID, new_width, new_height, -x_off, -y_off);
-      gimp_layer_resize_to_image_size (layer_ID);
+      nrg_key = energy_cache_key (digest, width, height, bpp, vals->nrg_func);
+      backend->energy_cache (carver, nrg_key, (guint64) vals->energy_cache << 20);
+      g_free (nrg_key);
     }
-  else
+
+  if ((backend->init (carver, vals->delta_x, rigidity, vals->nrg_func) == LQR_OK) &&
+      (update_bias (backend, carver, width, height,
+                    vals->pres_layer_ID, vals->pres_coeff,
+                    ignore_disc_mask ? 0 : vals->disc_layer_ID, -vals->disc_coeff,
+                    x_off, y_off, cache) == LQR_OK) &&
+      (set_rigmask (backend, carver, vals->rigmask_layer_ID, x_off, y_off, cache) == LQR_OK) &&
+      (backend->resize (carver, new_width, new_height) == LQR_OK))
     {
-      gimp_layer_resize (layer_ID, new_width, new_height, 0, 0);
+      vmap = backend->vmap (carver);
     }
+  backend->destroy (carver);
 
-#ifdef __CLOCK_IT__
-  clock2 = (double) clock () / CLOCKS_PER_SEC;
-  printf ("[ resized: %g ]\n", clock2 - clock1);
-  fflush (stdout);
-#endif /* __CLOCK_IT__ */
+  return vmap;
+}
 
-  carver_data->ref_w = lqr_carver_get_ref_width (carver);
-  carver_data->ref_h = lqr_carver_get_ref_height (carver);
-  carver_data->orientation = lqr_carver_get_orientation (carver);
-  carver_data->depth = lqr_carver_get_depth (carver);
-  carver_data->enl_step = lqr_carver_get_enl_step (carver);
+/* A visibility map covers the seams along one direction only, and
+ * liblqr can not search for more seams after loading one, so maps
+ * are used for shrinks along one direction which are not scaled back
+ * by liquid rescale; returns the number of seams needed, or 0 */
+static gint
+vmap_shrink_reach (PlugInVals * vals, gint old_width, gint old_height,
+                   gint new_width, gint new_height, gint * orientation)
+{
+  if ((vals->scaleback) && (vals->scaleback_mode == SCALEBACK_MODE_LQRBACK))
+    {
+      return 0;
+    }
+  if ((new_height == old_height) && (new_width < old_width))
+    {
+      *orientation = 0;
+      return old_width - new_width;
+    }
+  if ((new_width == old_width) && (new_height < old_height))
+    {
+      *orientation = 1;
+      return old_height - new_height;
+    }
+  return 0;
+}
 
-  set_tiles (new_width);
+/* The seam map cache and the proxy mode leave out the seams output
+ * as well */
+static gint
+vmap_cache_reach (PlugInVals * vals, gint old_width, gint old_height,
+                  gint new_width, gint new_height, gint * orientation)
+{
+  if ((vals->output_seams) || (vals->seams_file[0] != '\0'))
+    {
+      return 0;
+    }
+  return vmap_shrink_reach (vals, old_width, old_height, new_width, new_height, orientation);
+}
 
-  MEM_CHECK1 (write_carver_to_layer (carver, layer_ID));
+/* Hashed once, for both the seam map and the energy caches */
+static gchar *
+content_digest (guchar * rgb_buffer, gint width, gint height, gint bpp)
+{
+  return g_compute_checksum_for_data (G_CHECKSUM_SHA256, rgb_buffer,
+                                      (gsize) width * height * bpp);
+}
 
-  if (vals->resize_aux_layers)
+/* Everything the seams depend upon: the digest of the layer
+ * contents, the masks and the carver settings */
+static gchar *
+vmap_cache_key (PlugInVals * vals, const gchar * digest, gint width, gint height,
+                gint bpp, gfloat rigidity, gboolean ignore_disc_mask,
+                gint proxy_factor, const CarveBackend * backend,
+                gint x_off, gint y_off, AuxLayerCache * cache)
+{
+  GChecksum *sum;
+  gint32 params[9];
+  gchar *key;
+
+  params[0] = width;
+  params[1] = height;
+  params[2] = bpp;
+  params[3] = vals->delta_x;
+  params[4] = vals->nrg_func;
+  params[5] = vals->res_order;
+  params[6] = vals->pres_coeff;
+  params[7] = ignore_disc_mask ? 0 : vals->disc_coeff;
+  params[8] = proxy_factor;
+
+  sum = g_checksum_new (G_CHECKSUM_SHA256);
+  g_checksum_update (sum, (const guchar *) params, sizeof (params));
+  g_checksum_update (sum, (const guchar *) &rigidity, sizeof (rigidity));
+  if (backend != &lqr_backend)
     {
-      carver_list = lqr_carver_list_start (carver);
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->pres_layer_ID, new_width, new_height));
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->disc_layer_ID, new_width, new_height));
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->rigmask_layer_ID, new_width, new_height));
+      g_checksum_update (sum, (const guchar *) backend->name, -1);
     }
+  g_checksum_update (sum, (const guchar *) digest, -1);
+  checksum_mask (sum, vals->pres_layer_ID, x_off, y_off, cache);
+  checksum_mask (sum, ignore_disc_mask ? 0 : vals->disc_layer_ID, x_off, y_off, cache);
+  checksum_mask (sum, vals->rigmask_layer_ID, x_off, y_off, cache);
 
-#ifdef __CLOCK_IT__
-  clock3 = (double) clock () / CLOCKS_PER_SEC;
-  printf ("[ finish: %g ]\n\n", clock3 - clock2);
-#endif /* __CLOCK_IT__ */
+  key = g_strdup (g_checksum_get_string (sum));
+  g_checksum_free (sum);
 
-  gimp_drawable_set_visible (layer_ID, TRUE);
-  gimp_image_set_active_layer (image_ID, layer_ID);
+  return key;
+}
 
-  return TRUE;
+/* Orders the sizes by first extent, and by second extent within the
+ * same first extent (insertion sort, the lists are short) */
+static void
+sort_sizes (gint * sizes, gint n_sizes, gint res_order, gint * order)
+{
+  gint i, j, tmp;
+
+  for (i = 0; i < n_sizes; i++)
+    {
+      order[i] = i;
+    }
+  for (i = 1; i < n_sizes; i++)
+    {
+      tmp = order[i];
+      for (j = i; j > 0; j--)
+        {
+          if ((SIZE_FIRST (sizes, order[j - 1], res_order) <
+               SIZE_FIRST (sizes, tmp, res_order)) ||
+              ((SIZE_FIRST (sizes, order[j - 1], res_order) ==
+                SIZE_FIRST (sizes, tmp, res_order)) &&
+               (SIZE_SECOND (sizes, order[j - 1], res_order) <=
+                SIZE_SECOND (sizes, tmp, res_order))))
+            {
+              break;
+            }
+          order[j] = order[j - 1];
+        }
+      order[j] = tmp;
+    }
 }
 
-gboolean
-render_flatten (PlugInVals * vals,
-        CarverData * carver_data)
+/* A carver on a shared buffer, which is freed by the caller */
+static LqrCarver *
+multi_carver_new (PlugInVals * vals, gint32 layer_ID, guchar * rgb_buffer,
+                  gint width, gint height, gint bpp, gint x_off, gint y_off,
+                  gboolean ignore_disc_mask, LqrProgress * progress)
 {
   LqrCarver *carver;
-  LqrCarverList *carver_list;
-  gint32 image_ID;
-  gint32 layer_ID;
-  gchar layer_name[LQR_MAX_NAME_LENGTH];
-  gint old_width, old_height;
-  gint x_off, y_off;
-#ifdef __CLOCK_IT__
-  double clock1, clock2, clock3;
-#endif /* __CLOCK_IT__ */
 
-  carver = carver_data->carver;
-  image_ID = carver_data->image_ID;
-  layer_ID = carver_data->layer_ID;
+  carver = lqr_carver_new (rgb_buffer, width, height, bpp);
+  MEM_CHECK_N (carver);
+  lqr_carver_set_preserve_input_image (carver);
 
-  IMAGE_CHECK (image_ID, FALSE);
+  return carver_setup (vals, carver, rigidity_init (vals), x_off, y_off, ignore_disc_mask,
+                       NULL, progress);
+}
 
-  LAYER_CHECK (layer_ID, FALSE);
-  LAYER_CHECK0 (vals->pres_layer_ID, FALSE);
-  LAYER_CHECK0 (vals->disc_layer_ID, FALSE);
-  LAYER_CHECK0 (vals->rigmask_layer_ID, FALSE);
+/* Initializes a carver which searches for its own seams, with the
+ * masks aligned to x_off and y_off */
+static LqrCarver *
+carver_setup (PlugInVals * vals, LqrCarver * carver, gfloat rigidity,
+              gint x_off, gint y_off, gboolean ignore_disc_mask,
+              AuxLayerCache * cache, LqrProgress * progress)
+{
+  MEM_CHECK1_N (lqr_carver_init (carver, vals->delta_x, rigidity));
+  MEM_CHECK1_N (update_bias (&lqr_backend, carver,
+                             lqr_carver_get_width (carver), lqr_carver_get_height (carver),
+                             vals->pres_layer_ID, vals->pres_coeff,
+                             ignore_disc_mask ? 0 : vals->disc_layer_ID, -vals->disc_coeff,
+                             x_off, y_off, cache));
+  MEM_CHECK1_N (set_rigmask (&lqr_backend, carver, vals->rigmask_layer_ID,
+                             x_off, y_off, cache));
+  energy_set_function (carver, vals->nrg_func);
+  lqr_carver_set_resize_order (carver, vals->res_order);
+  lqr_carver_set_progress (carver, progress);
+  lqr_carver_set_side_switch_frequency (carver, 2);
+  lqr_carver_set_enl_step (carver, vals->enl_step / 100);
 
-  IMAGE_TYPE_CHECK (image_ID, carver_data->base_type);
-  BPP_CHECK (layer_ID, carver);
-  if (vals->resize_aux_layers == TRUE)
+  return carver;
+}
+
+/* The target of one of the sizes: a hidden layer above the original
+ * one, or the single layer of a new image, whose undo group is left
+ * open until all the sizes are written */
+static gint32
+multi_output_layer (gint32 image_ID, gint32 layer_ID, PlugInVals * vals,
+                    gint width, gint height, gint x_off, gint y_off)
+{
+  gchar name[LQR_MAX_NAME_LENGTH];
+  gint32 out_image_ID;
+  gint32 out_layer_ID;
+
+  if (vals->output_target == OUTPUT_TARGET_NEW_IMAGE)
     {
-      carver_list = lqr_carver_list_start (carver);
-      MEM_CHECK2 (check_aux_layer_bpp (&carver_list, vals->pres_layer_ID));
-      MEM_CHECK2 (check_aux_layer_bpp (&carver_list, vals->disc_layer_ID));
-      MEM_CHECK2 (check_aux_layer_bpp (&carver_list, vals->rigmask_layer_ID));
+      out_image_ID = gimp_image_new (width, height, gimp_image_base_type (image_ID));
+      gimp_image_undo_group_start (out_image_ID);
+      out_layer_ID = new_target_layer (out_image_ID, layer_ID, gimp_drawable_get_name (layer_ID),
+                                       width, height, 0, 0);
+      gimp_drawable_set_visible (out_layer_ID, TRUE);
+    }
+  else
+    {
+      g_snprintf (name, LQR_MAX_NAME_LENGTH, "%s LqR %dx%d",
+                  gimp_drawable_get_name (layer_ID), width, height);
+      out_layer_ID = new_target_layer (image_ID, layer_ID, name,
+                                       width, height, x_off, y_off);
+      gimp_drawable_set_visible (out_layer_ID, FALSE);
     }
 
-  UNFLOAT (layer_ID);
-  SELECTION_SAVE (image_ID);
-  UNMASK (layer_ID);
-
-  g_snprintf (layer_name, LQR_MAX_NAME_LENGTH, "%s",
-            gimp_drawable_get_name (layer_ID));
+  gimp_layer_set_lock_alpha (out_layer_ID, FALSE);
 
-  old_width = gimp_drawable_width (layer_ID);
-  old_height = gimp_drawable_height (layer_ID);
-  gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+  return out_layer_ID;
+}
 
-  gimp_layer_set_lock_alpha (layer_ID, FALSE);
+/* A rough figure of what liblqr takes to carve the layer at full
+ * size, aux layers attached to the carver included */
+static guint64
+carver_memory_estimate (PlugInVals * vals, gint width, gint height, gint bpp,
+                        guint64 follower_bytes)
+{
+  guint64 area;
+  guint64 size;
 
-  if (vals->resize_aux_layers == TRUE)
+  area = (guint64) width * height;
+  size = area * (bpp + CARVER_PIXEL_BYTES);
+  if (vals->resize_aux_layers)
     {
-      resize_unlock_aux_layer (vals->pres_layer_ID, old_width, old_height, x_off, y_off);
-      resize_unlock_aux_layer (vals->disc_layer_ID, old_width, old_height, x_off, y_off);
-      resize_unlock_aux_layer (vals->rigmask_layer_ID, old_width, old_height, x_off, y_off);
+      if (IS_AUX_LAYER (vals->pres_layer_ID))
+        {
+          size += area * (drawable_channels (vals->pres_layer_ID) + CARVER_PIXEL_BYTES);
+        }
+      if (IS_AUX_LAYER (vals->disc_layer_ID))
+        {
+          size += area * (drawable_channels (vals->disc_layer_ID) + CARVER_PIXEL_BYTES);
+        }
+      if (IS_AUX_LAYER (vals->rigmask_layer_ID))
+        {
+          size += area * (drawable_channels (vals->rigmask_layer_ID) + CARVER_PIXEL_BYTES);
+        }
     }
+  size += area * follower_bytes;
+
+  return size;
+}
 
+/* Picks the most demanding plan which fits within the memory limit,
+ * and reports it */
+static CarvePlan
+carve_plan_choose (PlugInVals * vals, gint old_width, gint old_height,
+                   gint new_width, gint new_height, gint bpp, guint64 follower_bytes)
+{
 #ifdef __CLOCK_IT__
-  clock1 = (double) clock () / CLOCKS_PER_SEC;
+  static const gchar *plan_names[] = {
+    "full", "no read cache", "no read cache, seams dropped", "strips", "refused"
+  };
 #endif /* __CLOCK_IT__ */
+  CarvePlan plan;
+  guint64 limit;
+  guint64 area;
+  guint64 carver_size;
+  guint64 cache_size;
+  guint64 seams_size = 0;
+  gint width, height;
+
+  limit = (guint64) vals->memory_limit << 20;
+
+  /* enlarging grows the carver to the new size */
+  width = MAX (old_width, new_width);
+  height = MAX (old_height, new_height);
+  area = (guint64) width * height;
+
+  carver_size = carver_memory_estimate (vals, width, height, bpp, follower_bytes);
+  cache_size = area * CARVER_CACHE_PIXEL_BYTES;
+  if ((vals->output_seams) || (vals->seams_file[0] != '\0'))
+    {
+      /* a map for each direction, and the layer showing it */
+      seams_size = area * ((old_width != new_width) + (old_height != new_height)) *
+        (sizeof (gint) + (vals->output_seams ? 4 : 0));
+    }
 
-  MEM_CHECK1 (lqr_carver_flatten (carver));
-
-  if (vals->resize_canvas == TRUE)
+  if (carver_size + cache_size + seams_size <= limit)
     {
-      gimp_image_resize (image_ID, old_width, old_height, -x_off, -y_off);
-      gimp_layer_resize_to_image_size (layer_ID);
+      plan = CARVE_PLAN_FULL;
+    }
+  else if (carver_size + seams_size <= limit)
+    {
+      plan = CARVE_PLAN_NO_CACHE;
+    }
+  else if (carver_size <= limit)
+    {
+      plan = CARVE_PLAN_NO_SEAMS;
+    }
+  else if (strips_allowed (vals, old_width, old_height, new_width, new_height, follower_bytes))
+    {
+      plan = CARVE_PLAN_STRIPS;
     }
   else
     {
-      gimp_layer_resize (layer_ID, old_width, old_height, 0, 0);
+      plan = CARVE_PLAN_REFUSE;
     }
 
 #ifdef __CLOCK_IT__
-  clock2 = (double) clock () / CLOCKS_PER_SEC;
-  printf ("[ flattened: %g ]\n", clock2 - clock1);
+  printf ("[ memory plan: %s, about %" G_GUINT64_FORMAT " MiB needed at full size ]\n",
+          plan_names[plan], (carver_size + cache_size + seams_size) >> 20);
   fflush (stdout);
 #endif /* __CLOCK_IT__ */
 
-  carver_data->ref_w = lqr_carver_get_ref_width (carver);
-  carver_data->ref_h = lqr_carver_get_ref_height (carver);
-  carver_data->orientation = lqr_carver_get_orientation (carver);
-  carver_data->depth = lqr_carver_get_depth (carver);
-  carver_data->enl_step = lqr_carver_get_enl_step (carver);
+  if (plan == CARVE_PLAN_REFUSE)
+    {
+      g_message (_("Error: this operation needs about %d MiB, more than the memory limit of %d MiB"),
+                 (gint) ((carver_size + seams_size + (1 << 20) - 1) >> 20), vals->memory_limit);
+    }
+  else if (plan == CARVE_PLAN_NO_CACHE)
+    {
+      g_message (_("Warning: the read cache is turned off, to stay within the memory limit"));
+    }
+  else
+    {
+      if (plan == CARVE_PLAN_STRIPS)
+        {
+          g_message (_("Warning: the layer is resized in strips on a coarser proxy, "
+                       "to stay within the memory limit"));
+        }
+      if ((plan >= CARVE_PLAN_NO_SEAMS) && (seams_size > 0))
+        {
+          g_message (_("Warning: the seams are not output, to stay within the memory limit"));
+        }
+    }
+
+  return plan;
+}
+
+/* Strip carving only shrinks the selected layer, and never keeps
+ * the seams */
+static gboolean
+strips_allowed (PlugInVals * vals, gint old_width, gint old_height,
+                gint new_width, gint new_height, guint64 follower_bytes)
+{
+  if ((new_width > old_width) || (new_height > old_height) || (follower_bytes > 0))
+    {
+      return FALSE;
+    }
+  if ((vals->scaleback) && (vals->scaleback_mode == SCALEBACK_MODE_LQRBACK))
+    {
+      return FALSE;
+    }
+  if ((vals->resize_aux_layers) &&
+      (IS_AUX_LAYER (vals->pres_layer_ID) || IS_AUX_LAYER (vals->disc_layer_ID) ||
+       IS_AUX_LAYER (vals->rigmask_layer_ID)))
+    {
+      return FALSE;
+    }
+  return TRUE;
+}
 
-  set_tiles (old_width);
+/* Strip carving works in place, so the new targets are copies of
+ * the layer rather than empty layers */
+static CarverData *
+strips_init (PlugInVals * vals, gint32 image_ID, gint32 layer_ID,
+             const gchar * layer_name, gboolean alpha_lock)
+{
+  CarverData *carver_data;
+  gchar new_layer_name[LQR_MAX_NAME_LENGTH];
+  gint32 src_layer_ID;
+  gint width, height;
+  gint x_off, y_off;
 
-  MEM_CHECK1 (write_carver_to_layer (carver, layer_ID));
+  src_layer_ID = layer_ID;
+  width = gimp_drawable_width (src_layer_ID);
+  height = gimp_drawable_height (src_layer_ID);
+  gimp_drawable_offsets (src_layer_ID, &x_off, &y_off);
 
-  if (vals->resize_aux_layers)
+  if (vals->output_target == OUTPUT_TARGET_NEW_LAYER)
     {
-      carver_list = lqr_carver_list_start (carver);
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->pres_layer_ID, old_width, old_height));
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->disc_layer_ID, old_width, old_height));
-      MEM_CHECK2 (write_aux_carver (&carver_list, vals->rigmask_layer_ID, old_width, old_height));
+      g_snprintf (new_layer_name, LQR_MAX_NAME_LENGTH, "%s LqR", layer_name);
+      layer_ID = gimp_layer_copy (src_layer_ID);
+      gimp_image_insert_layer (image_ID, layer_ID, 0, -1);
+      gimp_drawable_set_name (layer_ID, new_layer_name);
+      gimp_drawable_set_visible (layer_ID, FALSE);
+    }
+  else if (vals->output_target == OUTPUT_TARGET_NEW_IMAGE)
+    {
+      image_ID = gimp_image_new (width, height, gimp_image_base_type (image_ID));
+      gimp_image_undo_group_start (image_ID);
+      layer_ID = gimp_layer_new_from_drawable (src_layer_ID, image_ID);
+      gimp_image_insert_layer (image_ID, layer_ID, 0, -1);
+      gimp_drawable_set_name (layer_ID, layer_name);
+      gimp_layer_set_offsets (layer_ID, 0, 0);
+      gimp_drawable_set_visible (layer_ID, TRUE);
+      gimp_image_undo_group_end (image_ID);
     }
 
-#ifdef __CLOCK_IT__
-  clock3 = (double) clock () / CLOCKS_PER_SEC;
-  printf ("[ finish: %g ]\n\n", clock3 - clock2);
-#endif /* __CLOCK_IT__ */
+  gimp_layer_set_lock_alpha (layer_ID, FALSE);
 
-  gimp_drawable_set_visible (layer_ID, TRUE);
-  gimp_image_set_active_layer (image_ID, layer_ID);
+  MEM_CHECK_N (carver_data = calloc (1, sizeof (CarverData)));
 
-  return TRUE;
+  carver_data->carver = NULL;
+  carver_data->image_ID = image_ID;
+  carver_data->layer_ID = layer_ID;
+  carver_data->base_type = gimp_image_base_type (image_ID);
+  carver_data->alpha_lock = alpha_lock;
+  carver_data->ref_w = width;
+  carver_data->ref_h = height;
+  carver_data->x_off = x_off;
+  carver_data->y_off = y_off;
+  carver_data->enl_step = vals->enl_step / 100;
+
+  return carver_data;
 }
 
-gboolean
-render_dump_vmap (PlugInVals * vals,
-        PlugInColVals * col_vals,
-        CarverData * carver_data,
-        gint32 * vmap_layer_ID_p)
+/* Carves the target layer in strips, one direction at a time; the
+ * masks only steer the first one, since the layer no longer lines
+ * up with them afterwards */
+static gboolean
+render_strips (PlugInVals * vals, CarverData * carver_data)
 {
-  LqrCarver *carver;
-  LqrVMap *vmap;
-  VMapFuncArg vmap_data;
+  PlugInVals strip_vals;
+  LqrProgress *progress;
   gint32 image_ID;
   gint32 layer_ID;
-  gchar layer_name[LQR_MAX_NAME_LENGTH];
-  gchar vmap_name[LQR_MAX_NAME_LENGTH];
+  gint old_width, old_height;
+  gint new_width, new_height;
   gint x_off, y_off;
-  GimpRGB colour_start, colour_end;
-#ifdef __CLOCK_IT__
-  double clock1, clock2, clock3;
-#endif /* __CLOCK_IT__ */
+  gint reach[2];
+  gint k, orientation;
+  gboolean ignore_disc_mask;
 
-  carver = carver_data->carver;
   image_ID = carver_data->image_ID;
   layer_ID = carver_data->layer_ID;
+  old_width = carver_data->ref_w;
+  old_height = carver_data->ref_h;
+  new_width = vals->new_width;
+  new_height = vals->new_height;
+  reach[0] = old_width - new_width;
+  reach[1] = old_height - new_height;
 
-  IMAGE_CHECK (image_ID, FALSE);
-
-  LAYER_CHECK (layer_ID, FALSE);
-
-  IMAGE_TYPE_CHECK (image_ID, carver_data->base_type);
+  ignore_disc_mask = compute_ignore_disc_mask (vals, old_width, old_height, new_width, new_height);
 
-  UNFLOAT (layer_ID);
-  SELECTION_SAVE (image_ID);
-  UNMASK (layer_ID);
+  progress = progress_init();
+  MEM_CHECK (progress);
 
-  g_snprintf (layer_name, LQR_MAX_NAME_LENGTH, "%s",
-            gimp_drawable_get_name (layer_ID));
+  strip_vals = *vals;
+  for (k = 0; k < 2; k++)
+    {
+      orientation = (vals->res_order == LQR_RES_ORDER_HOR) ? k : 1 - k;
+      if (reach[orientation] == 0)
+        {
+          continue;
+        }
+      set_tiles (gimp_drawable_width (layer_ID));
+      if (!strips_shrink_layer (&strip_vals, layer_ID, carver_data->x_off, carver_data->y_off,
+                                orientation, reach[orientation], rigidity_init (&strip_vals),
+                                ignore_disc_mask, (guint64) vals->memory_limit << 20,
+                                progress))
+        {
+          return FALSE;
+        }
+      strip_vals.pres_layer_ID = 0;
+      strip_vals.disc_layer_ID = 0;
+      strip_vals.rigmask_layer_ID = 0;
+    }
 
   gimp_drawable_offsets (layer_ID, &x_off, &y_off);
+  if (vals->resize_canvas)
+    {
+      gimp_image_resize (image_ID, new_width, new_height, -x_off, -y_off);
+      gimp_layer_resize_to_image_size (layer_ID);
+    }
 
-#ifdef __CLOCK_IT__
-  clock1 = (double) clock () / CLOCKS_PER_SEC;
-#endif /* __CLOCK_IT__ */
-
-  vmap = lqr_vmap_dump (carver);
-  MEM_CHECK (vmap);
-
-  g_snprintf (vmap_name, LQR_MAX_NAME_LENGTH, _("%s seam map"), layer_name);
-
-#ifdef __CLOCK_IT__
-  clock2 = (double) clock () / CLOCKS_PER_SEC;
-  printf ("[ dumped: %g ]\n", clock2 - clock1);
-  fflush (stdout);
-#endif /* __CLOCK_IT__ */
-
-  gimp_rgba_set (&colour_start, col_vals->r1, col_vals->g1, col_vals->b1, 1);
-  gimp_rgba_set (&colour_end, col_vals->r2, col_vals->g2, col_vals->b2, 1);
-
-  vmap_data.image_ID = image_ID;
-  vmap_data.name = vmap_name;
-  vmap_data.x_off = x_off;
-  vmap_data.y_off = y_off;
-  vmap_data.colour_start = colour_start;
-  vmap_data.colour_end = colour_end;
-  vmap_data.vmap_layer_ID_p = vmap_layer_ID_p;
-
-  set_tiles (lqr_vmap_get_width(vmap));
-
-  MEM_CHECK1 (write_vmap_to_layer (vmap, (gpointer) (&vmap_data)));
-
-#ifdef __CLOCK_IT__
-  clock3 = (double) clock () / CLOCKS_PER_SEC;
-  printf ("[ finish: %g ]\n\n", clock3 - clock2);
-#endif /* __CLOCK_IT__ */
+  if ((vals->scaleback) &&
+      !scale_back_std (vals, image_ID, layer_ID, old_width, old_height,
+                       new_width, new_height, x_off, y_off, NULL, 0))
+    {
+      return FALSE;
+    }
 
+  gimp_drawable_set_visible (layer_ID, TRUE);
   gimp_image_set_active_layer (image_ID, layer_ID);
+  gimp_layer_set_lock_alpha (layer_ID, carver_data->alpha_lock);
 
   return TRUE;
 }
 
-static gboolean
-my_progress_end (const gchar * message)
+/* The uniform scaling applied before carving, for resizes which
+ * shrink or grow both sides: in auto mode, enough to leave at most
+ * PRESCALE_AUTO_CHANGE of relative change to carve along either
+ * side. It never goes past the new size of the side which changes
+ * least, so that carving still goes the same way as the resize. */
+static gdouble
+prescale_ratio (PlugInVals * vals, gint old_width, gint old_height,
+                gint new_width, gint new_height)
 {
-  return gimp_progress_end ();
-}
+  gdouble ratio_w, ratio_h;
+  gdouble ratio, full;
 
-static LqrProgress*
-progress_init (void)
-{
-  LqrProgress * progress = lqr_progress_new ();
-  MEM_CHECK_N (progress);
-  lqr_progress_set_init (progress, (LqrProgressFuncInit) gimp_progress_init);
-  lqr_progress_set_update (progress, (LqrProgressFuncUpdate) gimp_progress_update);
-  lqr_progress_set_end (progress, (LqrProgressFuncEnd) my_progress_end);
-  lqr_progress_set_init_width_message (progress, _("Resizing width..."));
-  lqr_progress_set_init_height_message (progress,
-                                        _("Resizing height..."));
-  return progress;
-}
+  if ((vals->prescale_mode == PRESCALE_MODE_NONE) || (vals->scaleback) ||
+      !prescale_full_ratio (old_width, old_height, new_width, new_height, &full))
+    {
+      return 1;
+    }
 
-static gfloat
-rigidity_init (PlugInVals * vals)
-{
-  if (vals->rigmask_layer_ID != 0)
+  ratio_w = (gdouble) new_width / old_width;
+  ratio_h = (gdouble) new_height / old_height;
+  if (vals->prescale_mode == PRESCALE_MODE_RATIO)
     {
-      return 3 * vals->rigidity;
+      ratio = vals->prescale_ratio;
+    }
+  else if (full < 1)
+    {
+      ratio = MIN (ratio_w, ratio_h) / (1 - PRESCALE_AUTO_CHANGE);
     }
   else
     {
-      return vals->rigidity;
+      ratio = MAX (ratio_w, ratio_h) / (1 + PRESCALE_AUTO_CHANGE);
     }
+
+  return CLAMP (ratio, MIN (full, 1), MAX (full, 1));
 }
 
+/* The largest prescaling possible, up to the new size of the side
+ * which changes least; FALSE if the sides do not both shrink or
+ * both grow */
 static gboolean
-compute_ignore_disc_mask (PlugInVals * vals, gint old_width, gint old_height, gint new_width, gint new_height)
+prescale_full_ratio (gint old_width, gint old_height,
+                     gint new_width, gint new_height, gdouble * full)
 {
-  if (!vals->no_disc_on_enlarge)
+  gdouble ratio_w, ratio_h;
+
+  ratio_w = (gdouble) new_width / old_width;
+  ratio_h = (gdouble) new_height / old_height;
+  if ((ratio_w - 1) * (ratio_h - 1) <= 0)
     {
       return FALSE;
     }
 
-  switch (vals->res_order)
-    {
-      case LQR_RES_ORDER_HOR:
-        if ((new_width > old_width) || ((new_width == old_width) && (new_height > old_height)))
-          {
-            return TRUE;
-          }
-        break;
-      case LQR_RES_ORDER_VERT:
-        if ((new_height > old_height) || ((new_height == old_height) && (new_width > old_width)))
-          {
-            return TRUE;
-          }
-        break;
-      default:
-        g_message ("Error: unknown resize order index");
-        abort();
-    }
-  return FALSE;
+  *full = (ratio_w < 1) ? MAX (ratio_w, ratio_h) : MIN (ratio_w, ratio_h);
+  return TRUE;
 }
 
-static void
-set_tiles (gint width)
+/* A copy of a drawable, scaled about the origin of the layer at
+ * x_off, y_off so that it stays aligned with the scaled layer */
+static gint32
+prescaled_copy (gint32 image_ID, gint32 drawable_ID,
+                gdouble ratio_x, gdouble ratio_y, gint x_off, gint y_off)
 {
-  gint ntiles = width / gimp_tile_width () + 1;
-  gimp_tile_cache_size ((gimp_tile_width () * gimp_tile_height () * ntiles *
-                         4 * 2) / 1024 + 1);
-}
+  gint32 copy_ID;
+  gint width, height;
+  gint d_x_off, d_y_off;
 
-static gboolean
-check_aux_layer_bpp (LqrCarverList ** carver_list_p, gint32 layer_ID)
-{
-  LqrCarver * aux_carver;
-  if (!layer_ID)
+  if (drawable_ID == 0)
     {
-      return TRUE;
+      return 0;
     }
-  aux_carver = lqr_carver_list_current (*carver_list_p);
-  BPP_CHECK (layer_ID, aux_carver);
-  *carver_list_p = lqr_carver_list_next (*carver_list_p);
-  return TRUE;
-}
 
-static gboolean copy_aux_layer_to_new_image (gint32 image_ID, gint32 * layer_ID_p, gint x_off, gint y_off)
-{
-  gint32 old_layer_ID;
-  gint32 new_layer_ID;
+  width = gimp_drawable_width (drawable_ID);
+  height = gimp_drawable_height (drawable_ID);
 
-  old_layer_ID = *layer_ID_p;
-  if (old_layer_ID)
+  if (gimp_drawable_is_layer (drawable_ID))
     {
-      new_layer_ID = gimp_layer_new_from_drawable (old_layer_ID, image_ID);
-      gimp_image_insert_layer (image_ID, new_layer_ID, 0, -1);
-      gimp_layer_translate (new_layer_ID, -x_off, -y_off);
+      copy_ID = gimp_layer_copy (drawable_ID);
+      gimp_image_insert_layer (image_ID, copy_ID, 0, -1);
+      scale_layer_translated (copy_ID, MAX ((gint) (width * ratio_x + 0.5), 1),
+                              MAX ((gint) (height * ratio_y + 0.5), 1), x_off, y_off);
     }
   else
     {
-      new_layer_ID = 0;
+      gimp_drawable_offsets (drawable_ID, &d_x_off, &d_y_off);
+      copy_ID = gimp_channel_copy (drawable_ID);
+      gimp_image_insert_channel (image_ID, copy_ID, 0, -1);
+      gimp_item_transform_scale (copy_ID,
+                                 x_off + (d_x_off - x_off) * ratio_x,
+                                 y_off + (d_y_off - y_off) * ratio_y,
+                                 x_off + (d_x_off + width - x_off) * ratio_x,
+                                 y_off + (d_y_off + height - y_off) * ratio_y);
     }
-  *layer_ID_p = new_layer_ID;
-  return TRUE;
+
+  return copy_ID;
 }
 
-static gboolean
-resize_unlock_aux_layer (gint32 layer_ID, gint width, gint height, gint x_off, gint y_off)
+static void
+prescaled_remove (gint32 image_ID, gint32 drawable_ID)
 {
-  gboolean alpha_lock = FALSE;
-  gint aux_x_off, aux_y_off;
-  if (layer_ID)
+  if (drawable_ID == 0)
     {
-      alpha_lock = gimp_layer_get_lock_alpha (layer_ID);
-      gimp_layer_set_lock_alpha (layer_ID, FALSE);
-      gimp_drawable_offsets (layer_ID, &aux_x_off, &aux_y_off);
-      gimp_layer_resize (layer_ID, width, height,
-                         aux_x_off - x_off, aux_y_off - y_off);
+      return;
+    }
+  if (gimp_drawable_is_layer (drawable_ID))
+    {
+      gimp_image_remove_layer (image_ID, drawable_ID);
+    }
+  else
+    {
+      gimp_image_remove_channel (image_ID, drawable_ID);
     }
-  return alpha_lock;
 }
 
-static LqrCarver*
-attach_aux_carver (LqrCarver * carver, gint32 layer_ID, gint width, gint height)
+/* Expected run time in seconds of a resize carved after prescaling
+ * by ratio, on a proxy if proxy_factor is above 1 (see proxy.c) */
+static gdouble
+deadline_estimate (gint old_width, gint old_height, gint new_width, gint new_height,
+                   gdouble ratio, gint proxy_factor, gdouble carve_ns)
 {
-  guchar *rgb_buffer;
-  LqrCarver * aux_carver;
-  gint bpp;
+  gint width, height;
+  gint seams, n_v;
+  gdouble carve_area;
+  gdouble ns;
 
-  if (layer_ID)
-    {
-      rgb_buffer = rgb_buffer_from_layer (layer_ID);
-      MEM_CHECK_N (rgb_buffer);
-      bpp = gimp_drawable_bpp (layer_ID);
-      aux_carver =
-        lqr_carver_new (rgb_buffer, width, height, bpp);
+  width = (gint) (old_width * ratio + 0.5);
+  height = (gint) (old_height * ratio + 0.5);
+  seams = ABS (width - new_width) + ABS (height - new_height);
 
-      MEM_CHECK_N (aux_carver);
-      MEM_CHECK1_N (lqr_carver_attach (carver, aux_carver));
+  /* the carver shrinks (or grows) while the seams are searched */
+  carve_area = ((width + new_width) / 2.0) * ((height + new_height) / 2.0);
+
+  ns = (gdouble) old_width * old_height * DEADLINE_IO_NS;
+  if (proxy_factor > 1)
+    {
+      /* proxies only serve resizes along one side */
+      n_v = (width != new_width) ? height : width;
+      ns += carve_area / ((gdouble) proxy_factor * proxy_factor) *
+        ((gdouble) seams / proxy_factor) * carve_ns;
+      ns += (gdouble) seams * n_v * 9.0 * proxy_factor * proxy_factor * DEADLINE_REFINE_NS;
     }
-  return carver;
+  else
+    {
+      ns += carve_area * seams * carve_ns;
+    }
+
+  return ns / 1e9;
 }
 
-static gboolean
-write_aux_carver (LqrCarverList ** carver_list_p, gint32 layer_ID, gint width, gint height)
+/* Lowers the cost of the run until it is expected to fit within
+ * vals->max_seconds: one-side shrinks are searched on a coarser proxy,
+ * resizes of both sides leave more to plain scaling; the returned
+ * DeadlineDegradation flags tell what was given up */
+static gint
+deadline_adapt (PlugInVals * vals, gint old_width, gint old_height,
+                gint new_width, gint new_height, gboolean proxy_allowed,
+                gint * proxy_factor, gdouble * ratio)
 {
-  LqrCarver * aux_carver;
-  LqrCarverList * carver_list = *carver_list_p;
-  if (!layer_ID)
+  gdouble carve_ns = DEADLINE_CARVE_NS;
+  gdouble expected;
+  gdouble full;
+  gdouble start;
+  gint degradations = 0;
+  gint k;
+
+  if (gimp_get_data_size (DEADLINE_DATA) == sizeof (carve_ns))
     {
-      return TRUE;
+      gimp_get_data (DEADLINE_DATA, &carve_ns);
+    }
+
+  expected = deadline_estimate (old_width, old_height, new_width, new_height,
+                                *ratio, *proxy_factor, carve_ns);
+  if (expected <= vals->max_seconds)
+    {
+      return 0;
+    }
+
+  if (proxy_allowed)
+    {
+      degradations |= DEADLINE_PROXY;
+      *proxy_factor = MAX (*proxy_factor, 1);
+      while ((expected > vals->max_seconds) && (*proxy_factor < DEADLINE_MAX_PROXY_FACTOR))
+        {
+          (*proxy_factor)++;
+          expected = deadline_estimate (old_width, old_height, new_width, new_height,
+                                        *ratio, *proxy_factor, carve_ns);
+        }
+    }
+  else if ((!vals->scaleback) &&
+           prescale_full_ratio (old_width, old_height, new_width, new_height, &full))
+    {
+      degradations |= DEADLINE_PRESCALE;
+      start = *ratio;
+      for (k = 1; (expected > vals->max_seconds) && (k <= DEADLINE_PRESCALE_STEPS); k++)
+        {
+          *ratio = start + (full - start) * k / DEADLINE_PRESCALE_STEPS;
+          expected = deadline_estimate (old_width, old_height, new_width, new_height,
+                                        *ratio, *proxy_factor, carve_ns);
+        }
+    }
+
+  if (expected > vals->max_seconds)
+    {
+      degradations |= DEADLINE_OVER;
     }
-  gimp_layer_resize (layer_ID, width, height, 0, 0);
-  aux_carver = lqr_carver_list_current (carver_list);
-  MEM_CHECK1 (write_carver_to_layer (aux_carver, layer_ID));
-  *carver_list_p = lqr_carver_list_next (carver_list);
-  return TRUE;
-}
 
+  return degradations;
+}
 
+/* Folds the time taken by a full-size seam search into the figure
+ * deadline_estimate works with */
 static void
-scale_layer_translated (gint32 layer_ID, gint width, gint height, gint x_off, gint y_off)
+deadline_calibrate (gint width, gint height, gint new_width, gint new_height,
+                    gdouble seconds)
 {
-  gimp_layer_translate (layer_ID, -x_off, -y_off);
-  gimp_layer_scale (layer_ID, width, height, FALSE);
-  gimp_layer_translate (layer_ID, x_off, y_off);
+  gdouble carve_ns;
+  gdouble measured;
+  gdouble work;
+
+  work = ((width + new_width) / 2.0) * ((height + new_height) / 2.0) *
+    (ABS (width - new_width) + ABS (height - new_height));
+  if (work <= 0)
+    {
+      return;
+    }
+  measured = seconds * 1e9 / work;
+
+  carve_ns = measured;
+  if (gimp_get_data_size (DEADLINE_DATA) == sizeof (carve_ns))
+    {
+      gimp_get_data (DEADLINE_DATA, &carve_ns);
+      carve_ns = (carve_ns + measured) / 2;
+    }
+  gimp_set_data (DEADLINE_DATA, &carve_ns, sizeof (carve_ns));
 }
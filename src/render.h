@@ -19,6 +19,9 @@
 #ifndef __RENDER_H__
 #define __RENDER_H__
 
+/* carver is NULL when the layer is to be carved in strips (see
+ * strips.h), straight into the target layer; ref_w, ref_h, x_off and
+ * y_off are then the size and offsets of the source layer */
 typedef struct
 {
   LqrCarver * carver;
@@ -29,15 +32,41 @@ typedef struct
   gboolean alpha_lock_pres;
   gboolean alpha_lock_disc;
   gboolean alpha_lock_rigmask;
+  gint32 *followers;            /* layers carved along, see vals->all_layers */
+  gboolean *alpha_lock_followers;
+  LqrCarver **follower_carvers; /* their own carvers, with vals->independent_layers */
+  gint n_followers;
   gint ref_w;
   gint ref_h;
+  gint x_off;
+  gint y_off;
+  gboolean no_seams;
+  gint degradations;            /* DeadlineDegradation flags */
+  gint proxy_factor;
+  gdouble prescale_ratio;
+  gboolean calibrate;
   gint orientation;
   gint depth;
   gfloat enl_step;
+  LayerCommit commit;
+  LayerCommit commit_pres;
+  LayerCommit commit_disc;
+  LayerCommit commit_rigmask;
+  gchar *vmap_key;
+  gint32 vmap_image_ID;
+  gint vmap_reach;
 } CarverData;
 
 #define CARVER_DATA(data) ((CarverData*)data)
 
+/* What was given up to finish within vals->max_seconds */
+typedef enum
+{
+  DEADLINE_PROXY = 1 << 0,      /* seams searched on a (coarser) proxy */
+  DEADLINE_PRESCALE = 1 << 1,   /* more of the resize done by plain scaling */
+  DEADLINE_OVER = 1 << 2        /* still expected to take longer */
+} DeadlineDegradation;
+
 
 /* Functions  */
 
@@ -52,6 +81,24 @@ render_noninteractive (PlugInVals * vals,
         PlugInColVals * col_vals,
         CarverData * carver_data);
 
+gboolean
+render_multi_noninteractive (PlugInImageVals * image_vals,
+        PlugInDrawableVals * drawable_vals,
+        PlugInVals * vals,
+        gint * sizes,
+        gint n_sizes,
+        gboolean display,
+        gint32 * out_layer_IDs);
+
+gboolean
+render_replay (PlugInImageVals * image_vals,
+        PlugInDrawableVals * drawable_vals,
+        PlugInVals * vals,
+        const gchar * seams_file,
+        gint size,
+        gboolean display,
+        gint32 * out_layer_ID_p);
+
 gboolean
 render_interactive (PlugInVals * vals,
         CarverData * carver_data);
@@ -66,4 +113,7 @@ render_dump_vmap (PlugInVals * vals,
         CarverData * carver_data,
         gint32 * vmap_layer_ID_p);
 
+void
+render_clear_commits (CarverData * carver_data);
+
 #endif /* __RENDER_H__ */
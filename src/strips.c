@@ -0,0 +1,322 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <libgimp/gimp.h>
+#include <lqr.h>
+
+#include "plugin-intl.h"
+
+#include "main.h"
+#include "io_functions.h"
+#include "proxy.h"
+#include "strips.h"
+
+#define MEM_CHECK(x) if ((x) == NULL) { g_message(_("Not enough memory")); return FALSE; }
+
+/* bands shorter than this would leave no room to refine the seams */
+#define STRIPS_MIN_ROWS (16)
+
+typedef struct
+{
+  gint factor;
+  gint p_reach;
+  gint band_rows;       /* rows read and refined at once */
+  gint commit_rows;     /* rows of a band which are written, the
+                         * others are read again with the next band */
+} StripsPlan;
+
+/* static functions declarations */
+
+static gboolean strips_plan (gint width, gint height, gint bpp, gint orientation, gint reach,
+                             gint min_factor, guint64 budget, StripsPlan * plan);
+static guchar * strips_proxy_buffer (PixelIO * io, gint width, gint height, gint bpp,
+                                     gint factor);
+static void strips_compact (const guchar * band, const gint * ranks, gint buf_width,
+                            gint n_u, gint n_rows, gint bpp, gint orientation,
+                            guchar * out, gint out_width);
+
+
+gboolean
+strips_shrink_layer (PlugInVals * vals, gint32 layer_ID,
+                     gint x_off, gint y_off,
+                     gint orientation, gint reach,
+                     gfloat rigidity, gboolean ignore_disc_mask,
+                     guint64 budget, LqrProgress * progress)
+{
+  PlugInVals p_vals;
+  StripsPlan plan;
+  PixelIO *io_in;
+  PixelIO *io_out;
+  guchar *p_buffer;
+  guchar *band = NULL;
+  guchar *out = NULL;
+  gint *ranks = NULL;
+  gint *last = NULL;
+  gint *guides;
+  gint width, height, bpp;
+  gint n_u, n_v, p_n_v;
+  gint v0, n_rows, n_commit, buf_width, out_width;
+  gint i;
+  gboolean ok = FALSE;
+
+  width = gimp_drawable_width (layer_ID);
+  height = gimp_drawable_height (layer_ID);
+  bpp = drawable_channels (layer_ID);
+  n_u = (orientation == 0) ? width : height;
+  n_v = (orientation == 0) ? height : width;
+
+  if (!strips_plan (width, height, bpp, orientation, reach, vals->proxy_factor, budget, &plan))
+    {
+      g_message (_("Error: the memory limit is too low for this image"));
+      return FALSE;
+    }
+
+  p_vals = *vals;
+  p_vals.proxy_factor = plan.factor;
+  p_n_v = n_v / plan.factor;
+
+  MEM_CHECK (io_in = pixel_io_open (layer_ID, PIXEL_IO_READ));
+
+  p_buffer = strips_proxy_buffer (io_in, width, height, bpp, plan.factor);
+  guides = p_buffer ? proxy_guides_new (&p_vals, p_buffer, width, height, bpp, x_off, y_off,
+                                        rigidity, ignore_disc_mask, orientation, plan.p_reach,
+                                        progress) : NULL;
+  if (guides == NULL)
+    {
+      pixel_io_close (io_in, FALSE);
+      g_message (_("Not enough memory"));
+      return FALSE;
+    }
+
+  band = g_try_new (guchar, (gsize) n_u * plan.band_rows * bpp);
+  ranks = g_try_new (gint, (gsize) n_u * plan.band_rows);
+  /* the last band commits all of its rows */
+  out = g_try_new (guchar, (gsize) (n_u - reach) * plan.band_rows * bpp);
+  last = g_try_new (gint, reach);
+  io_out = (band && ranks && out && last) ? pixel_io_open (layer_ID, PIXEL_IO_WRITE) : NULL;
+  if (io_out == NULL)
+    {
+      g_message (_("Not enough memory"));
+      goto out;
+    }
+
+  for (i = 0; i < reach; i++)
+    {
+      last[i] = -1;
+    }
+
+  for (v0 = 0; v0 < n_v; v0 += n_commit)
+    {
+      n_rows = MIN (plan.band_rows, n_v - v0);
+      n_commit = (n_rows == n_v - v0) ? n_rows : plan.commit_rows;
+
+      gimp_progress_init_printf (_("Resizing band %d of %d..."),
+                                 v0 / plan.commit_rows + 1,
+                                 (n_v + plan.commit_rows - 1) / plan.commit_rows);
+
+      if (orientation == 0)
+        {
+          buf_width = n_u;
+          pixel_io_get_rect (io_in, band, (gsize) n_u * bpp, 0, v0, n_u, n_rows);
+        }
+      else
+        {
+          buf_width = n_rows;
+          pixel_io_get_rect (io_in, band, (gsize) n_rows * bpp, v0, 0, n_rows, n_u);
+        }
+
+      memset (ranks, 0, (gsize) n_u * n_rows * sizeof (gint));
+      if (!proxy_refine_band (band, buf_width, bpp, orientation, n_u, v0, n_rows,
+                              reach, plan.factor, vals->delta_x, guides, plan.p_reach, p_n_v,
+                              ranks, last, n_commit - 1))
+        {
+          gimp_progress_end ();
+          pixel_io_close (io_out, FALSE);
+          g_message (_("Not enough memory"));
+          goto out;
+        }
+
+      out_width = (orientation == 0) ? n_u - reach : n_commit;
+      strips_compact (band, ranks, buf_width, n_u, n_commit, bpp, orientation, out, out_width);
+      if (orientation == 0)
+        {
+          pixel_io_set_rect (io_out, out, (gsize) out_width * bpp, 0, v0, n_u - reach, n_commit);
+        }
+      else
+        {
+          pixel_io_set_rect (io_out, out, (gsize) out_width * bpp, v0, 0, n_commit, n_u - reach);
+        }
+
+      gimp_progress_end ();
+    }
+
+  pixel_io_close (io_out, TRUE);
+
+  /* the carved pixels are at the top left corner */
+  if (orientation == 0)
+    {
+      gimp_layer_resize (layer_ID, width - reach, height, 0, 0);
+    }
+  else
+    {
+      gimp_layer_resize (layer_ID, width, height - reach, 0, 0);
+    }
+
+  ok = TRUE;
+
+out:
+  pixel_io_close (io_in, FALSE);
+  g_free (guides);
+  g_free (band);
+  g_free (ranks);
+  g_free (out);
+  g_free (last);
+
+  return ok;
+}
+
+/* Picks the smallest proxy factor (not below min_factor) for which
+ * carving the proxy fits in the budget, then the tallest band which
+ * fits in what is left once the proxy carver is gone */
+static gboolean
+strips_plan (gint width, gint height, gint bpp, gint orientation, gint reach,
+             gint min_factor, guint64 budget, StripsPlan * plan)
+{
+  gint factor;
+  gint pw, ph;
+  gint n_u, n_v, p_n_u, p_n_v;
+  gint p_reach;
+  guint64 guides_bytes;
+  guint64 proxy_bytes;
+  guint64 row_bytes;
+  guint64 rows;
+
+  n_u = (orientation == 0) ? width : height;
+  n_v = (orientation == 0) ? height : width;
+
+  for (factor = MAX (min_factor, 2); ; factor++)
+    {
+      pw = width / factor;
+      ph = height / factor;
+      p_n_u = (orientation == 0) ? pw : ph;
+      p_n_v = (orientation == 0) ? ph : pw;
+      p_reach = (reach + factor - 1) / factor;
+      if ((p_n_v < 1) || (p_reach >= p_n_u))
+        {
+          return FALSE;
+        }
+
+      guides_bytes = (guint64) p_n_v * p_reach * sizeof (gint);
+      proxy_bytes = (guint64) pw * ph * (bpp + CARVER_PIXEL_BYTES) +
+        (guint64) 2 * factor * width * bpp + (guint64) pw * bpp * sizeof (guint32) +
+        guides_bytes;
+      if (proxy_bytes <= budget)
+        {
+          break;
+        }
+    }
+
+  /* the band, its ranks, the carved rows and the candidates of the
+   * refinement */
+  if (guides_bytes + (guint64) reach * sizeof (gint) >= budget)
+    {
+      return FALSE;
+    }
+  row_bytes = (guint64) n_u * (bpp + sizeof (gint)) + (guint64) (n_u - reach) * bpp +
+    (guint64) 3 * factor * (2 * sizeof (gint) + sizeof (gint64)) + sizeof (gint);
+  rows = (budget - guides_bytes - (guint64) reach * sizeof (gint)) / row_bytes;
+  if (rows < MIN (STRIPS_MIN_ROWS, n_v))
+    {
+      return FALSE;
+    }
+
+  plan->factor = factor;
+  plan->p_reach = p_reach;
+  plan->band_rows = MIN (rows, (guint64) n_v);
+  plan->commit_rows = (plan->band_rows == n_v) ? n_v : plan->band_rows - plan->band_rows / 4;
+
+  return TRUE;
+}
+
+/* Builds the proxy reading the layer one row of blocks at a time */
+static guchar *
+strips_proxy_buffer (PixelIO * io, gint width, gint height, gint bpp, gint factor)
+{
+  gint pw, ph, py, y0, y1;
+  guint32 *sums;
+  guchar *rows;
+  guchar *p_buffer;
+
+  pw = width / factor;
+  ph = height / factor;
+
+  LQR_TRY_N_N (p_buffer = g_try_new (guchar, (gsize) pw * ph * bpp));
+  sums = g_try_new (guint32, (gsize) pw * bpp);
+  rows = g_try_new (guchar, (gsize) 2 * factor * width * bpp);
+  if ((sums == NULL) || (rows == NULL))
+    {
+      g_free (rows);
+      g_free (sums);
+      g_free (p_buffer);
+      return NULL;
+    }
+
+  gimp_progress_init (_("Parsing layer..."));
+  for (py = 0; py < ph; py++)
+    {
+      y0 = py * factor;
+      y1 = (py == ph - 1) ? height : y0 + factor;
+      pixel_io_get_rect (io, rows, (gsize) width * bpp, 0, y0, width, y1 - y0);
+      proxy_reduce_rows (rows, y1 - y0, width, bpp, factor, sums,
+                         p_buffer + (gsize) py * pw * bpp);
+      gimp_progress_update ((gdouble) (py + 1) / ph);
+    }
+  gimp_progress_end ();
+
+  g_free (rows);
+  g_free (sums);
+
+  return p_buffer;
+}
+
+/* Copies the pixels of the first n_rows rows of the band which are
+ * not on any seam */
+static void
+strips_compact (const guchar * band, const gint * ranks, gint buf_width,
+                gint n_u, gint n_rows, gint bpp, gint orientation,
+                guchar * out, gint out_width)
+{
+  gint u, v, i;
+
+  for (v = 0; v < n_rows; v++)
+    {
+      for (u = 0, i = 0; u < n_u; u++)
+        {
+          if (ranks[PROXY_INDEX (u, v, buf_width, orientation)] == 0)
+            {
+              memcpy (out + PROXY_INDEX (i, v, out_width, orientation) * bpp,
+                      band + PROXY_INDEX (u, v, buf_width, orientation) * bpp, bpp);
+              i++;
+            }
+        }
+    }
+}
@@ -0,0 +1,46 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+#ifndef __STRIPS_H__
+#define __STRIPS_H__
+
+#ifndef __LQR_H__
+#error "lqr/lqr.h must be included prior to strips.h"
+#endif /* __LQR_H__ */
+
+/* Memory used by liblqr for each pixel of a carver, besides the
+ * pixels themselves: energy, bias, cumulative energy, visibility,
+ * positions and rigidity mask */
+#define CARVER_PIXEL_BYTES (32)
+
+/* Strip carving: the layer is shrunk along one direction within a
+ * memory budget, in bytes. The seams are searched for on a proxy
+ * (see proxy.h) scaled down enough to fit, then refined in bands of
+ * rows along the seams, each band overlapping the next one; the
+ * carved bands are written back to the layer, which is then
+ * cropped. Only the proxy and one band are held in memory at a
+ * time, never the whole layer. The masks in vals are aligned to
+ * x_off and y_off. */
+
+gboolean strips_shrink_layer (PlugInVals * vals, gint32 layer_ID,
+                              gint x_off, gint y_off,
+                              gint orientation, gint reach,
+                              gfloat rigidity, gboolean ignore_disc_mask,
+                              guint64 budget, LqrProgress * progress);
+
+#endif /* __STRIPS_H__ */
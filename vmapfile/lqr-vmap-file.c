@@ -0,0 +1,398 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+/* This file must not depend on glib nor GIMP: it is meant to be
+ * built into programs which only render seam map files */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif /* HAVE_CONFIG_H */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif /* HAVE_SYS_MMAN_H */
+
+#include "lqr-vmap-file.h"
+
+struct _LqrVMapFile
+{
+  int width;
+  int height;
+  int depth;
+  int orientation;
+  int rank_bytes;
+  unsigned char *data;          /* the whole file */
+  size_t size;
+  int mapped;
+};
+
+static void
+put_u32 (unsigned char *p, unsigned long v)
+{
+  p[0] = v & 0xff;
+  p[1] = (v >> 8) & 0xff;
+  p[2] = (v >> 16) & 0xff;
+  p[3] = (v >> 24) & 0xff;
+}
+
+static unsigned long
+get_u32 (const unsigned char *p)
+{
+  return (unsigned long) p[0] | ((unsigned long) p[1] << 8) |
+    ((unsigned long) p[2] << 16) | ((unsigned long) p[3] << 24);
+}
+
+static int
+rank_bytes_for_depth (int depth)
+{
+  if (depth < 0x100)
+    {
+      return 1;
+    }
+  if (depth < 0x10000)
+    {
+      return 2;
+    }
+  return 4;
+}
+
+static unsigned long
+get_rank (const unsigned char *p, int rank_bytes)
+{
+  switch (rank_bytes)
+    {
+    case 1:
+      return p[0];
+    case 2:
+      return (unsigned long) p[0] | ((unsigned long) p[1] << 8);
+    default:
+      return get_u32 (p);
+    }
+}
+
+int
+lqr_vmap_file_write (const char *filename, const int *ranks,
+                     int width, int height, int depth, int orientation)
+{
+  FILE *f;
+  unsigned char header[LQR_VMAP_FILE_HEADER_SIZE];
+  unsigned char *row;
+  int rank_bytes;
+  int x, y, k;
+  unsigned long v;
+  int ret_val = 0;
+
+  if ((width < 1) || (height < 1) || (depth < 0) ||
+      ((orientation != 0) && (orientation != 1)))
+    {
+      return -1;
+    }
+
+  rank_bytes = rank_bytes_for_depth (depth);
+
+  memset (header, 0, LQR_VMAP_FILE_HEADER_SIZE);
+  memcpy (header, LQR_VMAP_FILE_MAGIC, strlen (LQR_VMAP_FILE_MAGIC));
+  put_u32 (header + 8, LQR_VMAP_FILE_VERSION);
+  put_u32 (header + 12, width);
+  put_u32 (header + 16, height);
+  put_u32 (header + 20, depth);
+  put_u32 (header + 24, orientation);
+  put_u32 (header + 28, rank_bytes);
+
+  row = malloc ((size_t) width * rank_bytes);
+  if (row == NULL)
+    {
+      return -1;
+    }
+
+  f = fopen (filename, "wb");
+  if (f == NULL)
+    {
+      free (row);
+      return -1;
+    }
+
+  if (fwrite (header, LQR_VMAP_FILE_HEADER_SIZE, 1, f) != 1)
+    {
+      ret_val = -1;
+    }
+
+  for (y = 0; (y < height) && (ret_val == 0); y++)
+    {
+      for (x = 0; x < width; x++)
+        {
+          v = ranks[(size_t) y * width + x];
+          for (k = 0; k < rank_bytes; k++)
+            {
+              row[x * rank_bytes + k] = (v >> (8 * k)) & 0xff;
+            }
+        }
+      if (fwrite (row, (size_t) width * rank_bytes, 1, f) != 1)
+        {
+          ret_val = -1;
+        }
+    }
+
+  if (fclose (f) != 0)
+    {
+      ret_val = -1;
+    }
+  free (row);
+
+  return ret_val;
+}
+
+static int
+read_whole_file (LqrVMapFile * vf, const char *filename)
+{
+  FILE *f;
+  long size;
+
+  f = fopen (filename, "rb");
+  if (f == NULL)
+    {
+      return -1;
+    }
+  if ((fseek (f, 0, SEEK_END) != 0) || ((size = ftell (f)) < 0) ||
+      (fseek (f, 0, SEEK_SET) != 0))
+    {
+      fclose (f);
+      return -1;
+    }
+  vf->size = size;
+  vf->data = malloc (vf->size ? vf->size : 1);
+  if ((vf->data == NULL) || (fread (vf->data, 1, vf->size, f) != vf->size))
+    {
+      free (vf->data);
+      vf->data = NULL;
+      fclose (f);
+      return -1;
+    }
+  fclose (f);
+  return 0;
+}
+
+#ifdef HAVE_SYS_MMAN_H
+static int
+map_whole_file (LqrVMapFile * vf, const char *filename)
+{
+  int fd;
+  struct stat st;
+  void *data;
+
+  fd = open (filename, O_RDONLY);
+  if (fd < 0)
+    {
+      return -1;
+    }
+  if ((fstat (fd, &st) != 0) || (st.st_size <= 0) ||
+      ((unsigned long long) st.st_size > (size_t) -1))
+    {
+      close (fd);
+      return -1;
+    }
+  data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    {
+      return -1;
+    }
+  vf->data = data;
+  vf->size = st.st_size;
+  vf->mapped = 1;
+  return 0;
+}
+#endif /* HAVE_SYS_MMAN_H */
+
+/* The file is mapped in memory where possible, otherwise read */
+LqrVMapFile *
+lqr_vmap_file_open (const char *filename)
+{
+  LqrVMapFile *vf;
+  unsigned long width, height, depth, orientation, rank_bytes;
+  unsigned long long expected;
+
+  vf = calloc (1, sizeof (LqrVMapFile));
+  if (vf == NULL)
+    {
+      return NULL;
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+  if (map_whole_file (vf, filename) != 0)
+#endif /* HAVE_SYS_MMAN_H */
+    {
+      if (read_whole_file (vf, filename) != 0)
+        {
+          free (vf);
+          return NULL;
+        }
+    }
+
+  if ((vf->size < LQR_VMAP_FILE_HEADER_SIZE) ||
+      (memcmp (vf->data, LQR_VMAP_FILE_MAGIC, strlen (LQR_VMAP_FILE_MAGIC) + 1) != 0) ||
+      (get_u32 (vf->data + 8) != LQR_VMAP_FILE_VERSION))
+    {
+      lqr_vmap_file_close (vf);
+      return NULL;
+    }
+
+  width = get_u32 (vf->data + 12);
+  height = get_u32 (vf->data + 16);
+  depth = get_u32 (vf->data + 20);
+  orientation = get_u32 (vf->data + 24);
+  rank_bytes = get_u32 (vf->data + 28);
+
+  expected = LQR_VMAP_FILE_HEADER_SIZE +
+    (unsigned long long) width * height * rank_bytes;
+  if ((width < 1) || (width > INT_MAX) || (height < 1) || (height > INT_MAX) ||
+      (depth > INT_MAX) || (orientation > 1) ||
+      (rank_bytes != (unsigned long) rank_bytes_for_depth (depth)) ||
+      (expected != vf->size))
+    {
+      lqr_vmap_file_close (vf);
+      return NULL;
+    }
+
+  vf->width = width;
+  vf->height = height;
+  vf->depth = depth;
+  vf->orientation = orientation;
+  vf->rank_bytes = rank_bytes;
+
+  return vf;
+}
+
+void
+lqr_vmap_file_close (LqrVMapFile * vf)
+{
+  if (vf == NULL)
+    {
+      return;
+    }
+#ifdef HAVE_SYS_MMAN_H
+  if (vf->mapped)
+    {
+      munmap (vf->data, vf->size);
+    }
+  else
+#endif /* HAVE_SYS_MMAN_H */
+    {
+      free (vf->data);
+    }
+  free (vf);
+}
+
+int
+lqr_vmap_file_get_width (const LqrVMapFile * vf)
+{
+  return vf->width;
+}
+
+int
+lqr_vmap_file_get_height (const LqrVMapFile * vf)
+{
+  return vf->height;
+}
+
+int
+lqr_vmap_file_get_depth (const LqrVMapFile * vf)
+{
+  return vf->depth;
+}
+
+int
+lqr_vmap_file_get_orientation (const LqrVMapFile * vf)
+{
+  return vf->orientation;
+}
+
+int
+lqr_vmap_file_get_rank (const LqrVMapFile * vf, int x, int y)
+{
+  return get_rank (vf->data + LQR_VMAP_FILE_HEADER_SIZE +
+                   ((size_t) y * vf->width + x) * vf->rank_bytes, vf->rank_bytes);
+}
+
+/* A pixel is kept if it is not removed by the first (extent - size)
+ * seams; each seam removes exactly one pixel per row (or column), so
+ * with vertical seams the kept pixels just follow each other in the
+ * output, with horizontal ones each column has its own output row */
+int
+lqr_vmap_file_render (const LqrVMapFile * vf, const unsigned char *src,
+                      int channels, int size, unsigned char *dest)
+{
+  const unsigned char *rank_p;
+  unsigned char *out;
+  unsigned long removed, rank;
+  int extent;
+  int *next_row = NULL;
+  int x, y;
+
+  extent = vf->orientation ? vf->height : vf->width;
+  if ((size < 1) || (size > extent) || (extent - size > vf->depth) || (channels < 1))
+    {
+      return -1;
+    }
+  removed = extent - size;
+
+  if (vf->orientation)
+    {
+      next_row = calloc (vf->width, sizeof (int));
+      if (next_row == NULL)
+        {
+          return -1;
+        }
+    }
+
+  rank_p = vf->data + LQR_VMAP_FILE_HEADER_SIZE;
+  out = dest;
+  for (y = 0; y < vf->height; y++)
+    {
+      for (x = 0; x < vf->width; x++, src += channels, rank_p += vf->rank_bytes)
+        {
+          rank = get_rank (rank_p, vf->rank_bytes);
+          if ((rank != 0) && (rank <= removed))
+            {
+              continue;
+            }
+          if (vf->orientation)
+            {
+              out = dest + ((size_t) next_row[x]++ * vf->width + x) * channels;
+              memcpy (out, src, channels);
+            }
+          else
+            {
+              memcpy (out, src, channels);
+              out += channels;
+            }
+        }
+    }
+
+  free (next_row);
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+/* GIMP LiquidRescale Plug-in
+ * Copyright (C) 2007-2010 Carlo Baldassi (the "Author") <carlobaldassi@gmail.com>.
+ * All Rights Reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the Licence, or
+ * (at your option) any later version.
+
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org.licences/>.
+ */
+
+#ifndef __LQR_VMAP_FILE_H__
+#define __LQR_VMAP_FILE_H__
+
+/* Seam map files
+ *
+ * A seam map file holds the visibility map of a carved image: for
+ * each pixel, the rank of the seam which removes it (1 for the first
+ * seam, up to the depth of the map), or 0 if it is never removed.
+ * Any size down to (original size - depth) along the direction of
+ * the map can then be rendered from the original image in a single
+ * pass, without the plug-in nor liblqr.
+ *
+ * Layout, all integers are unsigned little-endian 32 bit:
+ *
+ *   magic        8 bytes, "LQRVMAP" and a NUL
+ *   version      LQR_VMAP_FILE_VERSION
+ *   width        of the original image
+ *   height       of the original image
+ *   depth        number of seams in the map
+ *   orientation  0 for vertical seams (the width changes), 1 for
+ *                horizontal seams (the height changes)
+ *   rank_bytes   1, 2 or 4, the smallest size which holds depth
+ *   ranks        width * height ranks of rank_bytes each, by rows
+ *
+ * Ranks are not compressed, so that files can be mapped in memory
+ * and read in place. */
+
+#define LQR_VMAP_FILE_MAGIC "LQRVMAP"
+#define LQR_VMAP_FILE_VERSION (1)
+#define LQR_VMAP_FILE_HEADER_SIZE (32)
+
+typedef struct _LqrVMapFile LqrVMapFile;
+
+/* Writing; returns 0 on success, -1 on failure */
+
+int lqr_vmap_file_write (const char *filename, const int *ranks,
+                         int width, int height, int depth, int orientation);
+
+/* Reading */
+
+LqrVMapFile *lqr_vmap_file_open (const char *filename);
+void lqr_vmap_file_close (LqrVMapFile * vf);
+
+int lqr_vmap_file_get_width (const LqrVMapFile * vf);
+int lqr_vmap_file_get_height (const LqrVMapFile * vf);
+int lqr_vmap_file_get_depth (const LqrVMapFile * vf);
+int lqr_vmap_file_get_orientation (const LqrVMapFile * vf);
+int lqr_vmap_file_get_rank (const LqrVMapFile * vf, int x, int y);
+
+/* Renders the original image src (width * height pixels of channels
+ * bytes, by rows) at the given size along the direction of the map
+ * into dest, which must hold the resulting image; returns 0 on
+ * success, -1 if the size is out of the range of the map */
+
+int lqr_vmap_file_render (const LqrVMapFile * vf, const unsigned char *src,
+                          int channels, int size, unsigned char *dest);
+
+#endif /* __LQR_VMAP_FILE_H__ */